@@ -0,0 +1,61 @@
+/** @file
+    Software gain control driven by the detector statistics.
+
+    Steps through the tuner gain table one entry at a time: down when the
+    input clips or the channel noise floor is high, up when the noise floor
+    is close to the ADC quantization noise and the input does not clip.
+    The gap between the limits is the hysteresis, and after each change
+    the loop holds off until the noise floor estimates have settled.
+*/
+
+#ifndef INCLUDE_AGC_H_
+#define INCLUDE_AGC_H_
+
+#include <stdint.h>
+#include "parser.h"
+#include "sdr.h"
+
+#define AGC_INTERVAL    0.5  // seconds of samples per decision
+#define AGC_HOLD        3.0  // seconds of samples after a gain change
+#define AGC_CLIP_HIGH   1e-4 // clipped input ratio that lowers the gain
+#define AGC_CLIP_LOW    1e-6 // clipped input ratio that allows raising the gain
+#define AGC_NOISE_HIGH  -30  // dB noise floor that lowers the gain
+#define AGC_NOISE_LOW   -50  // dB noise floor that raises the gain
+
+typedef struct agc {
+    int gains[SDR_MAX_GAINS]; ///< tuner gains in tenths of a dB, ascending
+    int num_gains;
+    int index;                ///< current gain
+    uint64_t interval;        ///< samples per decision
+    uint64_t hold;            ///< samples to wait after a change
+    uint64_t next_sample;     ///< sample position of the next decision
+    uint64_t last_samples;
+    uint64_t last_clipped;
+} agc_t;
+
+/** Set up the gain control.
+
+    @param agc the gain control state
+    @param gains tuner gains in tenths of a dB, ascending
+    @param num_gains number of gains
+    @param gain initial gain in tenths of a dB, the nearest table entry is used
+    @param samp_rate input sample rate
+    @return 0 on success, -1 if the gain table is empty
+*/
+int agc_init(agc_t *agc, int const *gains, int num_gains, int gain, uint32_t samp_rate);
+
+/** Update from the detector statistics.
+
+    @param agc the gain control state
+    @param stats current detector statistics
+    @return -1 or 1 if the gain was stepped down or up, 0 otherwise
+*/
+int agc_update(agc_t *agc, mrbeam_stats_t const *stats);
+
+/// Current gain in tenths of a dB.
+static inline int agc_gain(agc_t const *agc)
+{
+    return agc->gains[agc->index];
+}
+
+#endif /* INCLUDE_AGC_H_ */
@@ -0,0 +1,80 @@
+/** @file
+    Batch replay of capture files on a pool of detectors.
+
+    Every capture runs through a detector instance of its own, the
+    captures are spread over the threads of a fork-join pool. The events
+    of a capture go to a log next to it, named after the capture with the
+    extension of the output format appended. Detectors of a batch run
+    their channels serially, the pool is busy enough with the files.
+
+    With a tolerance set, the events of each capture are also matched
+    against the ground truth in <capture>.truth, see evaluate.h, and the
+    CPU time of each replay is measured on its thread.
+*/
+
+#ifndef INCLUDE_BATCH_H_
+#define INCLUDE_BATCH_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "rtl_mrbeam.h"
+#include "parser.h"
+#include "evaluate.h"
+
+/// A capture of a batch and what its replay found.
+typedef struct batch_file {
+    char *path;
+    mrbeam_format_t format;
+    float full_scale;
+
+    int failed;                              ///< could not be read or its log not written
+    int channels;                            ///< channels in the plan of the replay
+    uint64_t samples;                        ///< input samples replayed
+    uint64_t clipped;
+    unsigned events;                         ///< all events
+    unsigned channel_events[MRBEAM_CHANNELS];
+    double secs;                             ///< processing time
+    eval_result_t eval;                      ///< accuracy and CPU time, with a tolerance set
+} batch_file_t;
+
+/** Set up a detector for a capture with the plan and options of the batch.
+
+    @param ctx setup context
+    @return the detector, NULL on failure
+*/
+typedef void *(*batch_setup_t)(void *ctx);
+
+typedef struct batch {
+    r_cfg_t *cfg;        ///< report options, block size, sample rate, scan time and do_exit
+    batch_setup_t setup;
+    void *setup_ctx;
+    batch_file_t *files;
+    int count;
+    double tolerance;    ///< seconds a detection may be off the ground truth, 0 for no evaluation
+} batch_t;
+
+/** Replay all captures of a batch.
+
+    @param batch the batch, results are filled in per file
+    @param jobs captures to replay at a time
+    @return 0 if all captures were replayed, -1 otherwise
+*/
+int batch_run(batch_t *batch, int jobs);
+
+/** Write a line per capture and the totals.
+
+    @param batch the batch after batch_run()
+    @param out the summary output
+    @param elapsed wall clock seconds of the run
+*/
+void batch_summary(batch_t const *batch, FILE *out, double elapsed);
+
+/** Write a JSON line of accuracy and cost per evaluated capture and the total.
+
+    @param batch the batch after batch_run() with a tolerance
+    @param out the report output
+*/
+void batch_evaluation(batch_t const *batch, FILE *out);
+
+#endif /* INCLUDE_BATCH_H_ */
@@ -0,0 +1,60 @@
+/** @file
+    Parallel replay of one capture in chunks with a deterministic merge.
+
+    The capture is cut into chunks on the block grid of a sequential
+    replay. Each chunk runs through a detector of its own that starts an
+    overlap earlier, so its noise floor, I/Q estimate and pulse counts
+    have settled by the time the chunk begins; only the events inside
+    the chunk are kept. Warm-up starts are rounded down to the detector
+    alignment, so decimation phase and correlation windows fall on the
+    same samples as in a sequential replay; I/Q estimates align to the
+    start position by themselves.
+
+    The chunks run on a fork-join pool. Afterwards each chunk's starting
+    state is checked against the state the previous chunk ended with; a
+    chunk that started out differently, e.g. in the middle of a light
+    whose pulses began before the overlap, is replayed again by the
+    previous detector. The events are then reported in sample order,
+    the same as a sequential replay.
+*/
+
+#ifndef INCLUDE_CHUNK_REPLAY_H_
+#define INCLUDE_CHUNK_REPLAY_H_
+
+#include <stdint.h>
+
+#include "rtl_mrbeam.h"
+#include "parser.h"
+
+/** Set up a detector with the plan and options of the replay.
+
+    @param ctx setup context
+    @return the detector, NULL on failure
+*/
+typedef void *(*chunk_setup_t)(void *ctx);
+
+typedef struct chunk_replay {
+    r_cfg_t *cfg;             ///< block size, sample rate and do_exit
+    chunk_setup_t setup;
+    void *setup_ctx;
+    char const *path;
+    mrbeam_format_t format;
+    float full_scale;
+    double overlap;           ///< seconds of warm-up before each chunk
+    mrbeam_event_cb_t event_cb; ///< gets the merged events, may block
+    void *event_ctx;
+
+    int chunks;               ///< chunks replayed
+    int reruns;               ///< chunks replayed again in sequence
+    mrbeam_stats_t stats;     ///< stats at the end of the capture, clipped counts the chunks only
+} chunk_replay_t;
+
+/** Replay a capture in chunks.
+
+    @param replay the replay, results are filled in
+    @param jobs chunks to replay at a time
+    @return 0 on success, -1 otherwise
+*/
+int chunk_replay_run(chunk_replay_t *replay, int jobs);
+
+#endif /* INCLUDE_CHUNK_REPLAY_H_ */
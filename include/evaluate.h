@@ -0,0 +1,84 @@
+/** @file
+    Detection accuracy of a replay against ground truth.
+
+    The ground truth of a capture is a sidecar text file with a line per
+    light, the time in seconds from the start of the capture and the
+    channel as reported in events, e.g. "12.50 2"; "#" starts a comment.
+    A detection on the channel within the tolerance of a true light finds
+    it, the first detection of a light sets the timing error; further
+    detections of a found light count as duplicates, the others as false
+    alarms.
+
+    Precision is found lights per detection, so duplicates count against
+    it like false alarms; precision_ignoring_duplicates counts only the
+    false alarms against it.
+*/
+
+#ifndef INCLUDE_EVALUATE_H_
+#define INCLUDE_EVALUATE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "parser.h"
+
+#define EVAL_TRUTH_EXT ".truth"
+
+/// A true light.
+typedef struct eval_truth {
+    double time;   ///< seconds from the start of the capture
+    int channel;
+} eval_truth_t;
+
+/// Accuracy counts, added up over captures.
+typedef struct eval_result {
+    unsigned truth;         ///< true lights
+    unsigned detected;      ///< events
+    unsigned found;         ///< true lights with a detection
+    unsigned duplicates;    ///< further detections of a found light
+    unsigned false_alarms;  ///< detections of no true light
+    double err_sum;         ///< sum of the timing errors in seconds, detection after truth is positive
+    double err_sq;          ///< sum of the squared timing errors
+    double err_max;         ///< largest absolute timing error
+    double signal_secs;     ///< seconds of capture
+    double cpu_secs;        ///< CPU seconds of the replay
+} eval_result_t;
+
+/** Read a ground truth sidecar.
+
+    @param path the sidecar
+    @param[out] truth the true lights in time order, release with free()
+    @return the true lights, -1 if the file is missing or invalid
+*/
+int eval_load_truth(char const *path, eval_truth_t **truth);
+
+/** Match the events of a replay against the ground truth.
+
+    @param truth the true lights in time order
+    @param count true lights
+    @param ev the events in sample order
+    @param events events
+    @param samp_rate sample rate of the capture
+    @param tolerance seconds a detection may be off
+    @param[out] result the counts, signal_secs and cpu_secs are left as they are
+*/
+void eval_match(eval_truth_t const *truth, int count, mrbeam_event_t const *ev, int events,
+        uint32_t samp_rate, double tolerance, eval_result_t *result);
+
+/** Add the counts of a capture to a total.
+
+    @param total the total
+    @param result the counts of a capture
+*/
+void eval_add(eval_result_t *total, eval_result_t const *result);
+
+/** Write a JSON line with the counts, precision (found / detected), precision ignoring duplicates
+    ((detected - false alarms) / detected), recall, timing error and CPU per signal second.
+
+    @param out the report output
+    @param name capture path or "total"
+    @param result the counts
+*/
+void eval_report(FILE *out, char const *name, eval_result_t const *result);
+
+#endif /* INCLUDE_EVALUATE_H_ */
@@ -0,0 +1,85 @@
+/** @file
+    Allocation-free event serializer, JSON lines or fixed-width binary.
+
+    All output goes to caller-provided buffers. The formatted date/time
+    prefix is cached per second, so the common case of several events in
+    the same second costs no localtime() or strftime() call.
+*/
+
+#ifndef INCLUDE_EVENT_FMT_H_
+#define INCLUDE_EVENT_FMT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "rtl_mrbeam.h"
+#include "parser.h"
+
+typedef enum {
+    EVENT_FMT_PLAIN,  ///< bare channel number per line (legacy), confirmations are marked
+    EVENT_FMT_JSON,   ///< one JSON object per line
+    EVENT_FMT_BINARY, ///< event_record_t per event
+} event_fmt_mode_t;
+
+#define EVENT_RECORD_MAGIC   0x5645424d /* "MBEV" little endian */
+#define EVENT_RECORD_VERSION 2
+
+/// Fixed-width binary event, little endian on all supported hosts.
+#pragma pack(push, 1)
+typedef struct event_record {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t channel;
+    int64_t time_us;     ///< microseconds since the epoch
+    uint64_t sample_pos; ///< input sample position
+    uint32_t count;      ///< pulses counted
+    float level_db;      ///< peak level in dB full scale
+    float snr_db;        ///< NaN if unknown
+    uint32_t freq;       ///< channel frequency in Hz, 0 if unknown
+    uint16_t kind;       ///< mrbeam_event_kind_t, since version 2
+    uint16_t reserved;
+    float confidence;    ///< chance an early event is not noise, 1 otherwise
+} event_record_t;
+#pragma pack(pop)
+
+#define EVENT_RECORD_SIZE 48 // wire size of version 2, as documented in -O help
+// C11 in a C99 tree, __extension__ keeps -pedantic quiet
+__extension__ _Static_assert(sizeof(event_record_t) == EVENT_RECORD_SIZE, "event_record_t wire size changed");
+
+/// Upper bound of one serialized event in any mode.
+#define EVENT_FMT_MAX 192
+
+typedef struct event_fmt {
+    event_fmt_mode_t mode;
+    time_mode_t report_time;
+    int report_time_hires;
+    int report_time_tz;
+    int report_time_utc;
+    int report_meta;
+
+    // cached time prefix of the current second
+    time_t cached_sec;
+    int prefix_len;
+    char prefix[32];
+    int suffix_len;
+    char suffix[8];
+} event_fmt_t;
+
+/** Set up a serializer from the report options.
+
+    @param fmt the serializer state
+    @param mode output mode
+    @param cfg report_time, report_time_hires, report_time_tz, report_time_utc and report_meta are used
+*/
+void event_fmt_init(event_fmt_t *fmt, event_fmt_mode_t mode, r_cfg_t const *cfg);
+
+/** Serialize one event.
+
+    @param fmt the serializer state
+    @param ev the event
+    @param[out] buf output buffer of at least EVENT_FMT_MAX bytes
+    @return number of bytes written (no terminating zero for binary)
+*/
+int event_fmt_write(event_fmt_t *fmt, mrbeam_event_t const *ev, char *buf);
+
+#endif /* INCLUDE_EVENT_FMT_H_ */
@@ -0,0 +1,71 @@
+/** @file
+    Asynchronous, batched event output.
+
+    The detector pushes fixed-size event records into a lock-free
+    single-producer single-consumer queue. A writer thread drains the
+    queue in batches and hands them to every configured sink, so a slow
+    consumer of e.g. stdout never stalls sample processing. When the queue
+    is full new events are dropped and counted instead of waiting.
+*/
+
+#ifndef INCLUDE_EVENT_OUT_H_
+#define INCLUDE_EVENT_OUT_H_
+
+#include "parser.h"
+#include "event_fmt.h"
+
+#define EVENT_OUT_QUEUE_LEN  1024 /* records, a power of two */
+#define EVENT_OUT_MAX_SINKS  8
+
+typedef struct event_out event_out_t;
+
+/** Create an event output, no sinks attached and not yet running.
+
+    @param fmt serializer settings, copied
+    @param verbosity nonzero to also echo a line per event to stderr
+    @return the event output, NULL on failure
+*/
+event_out_t *event_out_create(event_fmt_t const *fmt, int verbosity);
+
+/** Attach a sink given as a spec string.
+
+    Supported specs are "stdout", "file:<path>" (append-only),
+    "udp:<host>:<port>" and "unix:<path>" (datagram socket).
+
+    @param out the event output
+    @param spec sink spec
+    @return 0 on success, -1 otherwise
+*/
+int event_out_add_sink(event_out_t *out, char const *spec);
+
+/** Start the writer thread; adds a stdout sink if none were given.
+
+    @param out the event output
+    @return 0 on success, -1 otherwise
+*/
+int event_out_start(event_out_t *out);
+
+/** Queue an event, never blocks. Matches mrbeam_event_cb_t.
+
+    @param ev the event record, copied
+    @param ctx the event output
+*/
+void event_out_push(mrbeam_event_t const *ev, void *ctx);
+
+/** Queue an event, waits for room instead of dropping it.
+
+    For replays that report events much faster than the writer drains
+    them, e.g. all events of a capture at once.
+
+    @param ev the event record, copied
+    @param ctx the event output
+*/
+void event_out_push_wait(mrbeam_event_t const *ev, void *ctx);
+
+/** Flush queued events, stop the writer thread and close all sinks.
+
+    @param out the event output, may be NULL
+*/
+void event_out_free(event_out_t *out);
+
+#endif /* INCLUDE_EVENT_OUT_H_ */
@@ -0,0 +1,51 @@
+/** @file
+    Fork-join thread pool with work stealing.
+
+    fork_join_run() hands out tasks 0..n-1 and returns once all of them
+    ran. Each thread, the caller included, starts on its own contiguous
+    share of the tasks and takes them from the front; a thread that runs
+    out steals from the back of another thread's share, so a few costly
+    tasks do not hold up the rest. Shares are packed (next, end) pairs
+    updated with compare-and-swap, no lock is taken while tasks run.
+*/
+
+#ifndef INCLUDE_FORK_JOIN_H_
+#define INCLUDE_FORK_JOIN_H_
+
+#define FORK_JOIN_MAX_THREADS 64
+
+typedef struct fork_join fork_join_t;
+
+/// Task callback, called on any of the pool threads.
+typedef void (*fork_join_task_t)(void *ctx, int task);
+
+/** Create a pool.
+
+    @param threads threads to run tasks on, including the caller of fork_join_run()
+    @return the pool, NULL on failure
+*/
+fork_join_t *fork_join_create(int threads);
+
+/** Run tasks on the pool and wait for all of them.
+
+    @param pool the pool, NULL runs the tasks in order on the caller
+    @param tasks number of tasks
+    @param fn task callback
+    @param ctx user context for the callback
+*/
+void fork_join_run(fork_join_t *pool, int tasks, fork_join_task_t fn, void *ctx);
+
+/** Number of threads of a pool.
+
+    @param pool the pool, may be NULL
+    @return threads including the caller, 1 for no pool
+*/
+int fork_join_threads(fork_join_t const *pool);
+
+/** Stop the threads and free the pool.
+
+    @param pool the pool, may be NULL
+*/
+void fork_join_free(fork_join_t *pool);
+
+#endif /* INCLUDE_FORK_JOIN_H_ */
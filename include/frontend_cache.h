@@ -0,0 +1,80 @@
+/** @file
+    On-disk cache of the decimated front-end outputs of a capture.
+
+    A replay spends most of its time mixing and filtering at the full
+    sample rate. The decimated I/Q outputs, one per 69 samples and
+    channel, are all the detector needs, so a replay can keep them in a
+    cache file and a later replay of the same capture with other trigger
+    or pulse counting settings feeds them to the detector straight from
+    a memory map. The outputs are kept as float, 8 bytes per output and
+    channel, so four channels of 8 bit input take about a quarter of the
+    capture.
+
+    Cache files are named after a key: a hash of the capture contents,
+    of the front-end settings (sample rate, format, I/Q correction, tuner
+    offset, channel plan and filter) and of the block size. A change to
+    any of them makes a new key, stale files are never read. Files are
+    in native byte order and written under a temporary name, renamed
+    once the replay got to the end of the capture.
+*/
+
+#ifndef INCLUDE_FRONTEND_CACHE_H_
+#define INCLUDE_FRONTEND_CACHE_H_
+
+#include <stdint.h>
+
+#include "parser.h"
+
+typedef struct frontend_cache frontend_cache_t;
+
+/** Hash a capture with the front-end that processes it.
+
+    @param path the capture
+    @param frontend_hash hash of the front-end, see mrbeam_frontend_hash()
+    @param block_size bytes of input per block
+    @param[out] key the cache key
+    @return 0 on success, -1 if the capture can not be read
+*/
+int frontend_cache_key(char const *path, uint64_t frontend_hash, uint32_t block_size, uint64_t *key);
+
+/** Open the cache file of a key.
+
+    @param dir cache directory
+    @param key cache key
+    @return the cache, NULL if there is no complete file for the key
+*/
+frontend_cache_t *frontend_cache_open(char const *dir, uint64_t key);
+
+/** Feed the blocks of an open cache to a detector, see mrbeam_feed_frontend().
+
+    @param cache the cache
+    @param det detector with the front-end the key was made with
+    @param do_exit stops the replay once nonzero
+    @return 0 on success, -1 if the file is damaged or the detector refused a block
+*/
+int frontend_cache_replay(frontend_cache_t *cache, void *det, int const volatile *do_exit);
+
+/** Create a cache file to fill during a replay.
+
+    @param dir cache directory, created if missing
+    @param key cache key
+    @return the cache, NULL on failure
+*/
+frontend_cache_t *frontend_cache_create(char const *dir, uint64_t key);
+
+/** Write a block of outputs to a created cache. Matches mrbeam_frontend_cb_t.
+
+    @param block the outputs of the block
+    @param ctx the cache
+*/
+void frontend_cache_write(mrbeam_frontend_block_t const *block, void *ctx);
+
+/** Close a cache, a created file is kept only when complete.
+
+    @param cache the cache, may be NULL
+    @param complete the replay got to the end of the capture
+    @return 0 on success, -1 if a created file could not be written
+*/
+int frontend_cache_close(frontend_cache_t *cache, int complete);
+
+#endif /* INCLUDE_FRONTEND_CACHE_H_ */
@@ -0,0 +1,90 @@
+/** @file
+    DC offset and I/Q imbalance correction of the input.
+
+    Estimates the DC offset of I and Q, the Q to I gain ratio and the
+    quadrature phase error from the raw input, in units of full scale.
+    For 8 bit input the DC and gain are folded into separate I and Q
+    conversion tables, what is left per sample is the phase term,
+    Q' = lut_q[q] - phase * lut_i[i]. Wider input is converted first and
+    corrected with the same terms, I' = I - off_i and
+    Q' = (Q - off_q) * scale_q - phase * I'.
+
+    With I = A cos t and Q = g A sin(t + p) after DC removal:
+    var Q / var I = g^2 and cov(I, Q) / sqrt(var I var Q) = sin p, so the
+    corrected Q is Q / (g cos p) - I tan p.
+*/
+
+#ifndef INCLUDE_IQ_BALANCE_H_
+#define INCLUDE_IQ_BALANCE_H_
+
+#include <stdint.h>
+
+#define IQ_BALANCE_INTERVAL 0.25 // seconds of input per estimate
+#define IQ_BALANCE_STRIDE   4    // estimate from every 4th sample
+#define IQ_BALANCE_ALPHA    0.25 // weight of a new estimate
+
+#define IQ_BALANCE_DC_CU8 (-0.6 / 128) // RTL-SDR offset, 127.4 against a zero at 128
+
+typedef struct iq_balance {
+    float lut_i[256];     ///< I byte to DC free value, byte 128 is zero
+    float lut_q[256];     ///< Q byte to DC free, gain and phase scaled value
+    float off_i;          ///< I offset to subtract from wider input
+    float off_q;          ///< Q offset to subtract from wider input
+    float scale_q;        ///< Q gain and phase scale for wider input
+    float phase;          ///< tan of the phase error, subtracted as phase * I from Q
+    int enabled;
+    double nominal_dc;    ///< offset assumed without an estimate
+    double dc_i;          ///< estimated I offset in full scale units
+    double dc_q;          ///< estimated Q offset in full scale units
+    double gain;          ///< estimated Q to I gain ratio
+    double sin_phase;     ///< estimated sine of the phase error
+    uint32_t interval;    ///< strided samples per estimate
+    uint32_t skip;        ///< samples to skip before the next strided sample
+    unsigned estimates;   ///< estimates taken since enabled
+    uint32_t n;
+    double sum_i, sum_q, sum_ii, sum_qq, sum_iq;
+} iq_balance_t;
+
+/** Set up uncorrected tables, the nominal offset and no imbalance.
+
+    @param iq the corrector state
+    @param samp_rate input sample rate
+    @param nominal_dc offset of the input format in full scale units, e.g. IQ_BALANCE_DC_CU8
+*/
+void iq_balance_init(iq_balance_t *iq, uint32_t samp_rate, double nominal_dc);
+
+/** Turn the correction on or off, off restores the uncorrected tables.
+
+    @param iq the corrector state
+    @param enable nonzero to estimate and correct
+*/
+void iq_balance_enable(iq_balance_t *iq, int enable);
+
+/** Start the next estimate where a stream started at sample 0 would.
+
+    Input before the next interval boundary is not used, so estimates of
+    a stream picked up in the middle cover the same samples.
+
+    @param iq the corrector state
+    @param sample stream position of the next input sample
+*/
+void iq_balance_align(iq_balance_t *iq, uint64_t sample);
+
+/** Update the estimate from 8 bit input, rebuilds the tables every interval.
+
+    @param iq the corrector state
+    @param iq_buf interleaved I/Q bytes
+    @param len number of bytes
+    @param flip 0 for CU8, 0x80 to turn CS8 into table indices
+*/
+void iq_balance_feed(iq_balance_t *iq, unsigned char const *iq_buf, uint32_t len, unsigned char flip);
+
+/** Update the estimate from converted wider input.
+
+    @param iq the corrector state
+    @param iq_buf interleaved I/Q values in full scale units, before correction
+    @param samples number of I/Q pairs
+*/
+void iq_balance_feed_float(iq_balance_t *iq, float const (*iq_buf)[2], uint32_t samples);
+
+#endif /* INCLUDE_IQ_BALANCE_H_ */
@@ -0,0 +1,58 @@
+/** @file
+    Equivalence check of the front-end kernels against the reference.
+
+    Every kernel that mixes and decimates the channels runs on the same
+    input as the reference kernel, each in a detector of its own with the
+    options and plan of the command line. The decimated outputs must stay
+    within the error bound of the kernel, zero for exact kernels, and the
+    events must be the same, field by field, as those of the reference.
+
+    The synthetic input has lights on every channel of the plan at levels
+    from near the noise to clipping, with a small offset from the channel
+    so AFC and calibration have something to track.
+*/
+
+#ifndef INCLUDE_KERNEL_CHECK_H_
+#define INCLUDE_KERNEL_CHECK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "rtl_mrbeam.h"
+#include "parser.h"
+
+/** Set up a detector with the options and plan to check.
+
+    @param ctx setup context
+    @return the detector, NULL on failure
+*/
+typedef void *(*kernel_check_setup_t)(void *ctx);
+
+typedef struct kernel_check {
+    r_cfg_t *cfg;              ///< block size, sample rate and do_exit
+    kernel_check_setup_t setup;
+    void *setup_ctx;
+    FILE *out;                 ///< a line per kernel and input
+    int failed;                ///< kernel runs that differed, over all inputs
+} kernel_check_t;
+
+/** Check all kernels on synthetic CU8 input.
+
+    @param check the check
+    @param secs seconds of input
+    @param seed noise seed
+    @return 0 if all kernels passed, -1 otherwise
+*/
+int kernel_check_synthetic(kernel_check_t *check, double secs, uint32_t seed);
+
+/** Check all kernels on a capture.
+
+    @param check the check
+    @param path the capture
+    @param format sample format of the capture
+    @param full_scale full scale of the format
+    @return 0 if all kernels passed, -1 otherwise
+*/
+int kernel_check_file(kernel_check_t *check, char const *path, mrbeam_format_t format, float full_scale);
+
+#endif /* INCLUDE_KERNEL_CHECK_H_ */
@@ -0,0 +1,84 @@
+/** @file
+    Front-end planning on the CPU at hand, kept in a wisdom file.
+
+    The tuner times every front-end kernel at a few input block sizes and
+    worker thread counts on synthetic input in the input format, with the
+    detector options and channel plan of the command line, and picks the
+    fastest plan. A plan
+    should run at least TUNE_REALTIME times faster than the sample rate to
+    leave room for the receiver and the event outputs.
+
+    The wisdom file keeps a plan per CPU model, input format, sample rate,
+    channel plan, the detector options that change the work per sample
+    (AFC, automatic ppm correction, early detection) and a fixed block
+    size if one was given, a tab separated line each, so later starts read the plan instead
+    of timing again. Delete the line or the file to plan again.
+*/
+
+#ifndef INCLUDE_KERNEL_TUNE_H_
+#define INCLUDE_KERNEL_TUNE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "rtl_mrbeam.h"
+#include "kernel_check.h"
+
+#define TUNE_REALTIME 2.0 // times the sample rate a plan should keep up with
+
+/// A front-end plan.
+typedef struct kernel_plan {
+    int kernel;
+    uint32_t block_size;  ///< input bytes per block
+    int threads;          ///< worker threads, 1 to run the channels in sequence
+    double speed;         ///< seconds of input per second of processing
+} kernel_plan_t;
+
+typedef struct kernel_tune {
+    r_cfg_t *cfg;              ///< sample rate, detector options and do_exit
+    kernel_check_setup_t setup;
+    void *setup_ctx;
+    mrbeam_format_t format;    ///< input format
+    float full_scale;
+    uint32_t block_size;       ///< the only input block size to try, 0 to try a few
+    FILE *out;                 ///< a line per timed plan, NULL for none
+    int max_threads;           ///< most worker threads to try, 1 to keep the channels in sequence
+} kernel_tune_t;
+
+/** The wisdom key of the CPU, the input and the detector.
+
+    @param tune the tuner
+    @param[out] key the key, without tabs or newlines
+    @param size size of the key buffer
+    @return 0 on success, -1 if the detector could not be set up
+*/
+int kernel_tune_key(kernel_tune_t *tune, char *key, size_t size);
+
+/** Time the plans and pick the fastest.
+
+    @param tune the tuner
+    @param secs seconds of input per plan
+    @param[out] plan the fastest plan
+    @return 0 on success, -1 on failure or interruption
+*/
+int kernel_tune(kernel_tune_t *tune, double secs, kernel_plan_t *plan);
+
+/** Look up a plan in a wisdom file.
+
+    @param path the wisdom file
+    @param key the wisdom key
+    @param[out] plan the plan
+    @return 0 if found, -1 if the file or the key is missing or names an unknown kernel
+*/
+int kernel_wisdom_load(char const *path, char const *key, kernel_plan_t *plan);
+
+/** Keep a plan in a wisdom file, replacing one of the same key.
+
+    @param path the wisdom file, created if missing
+    @param key the wisdom key
+    @param plan the plan
+    @return 0 on success, -1 if the file could not be written
+*/
+int kernel_wisdom_save(char const *path, char const *key, kernel_plan_t const *plan);
+
+#endif /* INCLUDE_KERNEL_TUNE_H_ */
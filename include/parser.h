@@ -1,7 +1,146 @@
 #ifndef _PARSER_H_
 #define _PARSER_H_
 
+#include <stdint.h>
+
+/// Maximum channels per center frequency
+#define MRBEAM_CHANNELS 16
+
+/// Input sample formats, interleaved I and Q.
+typedef enum mrbeam_format
+{
+    MRBEAM_CU8,   ///< unsigned 8 bit, e.g. RTL-SDR
+    MRBEAM_CS8,   ///< signed 8 bit, e.g. HackRF
+    MRBEAM_CS16,  ///< signed 16 bit, full scale given by the source
+    MRBEAM_CF32,  ///< float, full scale given by the source
+} mrbeam_format_t;
+
+/// How a light was detected.
+typedef enum mrbeam_event_kind
+{
+    MRBEAM_EVENT_LIGHT,      ///< enough pulses counted
+    MRBEAM_EVENT_EARLY,      ///< the envelope correlates with the blink rate, see confidence
+    MRBEAM_EVENT_CONFIRMED,  ///< enough pulses counted after an early event
+} mrbeam_event_kind_t;
+
+/// A detected light, handed to the event callback on the DSP thread.
+typedef struct mrbeam_event
+{
+    double   time;       ///< wall clock time in seconds since the epoch
+    uint64_t samplePos;  ///< input sample position of the detection
+    int      channel;    ///< hop * MRBEAM_CHANNELS + channel within the hop
+    uint32_t freq;       ///< channel frequency in Hz, 0 if the tuning is unknown
+    int      count;      ///< pulses counted for this channel
+    float    level;      ///< peak mag2 of the last pulse
+    float    snr;        ///< signal to noise ratio in dB, NaN if unknown
+    float    confidence; ///< chance the envelope is not noise, 1 for counted pulses
+    mrbeam_event_kind_t kind;
+} mrbeam_event_t;
+
+/// Running detector statistics, read on the DSP thread.
+typedef struct mrbeam_stats
+{
+    uint64_t samples;                 ///< input samples processed
+    uint64_t clipped;                 ///< input I and Q values at full scale
+    uint64_t gaps;                    ///< input gaps, e.g. receiver overflows
+    uint64_t lost;                    ///< input samples known lost in the gaps
+    int      channels;                ///< channels in the plan
+    float    noise[MRBEAM_CHANNELS];  ///< noise floor in dB of the current hop
+    float    drift[MRBEAM_CHANNELS];  ///< AFC offset in Hz per channel of the current hop
+    float    dc[2];                   ///< I and Q offset from mid scale in 8 bit ADC counts
+    float    iqGain;                  ///< Q to I gain imbalance in dB
+    float    iqPhase;                 ///< quadrature phase error in degrees
+    float    freqOffset;              ///< calibrated signal offset in Hz of the current hop
+    float    ppm;                     ///< tuner error in ppm the offset amounts to, 0 if unknown
+} mrbeam_stats_t;
+
+/// Trigger and pulse counting settings, those a parameter sweep varies.
+typedef struct mrbeam_params
+{
+    float levelDb;     ///< fixed trigger level in dB of full scale, 0 for adaptive
+    float minSnrDb;    ///< adaptive trigger level above the noise floor
+    int   minCount;    ///< a light is reported once more pulses than this were counted
+    int   maxGap;      ///< the count starts over after more blink periods than this without a pulse
+    float refractory;  ///< seconds before a light is reported again
+    int   window;      ///< decimated outputs searched for the peak of a pulse
+} mrbeam_params_t;
+
+/// Sweep event callback, set is the index of the parameter set, must not block.
+typedef void (*mrbeam_sweep_cb_t) (int set, mrbeam_event_t const *ev, void *cbCtx);
+
+/// Decimated channel outputs of a block, everything the detector needs of the front-end.
+typedef struct mrbeam_frontend_block
+{
+    uint32_t samples;    ///< input samples of the block
+    uint32_t skip;       ///< samples skipped at the start while the tuner settled
+    uint64_t clipped;    ///< input I and Q values at full scale
+    uint32_t first;      ///< block position of the first output, the others follow at the decimation
+    int      outputs;    ///< outputs per channel
+    int      channels;
+    float const *iq[MRBEAM_CHANNELS];  ///< interleaved I and Q outputs per channel
+} mrbeam_frontend_block_t;
+
+/// Front-end callback, gets the outputs of every block on the DSP thread.
+typedef void (*mrbeam_frontend_cb_t) (mrbeam_frontend_block_t const *block, void *cbCtx);
+
+/// Detector state at a sample position, see mrbeam_save_state ().
+typedef struct mrbeam_state mrbeam_state_t;
+
+/// Event callback, must not block.
+typedef void (*mrbeam_event_cb_t) (mrbeam_event_t const *ev, void *cbCtx);
+
 void *mrbeam_setup (void);
+void mrbeam_set_replay (void *ctx);
+void mrbeam_set_event_cb (void *ctx, mrbeam_event_cb_t cb, void *cbCtx);
+void mrbeam_set_level (void *ctx, float levelDb, float minSnrDb);
+int mrbeam_set_params (void *ctx, mrbeam_params_t const *params);
+void mrbeam_get_params (void *ctx, mrbeam_params_t *params);
+/// Trigger the parameter sets on the outputs of the detector as well, each with its own state; 0 sets to stop.
+int mrbeam_set_sweep (void *ctx, mrbeam_params_t const *sets, int nSets, mrbeam_sweep_cb_t cb, void *cbCtx);
+int mrbeam_set_hops (void *ctx, int hops);
+void mrbeam_retune (void *ctx, int hop, uint32_t centerFreq, uint32_t settleSamples);
+int mrbeam_set_channels (void *ctx, float const *offsets, int channels);
+/// Add channels to the plan, the channels already there keep their numbers and state.
+int mrbeam_add_channels (void *ctx, float const *offsets, int channels);
+void mrbeam_set_calibration (void *ctx, int enable);
+void mrbeam_set_afc (void *ctx, float limitHz);
+void mrbeam_set_iq_correction (void *ctx, int enable);
+int mrbeam_set_format (void *ctx, mrbeam_format_t format, float fullScale);
+int mrbeam_sample_size (mrbeam_format_t format);
+void mrbeam_set_early (void *ctx, int periods, float confidence, int confirm);
+int mrbeam_set_threads (void *ctx, int threads);
+void mrbeam_adjust_ppm (void *ctx, double ppm);
+void mrbeam_input_gap (void *ctx, uint64_t lostSamples);
+int mrbeam_publish_shm (void *ctx, char const *name);
+void mrbeam_get_stats (void *ctx, mrbeam_stats_t *stats);
+/// Start counting input at a sample position instead of 0, before the first buffer.
+void mrbeam_set_position (void *ctx, uint64_t samplePos);
+/// Anchor event times to the time of a sample position.
+void mrbeam_set_anchor (void *ctx, uint64_t samplePos, double time);
+/// The sample position of the next input, lost samples included.
+uint64_t mrbeam_position (void *ctx);
+/// Sample positions must be a multiple of this to process later samples the same way, see mrbeam_set_position ().
+uint64_t mrbeam_alignment (void *ctx);
+/// Copy the offsets of the channel plan, returns the channels.
+int mrbeam_get_channels (void *ctx, float *offsets);
+/// Snapshot the state of the current hop that decides on future events, release with free ().
+mrbeam_state_t *mrbeam_save_state (void *ctx);
+/// Nonzero if the detector is at the position of the snapshot and would report the same events.
+int mrbeam_state_match (void *ctx, mrbeam_state_t const *state);
+/// Front-end kernels that mix and decimate the channels, kernel 0 is the reference.
+int mrbeam_kernels (void);
+char const *mrbeam_kernel_name (int kernel);
+/// Largest output difference of a kernel to the reference in full scale units, 0 for exact.
+float mrbeam_kernel_error (int kernel);
+int mrbeam_set_kernel (void *ctx, int kernel);
+/// Hash of the settings that decide on the decimated outputs of an input, see mrbeam_feed_frontend ().
+uint64_t mrbeam_frontend_hash (void *ctx);
+/// Get the outputs of the front-end after each block, NULL to stop.
+void mrbeam_set_frontend_cb (void *ctx, mrbeam_frontend_cb_t cb, void *cbCtx);
+/// Process a block of outputs kept from a front-end with the same hash instead of input.
+int mrbeam_feed_frontend (void *ctx, mrbeam_frontend_block_t const *block);
+void mrbeam_free (void *ctx);
+/// Process len bytes of input in the format set with mrbeam_set_format (), CU8 by default.
 void sdr_callback(unsigned char *iq_buf, uint32_t len, void *ctx);
 
 #endif /* _PARSER_H_ */
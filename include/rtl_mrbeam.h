@@ -10,26 +10,45 @@
 
 #define DEFAULT_SAMPLE_RATE     250000
 #define DEFAULT_FREQUENCY       433920000
+#define DEFAULT_GAIN            "13"
 #define DEFAULT_HOP_TIME        (60*10)
+#define DEFAULT_AFC_LIMIT       2000 // Hz a light may drift from its channel
+#define DEFAULT_SCAN_TIME       3 // s
+#define DEFAULT_CHUNK_OVERLAP   10 // s of warm-up before each chunk of a parallel replay
+#define DEFAULT_KERNEL_CHECK_TIME 30 // s of synthetic input for -k check
+#define DEFAULT_TUNE_TIME       1 // s of input per timed front-end plan
+#define DEFAULT_WISDOM_FILE     ".rtl_mrbeam.wisdom" // in $HOME
+#define DEFAULT_STATS_INTERVAL  600 // s
+#define DEFAULT_PPM_HOLD        10 // s between automatic frequency corrections
+#define DEFAULT_SETTLE_TIME     100 // ms of samples discarded after a retune
+#define DEFAULT_STALL_TIMEOUT   3 // seconds without data before the device is restarted
+#define DEFAULT_RECOVERY_ATTEMPTS 5
 #define DEFAULT_ASYNC_BUF_NUMBER    0 // Force use of default value (librtlsdr default: 15)
 #define DEFAULT_BUF_LENGTH      (16 * 32 * 512) // librtlsdr default
 #define FSK_PULSE_DETECTOR_LIMIT 800000000
 /*
- * Theoretical high level at I/Q saturation is 128x128 = 16384 (above is ripple)
+ * Trigger level in dB of the decimated channel power, full scale is 0 dB
  * 0 = automatic adaptive level limit, else fixed level limit
- * 8000 = previous fixed default
+ * -7 = previous fixed default
  */
 #define DEFAULT_LEVEL_LIMIT     0
+#define DEFAULT_MIN_SNR         12 // adaptive level limit above the noise floor in dB
+#define DEFAULT_EARLY_PERIODS   8 // blink periods per early detection window
+#define DEFAULT_EARLY_CONFIDENCE 0.999999
 
 #define MINIMAL_BUF_LENGTH      512
 #define MAXIMAL_BUF_LENGTH      (256 * 16384)
 #define SIGNAL_GRABBER_BUFFER   (12 * DEFAULT_BUF_LENGTH)
 #define MAX_FREQS               32
+#define MAX_OUTPUTS             8
 
 #define INPUT_LINE_MAX 8192 /**< enough for a complete textual bitbuffer (25*256) */
 
 struct sdr_dev;
 struct r_device;
+struct watchdog_stage;
+struct agc;
+struct scan;
 
 typedef enum {
     CONVERT_NATIVE,
@@ -49,11 +68,20 @@ typedef enum {
 typedef struct r_cfg {
     char *dev_query;
     char *gain_str;
+    int agc_mode;
+    struct agc *agc;
+    int gain_changed;
+    char agc_gain_str[16];
     char *settings_str;
     int ppm_error;
+    int ppm_auto;
+    int ppm_step;
+    uint64_t ppm_next;
     uint32_t out_block_size;
     char const *test_data;
     char const *in_filename;
+    char const **in_files; ///< all -r inputs, several or a directory replay a batch
+    int in_files_count;
     int do_exit;
     int do_exit_async;
     int frequencies;
@@ -61,13 +89,25 @@ typedef struct r_cfg {
     uint32_t frequency[MAX_FREQS];
     uint32_t center_frequency;
     int fsk_pulse_detect_mode;
+    char const *channel_plan;
+    int scan_time;
+    int scan_interval;
+    struct scan *scan;
+    int scan_active;
+    int scan_startup;
+    uint64_t scan_next;   ///< sample position of the next periodic scan
     int hop_times;
     int hop_time[MAX_FREQS];
     time_t hop_start_time;
+    uint64_t hop_samples; ///< samples to dwell on the current frequency
+    uint64_t hop_pos;     ///< samples received on the current frequency
     int duration;
     time_t stop_time;
     int after_successful_events_flag;
     uint32_t samp_rate;
+    int sample_size;      ///< bytes per I or Q value of the input
+    int input_format;     ///< mrbeam_format_t of the input
+    float full_scale;     ///< input value of full scale
     uint64_t input_pos;
     uint32_t bytes_to_read;
     struct sdr_dev *dev;
@@ -75,6 +115,26 @@ typedef struct r_cfg {
     int verbosity; ///< 0=normal, 1=verbose, 2=verbose decoders, 3=debug decoders, 4=trace decoding.
     int verbose_bits;
     conversion_mode_t conversion_mode;
+    float level_limit;
+    float min_snr;
+    float afc_limit;
+    int iq_correction;
+    int early_periods;
+    float early_confidence;
+    int early_confirm;
+    int min_count;        ///< pulses before a light is reported, 0 for the default
+    int max_gap;          ///< blink periods without a pulse that start the count over, 0 for the default
+    float refractory;     ///< seconds before a light is reported again, 0 for the default
+    int pulse_window;     ///< decimated outputs searched for the peak of a pulse, 0 for the default
+    char const *sweep_spec; ///< trigger settings to sweep over a replay
+    int threads;
+    int chunk_jobs;       ///< chunks of a single replay at a time, 0 to replay in sequence
+    double chunk_overlap; ///< seconds of warm-up before each chunk
+    char const *cache_dir; ///< front-end cache directory for replays, NULL for none
+    int kernel;           ///< front-end kernel, 0 for the reference
+    int kernel_check;     ///< seconds of synthetic input to check the kernels on before exiting, 0 to not
+    char const *wisdom_file; ///< plan the front-end with this wisdom file, NULL to not
+    double eval_tolerance; ///< seconds a detection may be off the ground truth, 0 for no evaluation
     int report_meta;
     int report_protocol;
     time_mode_t report_time;
@@ -94,6 +154,15 @@ typedef struct r_cfg {
     char const *sr_filename;
     int sr_execopen;
     int old_model_keys;
+    char const *shm_name;
+    int output_format;
+    int outputs;
+    char const *output_spec[MAX_OUTPUTS];
+    void *mrbeam;
+    struct watchdog_stage *wd_read;
+    struct watchdog_stage *wd_dsp;
+    int recover_device; ///< set by the watchdog thread, accessed with __atomic builtins
+    unsigned recoveries;
     /* stats*/
     unsigned frames_count; ///< stats counter for interval
     unsigned frames_fsk; ///< stats counter for interval
@@ -0,0 +1,75 @@
+/** @file
+    Sample-clock timestamps anchored to the system clocks.
+
+    All detector timing is done in input samples. Absolute times are
+    derived from the sample position relative to an anchor, a pair of
+    CLOCK_REALTIME and CLOCK_MONOTONIC readings taken at buffer arrival.
+    Live inputs re-anchor about once a second to follow sample rate error
+    and clock adjustments; file replay anchors once, so replay at any
+    speed yields the same sample positions as live operation. Once given
+    an anchor, e.g. a hardware timestamp, buffer arrivals no longer
+    re-anchor, the caller keeps anchoring instead.
+*/
+
+#ifndef INCLUDE_SAMPLE_CLOCK_H_
+#define INCLUDE_SAMPLE_CLOCK_H_
+
+#include <stdint.h>
+
+typedef struct sample_clock {
+    uint32_t samp_rate;
+    int live;                ///< re-anchor periodically
+    uint64_t interval;       ///< samples between anchors
+    uint64_t anchor_sample;  ///< sample position of the anchor
+    double anchor_real;      ///< CLOCK_REALTIME seconds at the anchor
+    double anchor_mono;      ///< CLOCK_MONOTONIC seconds at the anchor
+    int anchored;
+    int external;            ///< anchored by the caller, arrivals leave it
+} sample_clock_t;
+
+/** Set up a sample clock, unanchored.
+
+    @param clk the clock
+    @param samp_rate input sample rate
+    @param live nonzero to re-anchor every second, zero to anchor once
+*/
+void sample_clock_init(sample_clock_t *clk, uint32_t samp_rate, int live);
+
+/** Note the arrival of a buffer, anchors if due.
+
+    @param clk the clock
+    @param sample_end sample position just past the last sample of the buffer
+*/
+void sample_clock_arrival(sample_clock_t *clk, uint64_t sample_end);
+
+/** Anchor to a given time, e.g. a hardware timestamp, from now on arrivals do not anchor.
+
+    @param clk the clock
+    @param sample sample position the time refers to
+    @param real_time seconds since the epoch
+*/
+void sample_clock_anchor(sample_clock_t *clk, uint64_t sample, double real_time);
+
+/** Absolute time of a sample position.
+
+    @param clk the clock
+    @param sample sample position
+    @return seconds since the epoch
+*/
+double sample_clock_time(sample_clock_t const *clk, uint64_t sample);
+
+/** Monotonic time of a sample position.
+
+    @param clk the clock
+    @param sample sample position
+    @return CLOCK_MONOTONIC seconds
+*/
+double sample_clock_mono(sample_clock_t const *clk, uint64_t sample);
+
+/** Read CLOCK_MONOTONIC.
+
+    @return seconds
+*/
+double mono_time(void);
+
+#endif /* INCLUDE_SAMPLE_CLOCK_H_ */
@@ -0,0 +1,77 @@
+/** @file
+    Spectrum scan that finds the channels of blinking lights.
+
+    Averages the power spectrum of the raw input over a few seconds and,
+    for every bin, the component of its power envelope at the light's
+    blink rate. A light shows as a spectral peak whose power is strongly
+    modulated at that rate; carriers, spurs and the DC offset are not.
+
+    Like the early detector, the blink component is summed coherently over
+    windows of SCAN_BLINK_PERIODS periods only and the magnitudes of the
+    windows are added, so a light blinking a little off the nominal rate
+    does not cancel itself out over the scan.
+*/
+
+#ifndef INCLUDE_SCAN_H_
+#define INCLUDE_SCAN_H_
+
+#include <stdint.h>
+
+#include "parser.h"
+
+#define SCAN_FFT_SIZE   512   // bins, about 1.9 kHz each at 948 kS/s
+#define SCAN_BLINK_RATE 254.5 // Hz
+#define SCAN_MIN_SNR    10    // dB above the median bin power
+#define SCAN_MIN_MOD    0.3   // blink component relative to the mean power
+#define SCAN_BLINK_PERIODS 32 // blink periods summed coherently, about +-4 Hz of blink rate
+#define SCAN_MIN_SPACING 20e3 // Hz between two channels
+
+typedef struct scan scan_t;
+
+/** Create a scan.
+
+    @param samp_rate input sample rate
+    @param secs seconds of input to average
+    @return the scan, NULL on failure
+*/
+scan_t *scan_create(uint32_t samp_rate, double secs);
+
+/** Set the input format, CU8 by default.
+
+    @param scan the scan
+    @param format input sample format
+    @param full_scale full scale of CS16 and CF32 input
+*/
+void scan_set_format(scan_t *scan, mrbeam_format_t format, float full_scale);
+
+/** Feed input.
+
+    @param scan the scan
+    @param iq_buf interleaved I/Q samples in the set format
+    @param len number of bytes
+    @return 1 once enough input was seen, 0 otherwise
+*/
+int scan_feed(scan_t *scan, unsigned char const *iq_buf, uint32_t len);
+
+/** Find the channels, strongest first.
+
+    @param scan the scan
+    @param[out] offsets channel offsets from the center frequency in Hz
+    @param max_channels size of the offsets array
+    @return number of channels found
+*/
+int scan_result(scan_t *scan, float *offsets, int max_channels);
+
+/** Start over with the next input.
+
+    @param scan the scan
+*/
+void scan_reset(scan_t *scan);
+
+/** Free the scan.
+
+    @param scan the scan, may be NULL
+*/
+void scan_free(scan_t *scan);
+
+#endif /* INCLUDE_SCAN_H_ */
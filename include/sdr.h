@@ -14,8 +14,28 @@
 
 #include <stdint.h>
 
+#define SDR_MAX_GAINS 64 ///< enough for any tuner gain table
+
+#define SDR_BUFFER_OVERFLOW 1 ///< samples were lost right before this buffer
+#define SDR_BUFFER_HW_TIME  2 ///< time_ns is a hardware timestamp
+
+/// Metadata of a buffer handed to the read callback.
+typedef struct sdr_buffer_info {
+    uint64_t sample_index; ///< stream position of the first sample, lost samples included
+    uint64_t lost;         ///< samples lost right before this buffer, 0 if unknown or none
+    int64_t time_ns;       ///< hardware time of the first sample, else arrival in ns since the epoch
+    unsigned flags;        ///< SDR_BUFFER_OVERFLOW, SDR_BUFFER_HW_TIME
+} sdr_buffer_info_t;
+
 typedef struct sdr_dev sdr_dev_t;
-typedef void (*sdr_read_cb_t)(unsigned char *buf, uint32_t len, void *ctx);
+
+/** Read callback.
+
+    Losses are known from SoapySDR overflows and hardware timestamps;
+    RTL-SDR and rtl_tcp drop samples without notice, their buffers carry
+    the arrival time only.
+*/
+typedef void (*sdr_read_cb_t)(unsigned char *buf, uint32_t len, sdr_buffer_info_t const *info, void *ctx);
 
 /** Find the closest matching device, optionally report status.
 
@@ -43,6 +63,14 @@ int sdr_close(sdr_dev_t *dev);
 */
 int sdr_set_center_freq(sdr_dev_t *dev, uint32_t freq, int verbose);
 
+/** Get the stream sample format.
+
+    @param dev the device handle
+    @param[out] full_scale sample value of full scale, 128 for CU8 and CS8
+    @return the format name, "CU8", "CS8", "CS16" or "CF32", NULL on error
+*/
+char const *sdr_get_sample_format(sdr_dev_t *dev, double *full_scale);
+
 /** Get device frequency.
 
     @param dev the device handle
@@ -76,6 +104,15 @@ int sdr_set_auto_gain(sdr_dev_t *dev, int verbose);
 */
 int sdr_set_tuner_gain(sdr_dev_t *dev, char *gain_str, int verbose);
 
+/** Get the tuner gain table.
+
+    @param dev the device handle
+    @param[out] gains tuner gains in tenths of a dB, ascending
+    @param max_gains size of the gains array
+    @return number of gains, -1 if the device has no gain table
+*/
+int sdr_get_tuner_gains(sdr_dev_t *dev, int *gains, int max_gains);
+
 /** Set device sample rate, optionally report status.
 
     @param dev the device handle
@@ -0,0 +1,219 @@
+/** @file
+    Lock-free shared-memory ring of per-channel decimated samples.
+
+    A single writer (the detector) appends one frame per decimated output,
+    a frame holding the filtered I/Q and mag2 of every channel. Any number
+    of local readers map the same POSIX shared memory object read-only and
+    poll the published write position; no syscalls are needed after the
+    initial attach.
+
+    The writer never waits for readers. Before it fills frames it
+    publishes how far it will write (reserve_pos), and it moves write_pos
+    once they are filled, so a block of frames may be in flight at once.
+    A reader that falls more than `slots` frames behind reserve_pos loses
+    the oldest frames, which it detects by re-checking reserve_pos after
+    copying (see shm_ring_read()).
+
+    Every frame carries the input sample position of its output, the hop
+    it was tuned to and the channel plan generation it was filtered with.
+    The generation in the header is odd while the writer changes
+    channel_freq and even otherwise, frames carry the even value in effect
+    (see shm_ring_get_channel_freq()).
+*/
+
+#ifndef INCLUDE_SHM_RING_H_
+#define INCLUDE_SHM_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_RING_MAGIC          0x4e52424d /* "MBRN" little endian */
+#define SHM_RING_VERSION        3
+#define SHM_RING_MAX_CHANNELS   32
+#define SHM_RING_DEFAULT_SLOTS  (1 << 16) /* ~4.8 s at 13.7 kS/s */
+#define SHM_RING_HEADER_SIZE    4096
+
+/// One channel's decimated output at one time step.
+typedef struct shm_ring_sample {
+    float i;
+    float q;
+    float mag2;
+} shm_ring_sample_t;
+
+/// Where and how a frame was taken.
+typedef struct shm_ring_frame_info {
+    uint64_t sample_pos;     ///< input sample position of the frame's outputs
+    uint32_t hop;            ///< hop index the receiver was tuned to
+    uint32_t generation;     ///< channel plan generation, see shm_ring_header_t
+} shm_ring_frame_info_t;
+
+/// Layout of the first SHM_RING_HEADER_SIZE bytes of the shared object.
+/// Frames of `channels` samples follow, `slots` of them, then `slots` frame infos.
+typedef struct shm_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t channels;       ///< samples per frame
+    uint32_t slots;          ///< frames in the ring, a power of two
+    uint32_t sample_rate;    ///< input sample rate in S/s
+    uint32_t decimation;     ///< input samples per frame
+    uint32_t generation;     ///< channel plan generation, odd while channel_freq changes
+    float channel_freq[SHM_RING_MAX_CHANNELS]; ///< channel offsets from center in Hz
+    // keep the hot write position on its own cache line
+    uint8_t pad_[64 - (7 * 4 + SHM_RING_MAX_CHANNELS * 4) % 64];
+    uint64_t write_pos;      ///< frames written so far, published with release semantics
+    uint64_t reserve_pos;    ///< frames written or being written, published before the frames are filled
+} shm_ring_header_t;
+
+typedef struct shm_ring {
+    char *name;
+    int writer;
+    size_t map_size;
+    shm_ring_header_t *hdr;
+    shm_ring_sample_t *frames;
+    shm_ring_frame_info_t *info;
+    uint64_t pos;            ///< writer: next frame, reader: next frame to read
+} shm_ring_t;
+
+/** Create (or replace) a shared memory ring for writing.
+
+    @param name POSIX shared memory object name, e.g. "/mrbeam"
+    @param channels number of samples per frame
+    @param slots number of frames, rounded up to a power of two
+    @param sample_rate input sample rate
+    @param decimation input samples per frame
+    @param channel_freq channel offsets in Hz, @p channels entries
+    @return the ring, NULL on failure
+*/
+shm_ring_t *shm_ring_create(char const *name, unsigned channels, unsigned slots,
+        uint32_t sample_rate, uint32_t decimation, float const *channel_freq);
+
+/** Attach to an existing shared memory ring for reading.
+
+    The reader starts at the oldest frame still held in the ring.
+
+    @param name POSIX shared memory object name
+    @return the ring, NULL on failure
+*/
+shm_ring_t *shm_ring_attach(char const *name);
+
+/** Unmap the ring; the writer also unlinks the shared memory object.
+
+    @param ring the ring, may be NULL
+*/
+void shm_ring_free(shm_ring_t *ring);
+
+/** Update the channel frequencies after a change of the channel plan.
+
+    Frames filled after this carry the new generation.
+
+    @param ring the ring opened with shm_ring_create()
+    @param channel_freq channel offsets in Hz, one per sample of a frame
+*/
+void shm_ring_set_channel_freq(shm_ring_t *ring, float const *channel_freq);
+
+/** Read the channel frequencies and the generation they belong to.
+
+    @param ring the ring opened with shm_ring_attach()
+    @param[out] channel_freq channel offsets in Hz, one per sample of a frame
+    @return the channel plan generation
+*/
+uint32_t shm_ring_get_channel_freq(shm_ring_t *ring, float *channel_freq);
+
+/** Announce that the writer is about to fill a number of frames.
+
+    Call before filling frames with shm_ring_frame() or shm_ring_frame_at(),
+    readers treat the slots of these frames as overwritten from now on.
+
+    @param ring the ring
+    @param frames number of frames after the next one that may be filled
+*/
+static inline void shm_ring_reserve(shm_ring_t *ring, unsigned frames)
+{
+    __atomic_store_n(&ring->hdr->reserve_pos, ring->pos + frames, __ATOMIC_RELAXED);
+    // the reservation is visible before any frame store
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/** Get the writer's frame slot for the next time step.
+
+    @param ring the ring
+    @return pointer to `channels` samples to fill in
+*/
+static inline shm_ring_sample_t *shm_ring_frame(shm_ring_t *ring)
+{
+    return &ring->frames[(ring->pos & (ring->hdr->slots - 1)) * ring->hdr->channels];
+}
+
+/** Get the writer's frame slot a number of time steps after the next one.
+
+    @param ring the ring
+    @param offset time steps after the next frame
+    @return pointer to `channels` samples to fill in
+*/
+static inline shm_ring_sample_t *shm_ring_frame_at(shm_ring_t *ring, unsigned offset)
+{
+    return &ring->frames[((ring->pos + offset) & (ring->hdr->slots - 1)) * ring->hdr->channels];
+}
+
+/** Get the writer's frame info a number of time steps after the next one.
+
+    @param ring the ring
+    @param offset time steps after the next frame
+    @return pointer to the info of the frame to fill in
+*/
+static inline shm_ring_frame_info_t *shm_ring_info_at(shm_ring_t *ring, unsigned offset)
+{
+    return &ring->info[(ring->pos + offset) & (ring->hdr->slots - 1)];
+}
+
+/** Set the writer's frame info a number of time steps after the next one.
+
+    @param ring the ring
+    @param offset time steps after the next frame
+    @param sample_pos input sample position of the frame's outputs
+    @param hop hop index the receiver is tuned to
+*/
+static inline void shm_ring_set_info(shm_ring_t *ring, unsigned offset, uint64_t sample_pos, uint32_t hop)
+{
+    shm_ring_frame_info_t *info = shm_ring_info_at(ring, offset);
+    info->sample_pos = sample_pos;
+    info->hop        = hop;
+    // only the writer changes the generation, it is even here
+    info->generation = ring->hdr->generation;
+}
+
+/** Publish the frame returned by shm_ring_frame() to readers, reserved with shm_ring_reserve().
+
+    @param ring the ring
+*/
+static inline void shm_ring_commit(shm_ring_t *ring)
+{
+    __atomic_store_n(&ring->hdr->write_pos, ++ring->pos, __ATOMIC_RELEASE);
+}
+
+/** Publish a number of frames filled in with shm_ring_frame_at() to readers.
+
+    At most the frames reserved with shm_ring_reserve().
+
+    @param ring the ring
+    @param frames number of frames
+*/
+static inline void shm_ring_commit_n(shm_ring_t *ring, unsigned frames)
+{
+    ring->pos += frames;
+    __atomic_store_n(&ring->hdr->write_pos, ring->pos, __ATOMIC_RELEASE);
+}
+
+/** Copy up to @p max_frames frames not yet seen by this reader.
+
+    @param ring the ring opened with shm_ring_attach()
+    @param[out] out buffer for max_frames * channels samples
+    @param[out] info buffer for max_frames frame infos, may be NULL
+    @param max_frames capacity of @p out in frames
+    @param[out] lost number of frames overwritten before they could be read
+    @return number of frames copied
+*/
+unsigned shm_ring_read(shm_ring_t *ring, shm_ring_sample_t *out, shm_ring_frame_info_t *info,
+        unsigned max_frames, uint64_t *lost);
+
+#endif /* INCLUDE_SHM_RING_H_ */
@@ -0,0 +1,68 @@
+/** @file
+    Sweep of the trigger and pulse counting settings over one replay.
+
+    A sweep spec lists values per setting, e.g.
+    "count=150:175:200,minsnr=9:12:15"; the sweep runs every combination,
+    settings not given keep the value of the detector. All parameter sets
+    trigger on the decimated outputs of the one detector, so the mixers
+    and filters run once per block however many sets there are, and sets
+    with the same level and minsnr share one noise floor.
+*/
+
+#ifndef INCLUDE_SWEEP_H_
+#define INCLUDE_SWEEP_H_
+
+#include <stdio.h>
+
+#include "parser.h"
+#include "event_fmt.h"
+
+#define SWEEP_MAX_SETS 10000
+
+/// A parameter set and the events it found.
+typedef struct sweep_set {
+    mrbeam_params_t params;
+    unsigned events;
+    unsigned channel_events[MRBEAM_CHANNELS];
+    mrbeam_event_t *ev;
+    int size;
+} sweep_set_t;
+
+typedef struct sweep {
+    sweep_set_t *sets;
+    int count;
+} sweep_t;
+
+/** Set up the parameter sets of a spec.
+
+    @param sweep the sweep, empty
+    @param spec comma separated settings level, minsnr, count, gap, refractory
+           and window, each with colon separated values
+    @param base settings not in the spec
+    @return 0 on success, -1 if the spec is invalid
+*/
+int sweep_parse(sweep_t *sweep, char const *spec, mrbeam_params_t const *base);
+
+/** Collect an event of a parameter set. Matches mrbeam_sweep_cb_t.
+
+    @param set index of the parameter set
+    @param ev the event
+    @param ctx the sweep
+*/
+void sweep_event(int set, mrbeam_event_t const *ev, void *ctx);
+
+/** Write a line per parameter set, each followed by its events.
+
+    @param sweep the sweep
+    @param out the report output
+    @param fmt event serializer, no events are listed for binary output
+*/
+void sweep_report(sweep_t const *sweep, FILE *out, event_fmt_t *fmt);
+
+/** Free the parameter sets and their events.
+
+    @param sweep the sweep
+*/
+void sweep_free(sweep_t *sweep);
+
+#endif /* INCLUDE_SWEEP_H_ */
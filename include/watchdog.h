@@ -0,0 +1,96 @@
+/** @file
+    Stall watchdog thread driven by per-stage heartbeats.
+
+    Each pipeline stage (e.g. the read loop, the DSP) owns a stage record
+    and bumps its heartbeat counter with a relaxed atomic increment, which
+    costs no syscall. The watchdog thread samples the counters a few times
+    per timeout and reports a stage whose counter has not moved for longer
+    than the timeout. A stage marked idle (e.g. waiting for a retune or
+    for work) is not expected to beat and is never reported.
+
+    The workers of a fork-join pool do not beat on their own: the thread
+    that hands them a block waits for all of them, so a stalled worker
+    holds up its caller and is reported as a stall of the caller's stage,
+    the DSP stage ("sample processing" in rtl_mrbeam).
+*/
+
+#ifndef INCLUDE_WATCHDOG_H_
+#define INCLUDE_WATCHDOG_H_
+
+#include <stdint.h>
+
+#define WATCHDOG_MAX_STAGES 16
+
+typedef struct watchdog_stage {
+    char const *name;
+    uint32_t beat;  ///< bumped by the stage
+    int idle;       ///< set while the stage is not expected to beat
+    // watchdog thread private
+    uint32_t seen_beat;
+    double last_change;
+    int reports;
+} watchdog_stage_t;
+
+typedef struct watchdog watchdog_t;
+
+/** Stall report, called on the watchdog thread.
+
+    Called once the stage exceeded the timeout and again after each
+    further timeout while it stays stalled.
+
+    @param stage the stalled stage
+    @param stalled_secs time since the last heartbeat
+    @param reports number of reports for this stall, starting at 1
+    @param ctx user context
+*/
+typedef void (*watchdog_stall_cb_t)(watchdog_stage_t *stage, double stalled_secs, int reports, void *ctx);
+
+/** Create a watchdog, not yet running.
+
+    @param timeout stall timeout in seconds
+    @param cb stall report callback
+    @param ctx user context for the callback
+    @return the watchdog, NULL on failure
+*/
+watchdog_t *watchdog_create(double timeout, watchdog_stall_cb_t cb, void *ctx);
+
+/** Add a stage to watch, initially idle.
+
+    @param wd the watchdog
+    @param name stage name for reports
+    @return the stage record, NULL if there are too many stages
+*/
+watchdog_stage_t *watchdog_add_stage(watchdog_t *wd, char const *name);
+
+/** Start the watchdog thread.
+
+    @param wd the watchdog
+    @return 0 on success, -1 otherwise
+*/
+int watchdog_start(watchdog_t *wd);
+
+/** Stop the watchdog thread and free it.
+
+    @param wd the watchdog, may be NULL
+*/
+void watchdog_free(watchdog_t *wd);
+
+/// Record progress of a stage.
+static inline void watchdog_beat(watchdog_stage_t *stage)
+{
+    __atomic_fetch_add(&stage->beat, 1, __ATOMIC_RELAXED);
+}
+
+/// Mark a stage as expected to beat from now on.
+static inline void watchdog_busy(watchdog_stage_t *stage)
+{
+    __atomic_store_n(&stage->idle, 0, __ATOMIC_RELAXED);
+}
+
+/// Mark a stage as not expected to beat.
+static inline void watchdog_idle(watchdog_stage_t *stage)
+{
+    __atomic_store_n(&stage->idle, 1, __ATOMIC_RELAXED);
+}
+
+#endif /* INCLUDE_WATCHDOG_H_ */
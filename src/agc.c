@@ -0,0 +1,62 @@
+/** @file
+    Software gain control driven by the detector statistics.
+*/
+
+#include "agc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int agc_init(agc_t *agc, int const *gains, int num_gains, int gain, uint32_t samp_rate)
+{
+    memset(agc, 0, sizeof(*agc));
+    if (num_gains < 1)
+        return -1;
+    if (num_gains > SDR_MAX_GAINS)
+        num_gains = SDR_MAX_GAINS;
+
+    memcpy(agc->gains, gains, num_gains * sizeof(*gains));
+    agc->num_gains = num_gains;
+    for (int i = 1; i < num_gains; ++i) {
+        if (abs(gains[i] - gain) < abs(gains[agc->index] - gain))
+            agc->index = i;
+    }
+
+    agc->interval    = (uint64_t)(AGC_INTERVAL * samp_rate);
+    agc->hold        = (uint64_t)(AGC_HOLD * samp_rate);
+    agc->next_sample = agc->hold;
+    return 0;
+}
+
+int agc_update(agc_t *agc, mrbeam_stats_t const *stats)
+{
+    if (stats->samples < agc->next_sample)
+        return 0;
+
+    uint64_t values = (stats->samples - agc->last_samples) * 2;
+    double clip     = values ? (double)(stats->clipped - agc->last_clipped) / values : 0.0;
+    agc->last_samples = stats->samples;
+    agc->last_clipped = stats->clipped;
+    agc->next_sample  = stats->samples + agc->interval;
+
+    // the quietest channel is the one least likely to hold a signal
+    float noise = stats->noise[0];
+    for (int i = 1; i < stats->channels; ++i) {
+        if (stats->noise[i] < noise)
+            noise = stats->noise[i];
+    }
+
+    int step = 0;
+    if (clip > AGC_CLIP_HIGH || noise > AGC_NOISE_HIGH)
+        step = -1;
+    else if (clip < AGC_CLIP_LOW && noise < AGC_NOISE_LOW)
+        step = 1;
+
+    if (agc->index + step < 0 || agc->index + step >= agc->num_gains)
+        step = 0;
+    if (step) {
+        agc->index += step;
+        agc->next_sample = stats->samples + agc->hold;
+    }
+    return step;
+}
@@ -0,0 +1,289 @@
+/** @file
+    Batch replay of capture files on a pool of detectors.
+*/
+
+#include "batch.h"
+#include "event_fmt.h"
+#include "fork_join.h"
+#include "sample_clock.h"
+#include "scan.h"
+#include "fatal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+typedef struct batch_job {
+    batch_t *batch;
+    batch_file_t *file;
+    FILE *log;
+    int log_failed;
+    event_fmt_t fmt;
+    eval_truth_t *truth; ///< ground truth of the capture, with a tolerance set
+    int truths;
+    mrbeam_event_t *ev;  ///< events kept for the evaluation
+    int n;
+    int size;
+} batch_job_t;
+
+static char const *log_ext(int mode)
+{
+    switch (mode) {
+    case EVENT_FMT_JSON:
+        return ".json";
+    case EVENT_FMT_BINARY:
+        return ".bin";
+    default:
+        return ".log";
+    }
+}
+
+static void batch_event(mrbeam_event_t const *ev, void *ctx)
+{
+    batch_job_t *job = ctx;
+    char buf[EVENT_FMT_MAX];
+
+    int n = event_fmt_write(&job->fmt, ev, buf);
+    if (fwrite(buf, 1, n, job->log) != (size_t)n)
+        job->log_failed = 1;
+
+    job->file->events++;
+    if (ev->channel >= 0 && ev->channel < MRBEAM_CHANNELS)
+        job->file->channel_events[ev->channel]++;
+
+    if (!job->batch->tolerance)
+        return;
+    if (job->n == job->size) {
+        int size = job->size ? 2 * job->size : 64;
+        mrbeam_event_t *p = realloc(job->ev, size * sizeof(*p));
+        if (!p) {
+            WARN_REALLOC("batch_event()");
+            return;
+        }
+        job->ev   = p;
+        job->size = size;
+    }
+    job->ev[job->n++] = *ev;
+}
+
+/// CPU seconds of the calling thread.
+static double thread_cpu_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// Read the ground truth of a capture, before the replay so a missing one fails early.
+static int batch_load_truth(batch_job_t *job)
+{
+    char const *path = job->file->path;
+    size_t len = strlen(path) + strlen(EVAL_TRUTH_EXT) + 1;
+    char *truth_path = malloc(len);
+    if (!truth_path) {
+        WARN_MALLOC("batch_load_truth()");
+        return -1;
+    }
+    snprintf(truth_path, len, "%s%s", path, EVAL_TRUTH_EXT);
+    job->truths = eval_load_truth(truth_path, &job->truth);
+    free(truth_path);
+    return job->truths < 0 ? -1 : 0;
+}
+
+/// Scan the capture for its channels, keeps the plan if no lights were found.
+static void batch_scan(batch_job_t *job, void *det, FILE *in, unsigned char *buf, size_t pair, size_t pairs)
+{
+    r_cfg_t *cfg = job->batch->cfg;
+    scan_t *scan = scan_create(cfg->samp_rate, cfg->scan_time);
+    if (!scan)
+        return;
+    scan_set_format(scan, job->file->format, job->file->full_scale);
+
+    size_t n_read;
+    int done = 0;
+    while (!done && !cfg->do_exit && (n_read = fread(buf, pair, pairs, in)) > 0)
+        done = scan_feed(scan, buf, (uint32_t)(n_read * pair));
+
+    float offsets[MRBEAM_CHANNELS];
+    int channels = scan_result(scan, offsets, MRBEAM_CHANNELS);
+    if (channels > 0)
+        mrbeam_set_channels(det, offsets, channels);
+    scan_free(scan);
+    rewind(in);
+}
+
+static int batch_replay(batch_job_t *job, void *det, FILE *in)
+{
+    r_cfg_t *cfg = job->batch->cfg;
+    batch_file_t *file = job->file;
+
+    if (mrbeam_set_format(det, file->format, file->full_scale)) {
+        fprintf(stderr, "%s: unsupported format\n", file->path);
+        return -1;
+    }
+    mrbeam_set_replay(det);
+    mrbeam_set_event_cb(det, batch_event, job);
+
+    // whole I/Q pairs only
+    size_t pair  = 2 * mrbeam_sample_size(file->format);
+    size_t pairs = cfg->out_block_size / pair;
+    unsigned char *buf = malloc(pairs * pair);
+    if (!buf) {
+        WARN_MALLOC("batch_replay()");
+        return -1;
+    }
+
+    if (cfg->scan_time)
+        batch_scan(job, det, in, buf, pair, pairs);
+
+    size_t n_read;
+    while (!cfg->do_exit && (n_read = fread(buf, pair, pairs, in)) > 0)
+        sdr_callback(buf, (uint32_t)(n_read * pair), det);
+
+    int r = ferror(in) ? -1 : 0;
+    if (r)
+        fprintf(stderr, "%s: %s\n", file->path, strerror(errno));
+    free(buf);
+    return r;
+}
+
+static void batch_task(void *ctx, int task)
+{
+    batch_t *batch = ctx;
+    batch_job_t job = {.batch = batch, .file = &batch->files[task]};
+    batch_file_t *file = job.file;
+    double start = mono_time();
+
+    if (batch->tolerance && batch_load_truth(&job) < 0) {
+        file->failed = 1;
+        return;
+    }
+    FILE *in = fopen(file->path, "rb");
+    if (!in) {
+        fprintf(stderr, "%s: %s\n", file->path, strerror(errno));
+        free(job.truth);
+        file->failed = 1;
+        return;
+    }
+
+    char const *ext = log_ext(batch->cfg->output_format);
+    size_t len = strlen(file->path) + strlen(ext) + 1;
+    char *log_path = malloc(len);
+    if (!log_path) {
+        WARN_MALLOC("batch_task()");
+        fclose(in);
+        free(job.truth);
+        file->failed = 1;
+        return;
+    }
+    snprintf(log_path, len, "%s%s", file->path, ext);
+    job.log = fopen(log_path, "wb");
+    if (!job.log) {
+        fprintf(stderr, "%s: %s\n", log_path, strerror(errno));
+        free(log_path);
+        fclose(in);
+        free(job.truth);
+        file->failed = 1;
+        return;
+    }
+    event_fmt_init(&job.fmt, batch->cfg->output_format, batch->cfg);
+
+    void *det = batch->setup(batch->setup_ctx);
+    double cpu = thread_cpu_time();
+    if (!det || batch_replay(&job, det, in) < 0)
+        file->failed = 1;
+    file->eval.cpu_secs = thread_cpu_time() - cpu;
+
+    if (det) {
+        mrbeam_stats_t stats;
+        mrbeam_get_stats(det, &stats);
+        file->samples  = stats.samples;
+        file->clipped  = stats.clipped;
+        file->channels = stats.channels;
+        mrbeam_free(det);
+    }
+
+    if (fclose(job.log) || job.log_failed) {
+        fprintf(stderr, "%s: write failed\n", log_path);
+        file->failed = 1;
+    }
+    if (batch->tolerance && !file->failed) {
+        eval_match(job.truth, job.truths, job.ev, job.n, batch->cfg->samp_rate, batch->tolerance, &file->eval);
+        file->eval.signal_secs = (double)file->samples / batch->cfg->samp_rate;
+    }
+    free(job.truth);
+    free(job.ev);
+    free(log_path);
+    fclose(in);
+    file->secs = mono_time() - start;
+}
+
+int batch_run(batch_t *batch, int jobs)
+{
+    fork_join_t *pool = NULL;
+    if (jobs > 1 && batch->count > 1) {
+        if (jobs > batch->count)
+            jobs = batch->count;
+        pool = fork_join_create(jobs);
+        if (!pool)
+            return -1;
+    }
+
+    fork_join_run(pool, batch->count, batch_task, batch);
+    fork_join_free(pool);
+
+    for (int i = 0; i < batch->count; ++i) {
+        if (batch->files[i].failed)
+            return -1;
+    }
+    return 0;
+}
+
+void batch_summary(batch_t const *batch, FILE *out, double elapsed)
+{
+    uint32_t samp_rate = batch->cfg->samp_rate;
+    uint64_t samples = 0;
+    unsigned events = 0;
+    int failed = 0;
+
+    for (int i = 0; i < batch->count; ++i) {
+        batch_file_t const *file = &batch->files[i];
+        if (file->failed) {
+            fprintf(out, "%s: failed\n", file->path);
+            failed++;
+            continue;
+        }
+        fprintf(out, "%s: %.1f s in %.2f s, %.4f %% clipped, %u events",
+                file->path, (double)file->samples / samp_rate, file->secs,
+                file->samples ? 50.0 * file->clipped / file->samples : 0.0, file->events);
+        char const *sep = " (";
+        for (int c = 0; c < file->channels; ++c) {
+            if (file->channel_events[c]) {
+                fprintf(out, "%schannel %d: %u", sep, c, file->channel_events[c]);
+                sep = ", ";
+            }
+        }
+        fprintf(out, "%s\n", *sep == ',' ? ")" : "");
+        samples += file->samples;
+        events  += file->events;
+    }
+
+    double secs = (double)samples / samp_rate;
+    fprintf(out, "Batch: %d files, %.1f s of samples in %.1f s (%.0fx real time), %u events, %d failed\n",
+            batch->count, secs, elapsed, elapsed > 0 ? secs / elapsed : 0.0, events, failed);
+}
+
+void batch_evaluation(batch_t const *batch, FILE *out)
+{
+    eval_result_t total = {0};
+
+    for (int i = 0; i < batch->count; ++i) {
+        batch_file_t const *file = &batch->files[i];
+        if (file->failed)
+            continue;
+        eval_report(out, file->path, &file->eval);
+        eval_add(&total, &file->eval);
+    }
+    eval_report(out, "total", &total);
+}
@@ -0,0 +1,284 @@
+/** @file
+    Parallel replay of one capture in chunks with a deterministic merge.
+*/
+
+#include "chunk_replay.h"
+#include "fork_join.h"
+#include "fatal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+typedef struct chunk {
+    chunk_replay_t *replay;
+    uint64_t warm;           ///< first sample read
+    uint64_t start;          ///< events past this sample belong to the chunk
+    uint64_t end;            ///< sample just past the chunk
+    void *det;               ///< detector at the end of the chunk
+    mrbeam_state_t *state;   ///< detector state at the start, NULL for the first chunk
+    uint64_t clipped;        ///< clipped values within the chunk
+    mrbeam_event_t *ev;
+    int n;
+    int size;
+    int done;                ///< replayed to the end
+} chunk_t;
+
+static void chunk_event(mrbeam_event_t const *ev, void *ctx)
+{
+    chunk_t *chunk = ctx;
+
+    // events of the warm-up belong to the chunk before
+    if (ev->samplePos <= chunk->start)
+        return;
+    if (chunk->n == chunk->size) {
+        int size = chunk->size ? 2 * chunk->size : 16;
+        mrbeam_event_t *p = realloc(chunk->ev, size * sizeof(*p));
+        if (!p) {
+            WARN_REALLOC("chunk_event()");
+            return;
+        }
+        chunk->ev   = p;
+        chunk->size = size;
+    }
+    chunk->ev[chunk->n++] = *ev;
+}
+
+/// Feed samples from..to, blocks end on the block grid of a sequential replay.
+static int chunk_feed(chunk_t *chunk, void *det, FILE *in, unsigned char *buf, uint64_t from, uint64_t to)
+{
+    r_cfg_t *cfg = chunk->replay->cfg;
+    size_t pair  = 2 * mrbeam_sample_size(chunk->replay->format);
+    uint64_t block = cfg->out_block_size / pair;
+
+    while (from < to && !cfg->do_exit) {
+        uint64_t next = (from / block + 1) * block;
+        size_t pairs  = (size_t)((next < to ? next : to) - from);
+        if (fread(buf, pair, pairs, in) != pairs)
+            return -1;
+        sdr_callback(buf, (uint32_t)(pairs * pair), det);
+        from += pairs;
+    }
+    return from < to ? -1 : 0;
+}
+
+static FILE *chunk_open(chunk_t *chunk, uint64_t pos)
+{
+    chunk_replay_t *replay = chunk->replay;
+    size_t pair = 2 * mrbeam_sample_size(replay->format);
+
+    FILE *in = fopen(replay->path, "rb");
+    if (!in) {
+        fprintf(stderr, "%s: %s\n", replay->path, strerror(errno));
+        return NULL;
+    }
+    if (fseeko(in, (off_t)(pos * pair), SEEK_SET)) {
+        fprintf(stderr, "%s: %s\n", replay->path, strerror(errno));
+        fclose(in);
+        return NULL;
+    }
+    return in;
+}
+
+static uint64_t det_clipped(void *det)
+{
+    mrbeam_stats_t stats;
+    mrbeam_get_stats(det, &stats);
+    return stats.clipped;
+}
+
+static void chunk_task(void *ctx, int task)
+{
+    chunk_t *chunk = &((chunk_t *)ctx)[task];
+    r_cfg_t *cfg = chunk->replay->cfg;
+
+    unsigned char *buf = malloc(cfg->out_block_size);
+    FILE *in = chunk_open(chunk, chunk->warm);
+    if (!buf || !in) {
+        if (!buf)
+            WARN_MALLOC("chunk_task()");
+        free(buf);
+        if (in)
+            fclose(in);
+        return;
+    }
+
+    void *det = chunk->det;
+    mrbeam_set_position(det, chunk->warm);
+    mrbeam_set_event_cb(det, chunk_event, chunk);
+
+    if (chunk_feed(chunk, det, in, buf, chunk->warm, chunk->start) == 0) {
+        if (chunk->start)
+            chunk->state = mrbeam_save_state(det);
+        uint64_t clipped = det_clipped(det);
+        if (chunk_feed(chunk, det, in, buf, chunk->start, chunk->end) == 0) {
+            chunk->clipped = det_clipped(det) - clipped;
+            chunk->done    = 1;
+        }
+    }
+    if (ferror(in))
+        fprintf(stderr, "%s: %s\n", chunk->replay->path, strerror(errno));
+    fclose(in);
+    free(buf);
+}
+
+/// Replay a chunk again with the detector that ended the chunk before.
+static int chunk_rerun(chunk_t *chunk, chunk_t *prev)
+{
+    r_cfg_t *cfg = chunk->replay->cfg;
+
+    unsigned char *buf = malloc(cfg->out_block_size);
+    FILE *in = chunk_open(chunk, chunk->start);
+    if (!buf || !in) {
+        if (!buf)
+            WARN_MALLOC("chunk_rerun()");
+        free(buf);
+        if (in)
+            fclose(in);
+        return -1;
+    }
+
+    mrbeam_free(chunk->det);
+    chunk->det  = prev->det;
+    prev->det   = NULL;
+    chunk->n    = 0;
+    chunk->done = 0;
+    mrbeam_set_event_cb(chunk->det, chunk_event, chunk);
+
+    uint64_t clipped = det_clipped(chunk->det);
+    if (chunk_feed(chunk, chunk->det, in, buf, chunk->start, chunk->end) == 0) {
+        chunk->clipped = det_clipped(chunk->det) - clipped;
+        chunk->done    = 1;
+    }
+    fclose(in);
+    free(buf);
+    return chunk->done ? 0 : -1;
+}
+
+/// Cut the capture into chunks on the block grid, at least four overlaps long.
+static int chunk_plan(chunk_replay_t *replay, int jobs, uint64_t samples, uint64_t align, chunk_t **chunks)
+{
+    r_cfg_t *cfg = replay->cfg;
+    uint64_t block   = cfg->out_block_size / (2 * mrbeam_sample_size(replay->format));
+    uint64_t overlap = (uint64_t)(replay->overlap * cfg->samp_rate);
+    uint64_t least   = 4 * overlap > block ? 4 * overlap : block;
+
+    uint64_t count = samples / least;
+    if (count > (uint64_t)jobs * 4)
+        count = (uint64_t)jobs * 4;
+    if (count < 1)
+        count = 1;
+
+    chunk_t *c = calloc(count, sizeof(*c));
+    if (!c) {
+        WARN_CALLOC("chunk_plan()");
+        return -1;
+    }
+    for (uint64_t k = 0; k < count; ++k) {
+        c[k].replay = replay;
+        c[k].start  = samples * k / count / block * block;
+        c[k].end    = samples * (k + 1) / count / block * block;
+        c[k].warm   = c[k].start > overlap ? (c[k].start - overlap) / align * align : 0;
+    }
+    c[count - 1].end = samples;
+    *chunks = c;
+    return (int)count;
+}
+
+int chunk_replay_run(chunk_replay_t *replay, int jobs)
+{
+    r_cfg_t *cfg = replay->cfg;
+    size_t pair  = 2 * mrbeam_sample_size(replay->format);
+
+    struct stat st;
+    if (stat(replay->path, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", replay->path, strerror(errno));
+        return -1;
+    }
+    uint64_t samples = (uint64_t)st.st_size / pair;
+
+    // alignment depends on the options only, ask a detector before the plan
+    void *det = replay->setup(replay->setup_ctx);
+    if (!det)
+        return -1;
+    uint64_t align = mrbeam_alignment(det);
+    mrbeam_free(det);
+
+    chunk_t *chunks;
+    int count = chunk_plan(replay, jobs, samples, align, &chunks);
+    if (count < 0)
+        return -1;
+    replay->chunks = count;
+    replay->reruns = 0;
+
+    // a sequential replay anchors at the arrival of its first block
+    uint64_t block = cfg->out_block_size / pair;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    double anchor_time = now.tv_sec + now.tv_nsec * 1e-9;
+
+    int r = 0;
+    for (int k = 0; k < count; ++k) {
+        chunks[k].det = replay->setup(replay->setup_ctx);
+        if (!chunks[k].det || mrbeam_set_format(chunks[k].det, replay->format, replay->full_scale)) {
+            fprintf(stderr, "%s: detector setup failed\n", replay->path);
+            count = k + (chunks[k].det != NULL);
+            r = -1;
+            break;
+        }
+        mrbeam_set_replay(chunks[k].det);
+        mrbeam_set_anchor(chunks[k].det, samples < block ? samples : block, anchor_time);
+    }
+
+    fork_join_t *pool = NULL;
+    if (!r && jobs > 1 && count > 1) {
+        pool = fork_join_create(jobs < count ? jobs : count);
+        if (!pool)
+            r = -1;
+    }
+    if (!r)
+        fork_join_run(pool, count, chunk_task, chunks);
+    fork_join_free(pool);
+
+    // check every chunk against the end of the one before, in order, and
+    // report the events of the chunks that agree with a sequential replay
+    uint64_t clipped = 0;
+    void *last = NULL;
+    for (int k = 0; !r && k < count; ++k) {
+        chunk_t *chunk = &chunks[k];
+        if (!chunk->done) {
+            // an interrupted replay reports what it got to, like a sequential one
+            if (!cfg->do_exit)
+                r = -1;
+            break;
+        }
+        if (k > 0 && !mrbeam_state_match(chunks[k - 1].det, chunk->state)) {
+            replay->reruns++;
+            if (chunk_rerun(chunk, &chunks[k - 1]) < 0) {
+                r = -1;
+                break;
+            }
+        }
+        for (int i = 0; i < chunk->n; ++i)
+            replay->event_cb(&chunk->ev[i], replay->event_ctx);
+        clipped += chunk->clipped;
+        last = chunk->det;
+    }
+    if (last) {
+        mrbeam_get_stats(last, &replay->stats);
+        replay->stats.clipped = clipped;
+    }
+
+    for (int k = 0; k < count; ++k) {
+        if (chunks[k].det)
+            mrbeam_free(chunks[k].det);
+        free(chunks[k].state);
+        free(chunks[k].ev);
+    }
+    free(chunks);
+    return r;
+}
@@ -0,0 +1,174 @@
+/** @file
+    Detection accuracy of a replay against ground truth.
+*/
+
+#include "evaluate.h"
+#include "fatal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+static int cmp_truth(void const *a, void const *b)
+{
+    double ta = ((eval_truth_t const *)a)->time;
+    double tb = ((eval_truth_t const *)b)->time;
+    return (ta > tb) - (ta < tb);
+}
+
+int eval_load_truth(char const *path, eval_truth_t **truth)
+{
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    eval_truth_t *t = NULL;
+    int count = 0;
+    int size  = 0;
+    char line[256];
+    for (int n = 1; fgets(line, sizeof(line), in); ++n) {
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        double time;
+        int channel;
+        char rest;
+        int fields = sscanf(line, "%lf %d %c", &time, &channel, &rest);
+        if (fields <= 0)
+            continue; // blank or comment
+        if (fields != 2 || time < 0 || channel < 0) {
+            fprintf(stderr, "%s:%d: expected <seconds> <channel>\n", path, n);
+            free(t);
+            fclose(in);
+            return -1;
+        }
+        if (count == size) {
+            size = size ? 2 * size : 64;
+            eval_truth_t *p = realloc(t, size * sizeof(*p));
+            if (!p)
+                FATAL_REALLOC("eval_load_truth()");
+            t = p;
+        }
+        t[count].time    = time;
+        t[count].channel = channel;
+        count++;
+    }
+    fclose(in);
+
+    qsort(t, count, sizeof(*t), cmp_truth);
+    *truth = t;
+    return count;
+}
+
+void eval_match(eval_truth_t const *truth, int count, mrbeam_event_t const *ev, int events,
+        uint32_t samp_rate, double tolerance, eval_result_t *result)
+{
+    char *found = calloc(count ? count : 1, 1);
+    if (!found)
+        FATAL_CALLOC("eval_match()");
+
+    result->truth    = count;
+    result->detected = events;
+    result->found = result->duplicates = result->false_alarms = 0;
+    result->err_sum = result->err_sq = result->err_max = 0;
+
+    // the truth is in time order, the window of a detection only moves on
+    int lo = 0;
+    for (int k = 0; k < events; ++k) {
+        double time = (double)ev[k].samplePos / samp_rate;
+        while (lo < count && truth[lo].time < time - tolerance)
+            lo++;
+
+        // the earliest light not found yet, else a duplicate of one found
+        int match = -1;
+        int duplicate = 0;
+        for (int i = lo; i < count && truth[i].time <= time + tolerance; ++i) {
+            if (truth[i].channel != ev[k].channel)
+                continue;
+            if (!found[i]) {
+                match = i;
+                break;
+            }
+            duplicate = 1;
+        }
+
+        if (match >= 0) {
+            double err = time - truth[match].time;
+            found[match] = 1;
+            result->found++;
+            result->err_sum += err;
+            result->err_sq  += err * err;
+            if (fabs(err) > result->err_max)
+                result->err_max = fabs(err);
+        }
+        else if (duplicate) {
+            result->duplicates++;
+        }
+        else {
+            result->false_alarms++;
+        }
+    }
+    free(found);
+}
+
+void eval_add(eval_result_t *total, eval_result_t const *result)
+{
+    total->truth        += result->truth;
+    total->detected     += result->detected;
+    total->found        += result->found;
+    total->duplicates   += result->duplicates;
+    total->false_alarms += result->false_alarms;
+    total->err_sum      += result->err_sum;
+    total->err_sq       += result->err_sq;
+    if (result->err_max > total->err_max)
+        total->err_max = result->err_max;
+    total->signal_secs  += result->signal_secs;
+    total->cpu_secs     += result->cpu_secs;
+}
+
+/// A number, null if there is nothing to divide.
+static void print_ratio(FILE *out, char const *key, double num, double den)
+{
+    if (den > 0)
+        fprintf(out, ",\"%s\":%.6g", key, num / den);
+    else
+        fprintf(out, ",\"%s\":null", key);
+}
+
+static void print_string(FILE *out, char const *s)
+{
+    fputc('"', out);
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+void eval_report(FILE *out, char const *name, eval_result_t const *r)
+{
+    fprintf(out, "{\"capture\":");
+    print_string(out, name);
+    fprintf(out, ",\"truth\":%u,\"detected\":%u,\"found\":%u,\"missed\":%u,\"duplicates\":%u,\"false_alarms\":%u",
+            r->truth, r->detected, r->found, r->truth - r->found, r->duplicates, r->false_alarms);
+    // a duplicate trigger is as wrong as a false alarm for tuning
+    print_ratio(out, "precision", r->found, r->detected);
+    print_ratio(out, "precision_ignoring_duplicates", r->detected - r->false_alarms, r->detected);
+    print_ratio(out, "recall", r->found, r->truth);
+    print_ratio(out, "timing_mean", r->err_sum, r->found);
+    if (r->found)
+        fprintf(out, ",\"timing_rms\":%.6g,\"timing_max\":%.6g", sqrt(r->err_sq / r->found), r->err_max);
+    else
+        fprintf(out, ",\"timing_rms\":null,\"timing_max\":null");
+    fprintf(out, ",\"signal_secs\":%.3f,\"cpu_secs\":%.3f", r->signal_secs, r->cpu_secs);
+    print_ratio(out, "cpu_per_signal_sec", r->cpu_secs, r->signal_secs);
+    fprintf(out, "}\n");
+}
@@ -0,0 +1,161 @@
+/** @file
+    Allocation-free event serializer, JSON lines or fixed-width binary.
+*/
+
+#include "event_fmt.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+
+void event_fmt_init(event_fmt_t *fmt, event_fmt_mode_t mode, r_cfg_t const *cfg)
+{
+    memset(fmt, 0, sizeof(*fmt));
+    fmt->mode              = mode;
+    fmt->report_time       = cfg->report_time;
+    fmt->report_time_hires = cfg->report_time_hires;
+    fmt->report_time_tz    = cfg->report_time_tz;
+    fmt->report_time_utc   = cfg->report_time_utc;
+    fmt->report_meta       = cfg->report_meta;
+    fmt->cached_sec        = -1;
+}
+
+static void event_fmt_cache_second(event_fmt_t *fmt, time_t sec)
+{
+    struct tm tm_info;
+
+    if (fmt->report_time_utc)
+        gmtime_r(&sec, &tm_info);
+    else
+        localtime_r(&sec, &tm_info);
+
+    char const *format = fmt->report_time == REPORT_TIME_ISO ? "%Y-%m-%dT%H:%M:%S" : "%Y-%m-%d %H:%M:%S";
+    fmt->prefix_len = strftime(fmt->prefix, sizeof(fmt->prefix), format, &tm_info);
+
+    fmt->suffix_len = 0;
+    if (fmt->report_time_tz) {
+        fmt->suffix_len = strftime(fmt->suffix, sizeof(fmt->suffix), "%z", &tm_info);
+        if (!strcmp(fmt->suffix, "+0000"))
+            fmt->suffix_len = snprintf(fmt->suffix, sizeof(fmt->suffix), "Z");
+    }
+
+    fmt->cached_sec = sec;
+}
+
+/// Write the event time as text, returns the length, 0 if time is off.
+static int event_fmt_time(event_fmt_t *fmt, mrbeam_event_t const *ev, char *buf)
+{
+    time_t sec = (time_t)ev->time;
+    long usec  = (long)((ev->time - (double)sec) * 1e6 + 0.5);
+    if (usec > 999999)
+        usec = 999999;
+
+    switch (fmt->report_time) {
+    case REPORT_TIME_OFF:
+        return 0;
+    case REPORT_TIME_SAMPLES:
+        return sprintf(buf, "@%" PRIu64, ev->samplePos);
+    case REPORT_TIME_UNIX:
+        if (fmt->report_time_hires)
+            return sprintf(buf, "%ld.%06ld", (long)sec, usec);
+        return sprintf(buf, "%ld", (long)sec);
+    default:
+        break;
+    }
+
+    if (sec != fmt->cached_sec)
+        event_fmt_cache_second(fmt, sec);
+
+    char *p = buf;
+    memcpy(p, fmt->prefix, fmt->prefix_len);
+    p += fmt->prefix_len;
+    if (fmt->report_time_hires) {
+        *p++ = '.';
+        for (int i = 5; i >= 0; --i) {
+            p[i] = '0' + usec % 10;
+            usec /= 10;
+        }
+        p += 6;
+    }
+    memcpy(p, fmt->suffix, fmt->suffix_len);
+    p += fmt->suffix_len;
+    return p - buf;
+}
+
+static float level_db(float mag2)
+{
+    return mag2 > 0.0f ? 10.0f * log10f(mag2) : -99.0f;
+}
+
+static int event_fmt_json(event_fmt_t *fmt, mrbeam_event_t const *ev, char *buf)
+{
+    char *p = buf;
+
+    *p++ = '{';
+    if (fmt->report_time != REPORT_TIME_OFF && fmt->report_time != REPORT_TIME_SAMPLES) {
+        int quote = fmt->report_time != REPORT_TIME_UNIX;
+        p += sprintf(p, "\"time\":%s", quote ? "\"" : "");
+        p += event_fmt_time(fmt, ev, p);
+        p += sprintf(p, "%s,", quote ? "\"" : "");
+    }
+    p += sprintf(p, "\"sample\":%" PRIu64 ",\"channel\":%d", ev->samplePos, ev->channel);
+    if (ev->freq)
+        p += sprintf(p, ",\"freq\":%" PRIu32, ev->freq);
+    if (ev->kind == MRBEAM_EVENT_EARLY)
+        p += sprintf(p, ",\"event\":\"early\",\"confidence\":%.6f", ev->confidence);
+    else if (ev->kind == MRBEAM_EVENT_CONFIRMED)
+        p += sprintf(p, ",\"event\":\"confirmed\"");
+    if (fmt->report_meta) {
+        p += sprintf(p, ",\"count\":%d,\"level\":%.1f", ev->count, level_db(ev->level));
+        if (isnan(ev->snr))
+            p += sprintf(p, ",\"snr\":null");
+        else
+            p += sprintf(p, ",\"snr\":%.1f", ev->snr);
+    }
+    *p++ = '}';
+    *p++ = '\n';
+    *p   = '\0';
+    return p - buf;
+}
+
+static int event_fmt_binary(mrbeam_event_t const *ev, char *buf)
+{
+    event_record_t rec = {
+            .magic      = EVENT_RECORD_MAGIC,
+            .version    = EVENT_RECORD_VERSION,
+            .channel    = (uint16_t)ev->channel,
+            .time_us    = (int64_t)(ev->time * 1e6 + 0.5),
+            .sample_pos = ev->samplePos,
+            .count      = (uint32_t)ev->count,
+            .level_db   = level_db(ev->level),
+            .snr_db     = ev->snr,
+            .freq       = ev->freq,
+            .kind       = (uint16_t)ev->kind,
+            .confidence = ev->confidence,
+    };
+    memcpy(buf, &rec, sizeof(rec));
+    return sizeof(rec);
+}
+
+int event_fmt_write(event_fmt_t *fmt, mrbeam_event_t const *ev, char *buf)
+{
+    switch (fmt->mode) {
+    case EVENT_FMT_JSON:
+        return event_fmt_json(fmt, ev, buf);
+    case EVENT_FMT_BINARY:
+        return event_fmt_binary(ev, buf);
+    default:
+        break;
+    }
+
+    // plain: the channel number, prefixed by the time only if asked for
+    int len = 0;
+    if (fmt->report_time != REPORT_TIME_DEFAULT && fmt->report_time != REPORT_TIME_OFF) {
+        len = event_fmt_time(fmt, ev, buf);
+        buf[len++] = ' ';
+    }
+    if (ev->kind == MRBEAM_EVENT_CONFIRMED)
+        return len + sprintf(buf + len, "%d confirmed\n", ev->channel);
+    return len + sprintf(buf + len, "%d\n", ev->channel);
+}
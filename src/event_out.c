@@ -0,0 +1,320 @@
+/** @file
+    Asynchronous, batched event output.
+*/
+
+#include "event_out.h"
+#include "optparse.h"
+#include "fatal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <semaphore.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define EVENT_BATCH_MAX (EVENT_FMT_MAX * 64)
+
+typedef enum {
+    SINK_STREAM, ///< stdout or append-only file, one write per batch
+    SINK_DGRAM,  ///< UDP or Unix datagram socket, one datagram per event record
+} sink_kind_t;
+
+typedef struct event_sink {
+    sink_kind_t kind;
+    int fd;
+    int owns_fd;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    char const *spec;
+} event_sink_t;
+
+struct event_out {
+    mrbeam_event_t queue[EVENT_OUT_QUEUE_LEN];
+    uint32_t head;     ///< written by the producer only
+    uint32_t tail;     ///< written by the writer thread only
+    uint32_t dropped;
+    int stopping;
+
+    sem_t wake;
+    pthread_t thread;
+    int running;
+
+    event_sink_t sinks[EVENT_OUT_MAX_SINKS];
+    int num_sinks;
+
+    event_fmt_t fmt;
+    int verbosity;     ///< echo events to stderr if nonzero
+    char batch[EVENT_BATCH_MAX];
+    unsigned line_off[EVENT_BATCH_MAX / EVENT_FMT_MAX + 1];
+};
+
+event_out_t *event_out_create(event_fmt_t const *fmt, int verbosity)
+{
+    event_out_t *out = calloc(1, sizeof(*out));
+    if (!out) {
+        WARN_CALLOC("event_out_create()");
+        return NULL;
+    }
+    out->fmt       = *fmt;
+    out->verbosity = verbosity;
+    if (sem_init(&out->wake, 0, 0) < 0) {
+        perror("sem_init");
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static int sink_open_udp(event_sink_t *sink, char *param)
+{
+    char *host = "localhost";
+    char *port = NULL;
+    hostport_param(param, &host, &port);
+    if (!port) {
+        fprintf(stderr, "Event sink \"%s\" needs a port\n", sink->spec);
+        return -1;
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = PF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    int ret = getaddrinfo(host, port, &hints, &res);
+    if (ret) {
+        fprintf(stderr, "Event sink \"%s\": %s\n", sink->spec, gai_strerror(ret));
+        return -1;
+    }
+    sink->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sink->fd >= 0) {
+        memcpy(&sink->addr, res->ai_addr, res->ai_addrlen);
+        sink->addr_len = res->ai_addrlen;
+    }
+    freeaddrinfo(res);
+    if (sink->fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    return 0;
+}
+
+static int sink_open_unix(event_sink_t *sink, char const *path)
+{
+    struct sockaddr_un *sun = (struct sockaddr_un *)&sink->addr;
+    if (strlen(path) >= sizeof(sun->sun_path)) {
+        fprintf(stderr, "Event sink \"%s\": path too long\n", sink->spec);
+        return -1;
+    }
+    sun->sun_family = AF_UNIX;
+    strcpy(sun->sun_path, path);
+    sink->addr_len = sizeof(*sun);
+
+    // the receiver may come and go, so address each datagram instead of connecting
+    sink->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sink->fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    return 0;
+}
+
+int event_out_add_sink(event_out_t *out, char const *spec)
+{
+    if (out->num_sinks >= EVENT_OUT_MAX_SINKS) {
+        fprintf(stderr, "Too many event sinks (max %d)\n", EVENT_OUT_MAX_SINKS);
+        return -1;
+    }
+
+    event_sink_t *sink = &out->sinks[out->num_sinks];
+    memset(sink, 0, sizeof(*sink));
+    sink->spec = spec;
+    sink->fd   = -1;
+
+    char *param = strdup(spec);
+    if (!param)
+        FATAL_STRDUP("event_out_add_sink()");
+    char *arg = arg_param(param);
+    int r = 0;
+
+    if (!strcmp(param, "stdout") || !strcmp(param, "-")) {
+        sink->kind = SINK_STREAM;
+        sink->fd   = STDOUT_FILENO;
+    }
+    else if (!strncmp(param, "file:", 5) && arg && *arg) {
+        sink->kind    = SINK_STREAM;
+        sink->owns_fd = 1;
+        sink->fd      = open(arg, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (sink->fd < 0) {
+            fprintf(stderr, "Event sink \"%s\": %s\n", spec, strerror(errno));
+            r = -1;
+        }
+    }
+    else if (!strncmp(param, "udp:", 4)) {
+        sink->kind    = SINK_DGRAM;
+        sink->owns_fd = 1;
+        r = sink_open_udp(sink, arg);
+    }
+    else if (!strncmp(param, "unix:", 5) && arg && *arg) {
+        sink->kind    = SINK_DGRAM;
+        sink->owns_fd = 1;
+        r = sink_open_unix(sink, arg);
+    }
+    else {
+        fprintf(stderr, "Unknown event sink \"%s\"\n", spec);
+        r = -1;
+    }
+
+    free(param);
+    if (r == 0)
+        out->num_sinks++;
+    return r;
+}
+
+static void sink_write(event_sink_t *sink, char const *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(sink->fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return; // reader gone, nothing sensible to do
+        buf += n;
+        len -= n;
+    }
+}
+
+static void sink_send(event_sink_t *sink, char const *buf, size_t len)
+{
+    // best effort, a missing receiver must not hold up the batch
+    sendto(sink->fd, buf, len, MSG_DONTWAIT, (struct sockaddr *)&sink->addr, sink->addr_len);
+}
+
+static void event_out_drain(event_out_t *out)
+{
+    uint32_t head = __atomic_load_n(&out->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = out->tail;
+
+    while (tail != head) {
+        unsigned n   = 0;
+        unsigned len = 0;
+        // records are mostly shorter than EVENT_FMT_MAX, bound the count too
+        for (; tail != head && len + EVENT_FMT_MAX <= EVENT_BATCH_MAX
+                && n < EVENT_BATCH_MAX / EVENT_FMT_MAX; ++tail, ++n) {
+            mrbeam_event_t const *ev = &out->queue[tail & (EVENT_OUT_QUEUE_LEN - 1)];
+            if (out->verbosity)
+                fprintf(stderr, "%f channel %d %s\n", ev->time, ev->channel,
+                        ev->kind == MRBEAM_EVENT_EARLY ? "early"
+                        : ev->kind == MRBEAM_EVENT_CONFIRMED ? "confirmed" : "light");
+            out->line_off[n] = len;
+            len += event_fmt_write(&out->fmt, ev, &out->batch[len]);
+        }
+        out->line_off[n] = len;
+        // records are copied out, hand the slots back to the producer
+        __atomic_store_n(&out->tail, tail, __ATOMIC_RELEASE);
+
+        for (int s = 0; s < out->num_sinks; ++s) {
+            event_sink_t *sink = &out->sinks[s];
+            if (sink->kind == SINK_STREAM) {
+                sink_write(sink, out->batch, len);
+            }
+            else {
+                for (unsigned i = 0; i < n; ++i)
+                    sink_send(sink, &out->batch[out->line_off[i]], out->line_off[i + 1] - out->line_off[i]);
+            }
+        }
+
+        head = __atomic_load_n(&out->head, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void *event_out_thread(void *arg)
+{
+    event_out_t *out = arg;
+
+    for (;;) {
+        while (sem_wait(&out->wake) < 0 && errno == EINTR)
+            ;
+        int stopping = __atomic_load_n(&out->stopping, __ATOMIC_ACQUIRE);
+        event_out_drain(out);
+        if (stopping)
+            break;
+    }
+    return NULL;
+}
+
+int event_out_start(event_out_t *out)
+{
+    if (!out->num_sinks && event_out_add_sink(out, "stdout") < 0)
+        return -1;
+
+    int r = pthread_create(&out->thread, NULL, event_out_thread, out);
+    if (r) {
+        fprintf(stderr, "Failed to start event output thread: %s\n", strerror(r));
+        return -1;
+    }
+    out->running = 1;
+    return 0;
+}
+
+void event_out_push(mrbeam_event_t const *ev, void *ctx)
+{
+    event_out_t *out = ctx;
+
+    uint32_t head = out->head;
+    uint32_t tail = __atomic_load_n(&out->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= EVENT_OUT_QUEUE_LEN) {
+        __atomic_fetch_add(&out->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    out->queue[head & (EVENT_OUT_QUEUE_LEN - 1)] = *ev;
+    __atomic_store_n(&out->head, head + 1, __ATOMIC_RELEASE);
+    sem_post(&out->wake);
+}
+
+void event_out_push_wait(mrbeam_event_t const *ev, void *ctx)
+{
+    event_out_t *out = ctx;
+
+    uint32_t head = out->head;
+    while (head - __atomic_load_n(&out->tail, __ATOMIC_ACQUIRE) >= EVENT_OUT_QUEUE_LEN) {
+        if (!out->running) {
+            event_out_drain(out);
+            continue;
+        }
+        sem_post(&out->wake);
+        nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+    }
+    event_out_push(ev, ctx);
+}
+
+void event_out_free(event_out_t *out)
+{
+    if (!out)
+        return;
+
+    if (out->running) {
+        __atomic_store_n(&out->stopping, 1, __ATOMIC_RELEASE);
+        sem_post(&out->wake);
+        pthread_join(out->thread, NULL);
+    }
+    else {
+        event_out_drain(out);
+    }
+
+    if (out->dropped)
+        fprintf(stderr, "WARNING: %u events dropped, output too slow.\n", out->dropped);
+
+    for (int s = 0; s < out->num_sinks; ++s) {
+        if (out->sinks[s].owns_fd)
+            close(out->sinks[s].fd);
+    }
+    sem_destroy(&out->wake);
+    free(out);
+}
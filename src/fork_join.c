@@ -0,0 +1,201 @@
+/** @file
+    Fork-join thread pool with work stealing.
+*/
+
+#include "fork_join.h"
+#include "fatal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/// A thread's share of the tasks, next in the low and end in the high half.
+typedef struct {
+    uint64_t range;
+    char pad_[56]; // one share per cache line
+} fork_join_share_t;
+
+typedef struct {
+    fork_join_t *pool;
+    int index;
+} fork_join_worker_t;
+
+struct fork_join {
+    int threads;
+    pthread_t thread[FORK_JOIN_MAX_THREADS];
+    fork_join_worker_t worker[FORK_JOIN_MAX_THREADS];
+    fork_join_share_t share[FORK_JOIN_MAX_THREADS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned generation; ///< bumped for each run
+    int busy;            ///< helper threads still working on the run
+    int stopping;
+
+    fork_join_task_t fn;
+    void *ctx;
+};
+
+static inline uint64_t share_pack(uint32_t next, uint32_t end)
+{
+    return (uint64_t)end << 32 | next;
+}
+
+/// Take the next task of a share, -1 if it is empty.
+static int share_pop(fork_join_share_t *share)
+{
+    uint64_t r = __atomic_load_n(&share->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t next = (uint32_t)r;
+        uint32_t end  = (uint32_t)(r >> 32);
+        if (next >= end)
+            return -1;
+        if (__atomic_compare_exchange_n(&share->range, &r, share_pack(next + 1, end),
+                    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return (int)next;
+    }
+}
+
+/// Steal the last task of a share, -1 if it is empty.
+static int share_steal(fork_join_share_t *share)
+{
+    uint64_t r = __atomic_load_n(&share->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t next = (uint32_t)r;
+        uint32_t end  = (uint32_t)(r >> 32);
+        if (next >= end)
+            return -1;
+        if (__atomic_compare_exchange_n(&share->range, &r, share_pack(next, end - 1),
+                    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return (int)end - 1;
+    }
+}
+
+static void fork_join_work(fork_join_t *pool, int index)
+{
+    int task;
+
+    while ((task = share_pop(&pool->share[index])) >= 0)
+        pool->fn(pool->ctx, task);
+
+    // out of work, help the others starting with the next thread
+    for (int i = 1; i < pool->threads; ++i) {
+        fork_join_share_t *victim = &pool->share[(index + i) % pool->threads];
+        while ((task = share_steal(victim)) >= 0)
+            pool->fn(pool->ctx, task);
+    }
+}
+
+static void *fork_join_thread(void *arg)
+{
+    fork_join_worker_t *worker = arg;
+    fork_join_t *pool = worker->pool;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stopping && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stopping)
+            break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        fork_join_work(pool, worker->index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+fork_join_t *fork_join_create(int threads)
+{
+    if (threads < 1 || threads > FORK_JOIN_MAX_THREADS) {
+        fprintf(stderr, "fork_join_create(): threads must be 1 to %d\n", FORK_JOIN_MAX_THREADS);
+        return NULL;
+    }
+    fork_join_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        WARN_CALLOC("fork_join_create()");
+        return NULL;
+    }
+    pool->threads = 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // thread 0 is the caller of fork_join_run()
+    for (int i = 1; i < threads; ++i) {
+        pool->worker[i].pool  = pool;
+        pool->worker[i].index = i;
+        int r = pthread_create(&pool->thread[i], NULL, fork_join_thread, &pool->worker[i]);
+        if (r) {
+            fprintf(stderr, "fork_join_create(): pthread_create failed (%d)\n", r);
+            fork_join_free(pool);
+            return NULL;
+        }
+        pool->threads++;
+    }
+    return pool;
+}
+
+void fork_join_run(fork_join_t *pool, int tasks, fork_join_task_t fn, void *ctx)
+{
+    if (!pool || pool->threads == 1 || tasks < 2) {
+        for (int task = 0; task < tasks; ++task)
+            fn(ctx, task);
+        return;
+    }
+
+    // contiguous shares, the first threads take one more if it does not divide
+    int threads = pool->threads;
+    for (int i = 0; i < threads; ++i) {
+        uint32_t begin = (uint32_t)((int64_t)tasks * i / threads);
+        uint32_t end   = (uint32_t)((int64_t)tasks * (i + 1) / threads);
+        __atomic_store_n(&pool->share[i].range, share_pack(begin, end), __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn   = fn;
+    pool->ctx  = ctx;
+    pool->busy = threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    fork_join_work(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int fork_join_threads(fork_join_t const *pool)
+{
+    return pool ? pool->threads : 1;
+}
+
+void fork_join_free(fork_join_t *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->threads; ++i)
+        pthread_join(pool->thread[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
@@ -0,0 +1,289 @@
+/** @file
+    On-disk cache of the decimated front-end outputs of a capture.
+*/
+
+#include "frontend_cache.h"
+#include "fatal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FRONTEND_CACHE_MAGIC "MRBFEC1\n"
+
+typedef struct cache_header {
+    char magic[8];
+    uint64_t key;
+    uint32_t channels;
+    uint32_t reserved;
+    uint64_t blocks;
+} cache_header_t;
+
+/// A block record, followed by channels * outputs I/Q pairs of float, channel by channel.
+typedef struct cache_block {
+    uint32_t samples;
+    uint32_t skip;
+    uint32_t first;
+    uint32_t outputs;
+    uint64_t clipped;
+} cache_block_t;
+
+struct frontend_cache {
+    char *path;
+    char *tmp_path;
+    // reading
+    void *map;
+    size_t map_size;
+    // writing
+    FILE *out;
+    cache_header_t header;
+    int failed;
+};
+
+/// Hash 8 byte words on four lanes, so the multiplies do not wait on each other.
+static uint64_t hash_words(uint64_t const *w, size_t words, uint64_t h)
+{
+    uint64_t const prime = 0x100000001b3ULL;
+    uint64_t lane[4] = {h, h ^ 1, h ^ 2, h ^ 3};
+
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4) {
+        lane[0] = (lane[0] ^ w[i]) * prime;
+        lane[1] = (lane[1] ^ w[i + 1]) * prime;
+        lane[2] = (lane[2] ^ w[i + 2]) * prime;
+        lane[3] = (lane[3] ^ w[i + 3]) * prime;
+    }
+    for (; i < words; ++i)
+        lane[0] = (lane[0] ^ w[i]) * prime;
+    for (int k = 1; k < 4; ++k)
+        lane[0] = (lane[0] ^ lane[k]) * prime;
+    return lane[0];
+}
+
+int frontend_cache_key(char const *path, uint64_t frontend_hash, uint32_t block_size, uint64_t *key)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t h = hash_words(&size, 1, frontend_hash);
+    h = hash_words(&(uint64_t){block_size}, 1, h);
+    if (size) {
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
+            return -1;
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+        h = hash_words(map, size / 8, h);
+        uint64_t tail = 0;
+        memcpy(&tail, (char const *)map + size / 8 * 8, size % 8);
+        h = hash_words(&tail, 1, h);
+        munmap(map, size);
+    }
+    close(fd);
+    *key = h;
+    return 0;
+}
+
+static char *cache_path(char const *dir, uint64_t key, char const *suffix)
+{
+    size_t len = strlen(dir) + strlen(suffix) + 32;
+    char *path = malloc(len);
+    if (!path)
+        FATAL_MALLOC("cache_path()");
+    snprintf(path, len, "%s/%016llx.fec%s", dir, (unsigned long long)key, suffix);
+    return path;
+}
+
+frontend_cache_t *frontend_cache_open(char const *dir, uint64_t key)
+{
+    char *path = cache_path(dir, key, "");
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        free(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(cache_header_t)) {
+        fprintf(stderr, "%s: not a front-end cache\n", path);
+        close(fd);
+        free(path);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        free(path);
+        return NULL;
+    }
+
+    cache_header_t const *header = map;
+    if (memcmp(header->magic, FRONTEND_CACHE_MAGIC, sizeof(header->magic)) || header->key != key
+            || header->channels > MRBEAM_CHANNELS || (header->blocks && header->channels < 1)) {
+        fprintf(stderr, "%s: not a front-end cache\n", path);
+        munmap(map, st.st_size);
+        free(path);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    frontend_cache_t *cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        WARN_CALLOC("frontend_cache_open()");
+        munmap(map, st.st_size);
+        free(path);
+        return NULL;
+    }
+    cache->path     = path;
+    cache->map      = map;
+    cache->map_size = st.st_size;
+    cache->header   = *header;
+    return cache;
+}
+
+int frontend_cache_replay(frontend_cache_t *cache, void *det, int const volatile *do_exit)
+{
+    char const *p   = (char const *)cache->map + sizeof(cache_header_t);
+    char const *end = (char const *)cache->map + cache->map_size;
+    int channels = (int)cache->header.channels;
+
+    for (uint64_t n = 0; n < cache->header.blocks && !*do_exit; ++n) {
+        cache_block_t const *rec = (cache_block_t const *)p;
+        if ((size_t)(end - p) < sizeof(*rec)) {
+            fprintf(stderr, "%s: truncated\n", cache->path);
+            return -1;
+        }
+        size_t pairs = (size_t)rec->outputs * 2;
+        p += sizeof(*rec);
+        if ((size_t)(end - p) / (channels * sizeof(float)) < pairs) {
+            fprintf(stderr, "%s: truncated\n", cache->path);
+            return -1;
+        }
+
+        mrbeam_frontend_block_t block = {
+                .samples  = rec->samples,
+                .skip     = rec->skip,
+                .clipped  = rec->clipped,
+                .first    = rec->first,
+                .outputs  = (int)rec->outputs,
+                .channels = channels,
+        };
+        for (int i = 0; i < channels; ++i) {
+            block.iq[i] = (float const *)p;
+            p += pairs * sizeof(float);
+        }
+        if (mrbeam_feed_frontend(det, &block)) {
+            fprintf(stderr, "%s: does not fit the detector\n", cache->path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+frontend_cache_t *frontend_cache_create(char const *dir, uint64_t key)
+{
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+        return NULL;
+    }
+
+    frontend_cache_t *cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        WARN_CALLOC("frontend_cache_create()");
+        return NULL;
+    }
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+    cache->path     = cache_path(dir, key, "");
+    cache->tmp_path = cache_path(dir, key, suffix);
+    cache->out      = fopen(cache->tmp_path, "wb");
+    if (!cache->out) {
+        fprintf(stderr, "%s: %s\n", cache->tmp_path, strerror(errno));
+        free(cache->path);
+        free(cache->tmp_path);
+        free(cache);
+        return NULL;
+    }
+    memcpy(cache->header.magic, FRONTEND_CACHE_MAGIC, sizeof(cache->header.magic));
+    cache->header.key = key;
+    // the header is written again with the block count at the end
+    if (fwrite(&cache->header, sizeof(cache->header), 1, cache->out) != 1)
+        cache->failed = 1;
+    return cache;
+}
+
+void frontend_cache_write(mrbeam_frontend_block_t const *block, void *ctx)
+{
+    frontend_cache_t *cache = ctx;
+
+    if (cache->failed)
+        return;
+    // the plan is known once the first block arrives
+    if (!cache->header.blocks)
+        cache->header.channels = block->channels;
+    if ((int)cache->header.channels != block->channels) {
+        fprintf(stderr, "%s: channel plan changed during the replay\n", cache->tmp_path);
+        cache->failed = 1;
+        return;
+    }
+
+    cache_block_t rec = {
+            .samples = block->samples,
+            .skip    = block->skip,
+            .first   = block->first,
+            .outputs = (uint32_t)block->outputs,
+            .clipped = block->clipped,
+    };
+    if (fwrite(&rec, sizeof(rec), 1, cache->out) != 1)
+        cache->failed = 1;
+    for (int i = 0; i < block->channels && !cache->failed; ++i) {
+        if (fwrite(block->iq[i], 2 * sizeof(float), block->outputs, cache->out) != (size_t)block->outputs)
+            cache->failed = 1;
+    }
+    cache->header.blocks++;
+}
+
+int frontend_cache_close(frontend_cache_t *cache, int complete)
+{
+    if (!cache)
+        return 0;
+
+    int r = 0;
+    if (cache->map)
+        munmap(cache->map, cache->map_size);
+    if (cache->out) {
+        if (!cache->failed && complete) {
+            if (fseek(cache->out, 0, SEEK_SET) || fwrite(&cache->header, sizeof(cache->header), 1, cache->out) != 1)
+                cache->failed = 1;
+        }
+        if (fclose(cache->out))
+            cache->failed = 1;
+        if (cache->failed)
+            fprintf(stderr, "%s: write failed\n", cache->tmp_path);
+        if (!cache->failed && complete && rename(cache->tmp_path, cache->path) < 0) {
+            fprintf(stderr, "%s: %s\n", cache->path, strerror(errno));
+            cache->failed = 1;
+        }
+        if (cache->failed || !complete)
+            unlink(cache->tmp_path);
+        r = cache->failed ? -1 : 0;
+    }
+    free(cache->path);
+    free(cache->tmp_path);
+    free(cache);
+    return r;
+}
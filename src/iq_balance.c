@@ -0,0 +1,126 @@
+/** @file
+    DC offset and I/Q imbalance correction of the input.
+*/
+
+#include "iq_balance.h"
+
+#include <string.h>
+#include <math.h>
+
+static void iq_balance_build(iq_balance_t *iq)
+{
+    double cos_phase = sqrt(1.0 - iq->sin_phase * iq->sin_phase);
+    double scale_q   = 1.0 / (iq->gain * cos_phase);
+
+    for (int b = 0; b < 256; ++b) {
+        iq->lut_i[b] = (float)((b - 128) * (1.0 / 128.0) - iq->dc_i);
+        iq->lut_q[b] = (float)(((b - 128) * (1.0 / 128.0) - iq->dc_q) * scale_q);
+    }
+    iq->off_i   = (float)iq->dc_i;
+    iq->off_q   = (float)iq->dc_q;
+    iq->scale_q = (float)scale_q;
+    iq->phase   = (float)(iq->sin_phase / cos_phase);
+}
+
+static void iq_balance_reset(iq_balance_t *iq)
+{
+    iq->dc_i      = iq->nominal_dc;
+    iq->dc_q      = iq->nominal_dc;
+    iq->gain      = 1.0;
+    iq->sin_phase = 0.0;
+    iq_balance_build(iq);
+}
+
+void iq_balance_init(iq_balance_t *iq, uint32_t samp_rate, double nominal_dc)
+{
+    memset(iq, 0, sizeof(*iq));
+    iq->nominal_dc = nominal_dc;
+    iq->interval   = (uint32_t)(IQ_BALANCE_INTERVAL * samp_rate / IQ_BALANCE_STRIDE);
+    iq_balance_reset(iq);
+}
+
+void iq_balance_enable(iq_balance_t *iq, int enable)
+{
+    if (!enable)
+        iq_balance_reset(iq);
+    iq->enabled = enable;
+    iq->estimates = 0;
+    iq->n = 0;
+    iq->sum_i = iq->sum_q = iq->sum_ii = iq->sum_qq = iq->sum_iq = 0;
+}
+
+void iq_balance_align(iq_balance_t *iq, uint64_t sample)
+{
+    uint64_t period = (uint64_t)iq->interval * IQ_BALANCE_STRIDE;
+
+    iq->skip = (uint32_t)((period - sample % period) % period);
+    iq->n = 0;
+    iq->sum_i = iq->sum_q = iq->sum_ii = iq->sum_qq = iq->sum_iq = 0;
+}
+
+/// Blend the accumulated moments into the estimate and rebuild the tables.
+static void iq_balance_update(iq_balance_t *iq)
+{
+    double n     = iq->n;
+    double m_i   = iq->sum_i / n;
+    double m_q   = iq->sum_q / n;
+    double var_i = iq->sum_ii / n - m_i * m_i;
+    double var_q = iq->sum_qq / n - m_q * m_q;
+    double cov   = iq->sum_iq / n - m_i * m_q;
+
+    iq->n = 0;
+    iq->sum_i = iq->sum_q = iq->sum_ii = iq->sum_qq = iq->sum_iq = 0;
+
+    // too little signal to tell an imbalance, e.g. a stalled or disconnected tuner
+    if (var_i < 0.25 / (128 * 128) || var_q < 0.25 / (128 * 128))
+        return;
+
+    double gain      = sqrt(var_q / var_i);
+    double sin_phase = cov / sqrt(var_i * var_q);
+    if (gain < 0.5 || gain > 2.0 || fabs(sin_phase) > 0.5)
+        return;
+
+    // the first estimate replaces the nominal values outright
+    double alpha = iq->estimates++ ? IQ_BALANCE_ALPHA : 1.0;
+    iq->dc_i      += alpha * (m_i - iq->dc_i);
+    iq->dc_q      += alpha * (m_q - iq->dc_q);
+    iq->gain      += alpha * (gain - iq->gain);
+    iq->sin_phase += alpha * (sin_phase - iq->sin_phase);
+    iq_balance_build(iq);
+}
+
+static inline void iq_balance_add(iq_balance_t *iq, double v_i, double v_q)
+{
+    iq->sum_i  += v_i;
+    iq->sum_q  += v_q;
+    iq->sum_ii += v_i * v_i;
+    iq->sum_qq += v_q * v_q;
+    iq->sum_iq += v_i * v_q;
+    if (++iq->n >= iq->interval)
+        iq_balance_update(iq);
+}
+
+void iq_balance_feed(iq_balance_t *iq, unsigned char const *iq_buf, uint32_t len, unsigned char flip)
+{
+    if (!iq->enabled)
+        return;
+
+    uint32_t i = iq->skip * 2;
+    for (; i + 1 < len; i += 2 * IQ_BALANCE_STRIDE) {
+        int v_i = (iq_buf[i] ^ flip) - 128;
+        int v_q = (iq_buf[i + 1] ^ flip) - 128;
+        iq_balance_add(iq, v_i * (1.0 / 128.0), v_q * (1.0 / 128.0));
+    }
+    iq->skip = (i - len) / 2;
+}
+
+void iq_balance_feed_float(iq_balance_t *iq, float const (*iq_buf)[2], uint32_t samples)
+{
+    if (!iq->enabled)
+        return;
+
+    uint32_t k = iq->skip;
+    for (; k < samples; k += IQ_BALANCE_STRIDE)
+        iq_balance_add(iq, iq_buf[k][0], iq_buf[k][1]);
+    iq->skip = k - samples;
+}
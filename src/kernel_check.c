@@ -0,0 +1,323 @@
+/** @file
+    Equivalence check of the front-end kernels against the reference.
+*/
+
+#include "kernel_check.h"
+#include "fatal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#define SYNTH_NOISE      3.0    // noise sigma in CU8 counts
+#define SYNTH_DC         127.4  // RTL-SDR zero
+#define SYNTH_BLINK_RATE 254.5  // Hz
+#define SYNTH_PULSE      1e-3   // seconds a pulse is on
+#define SYNTH_SPACING    1.3    // seconds from one light to the next
+#define SYNTH_LIGHT      1.0    // seconds a light blinks
+
+static double const synth_levels[] = {4, 10, 25, 60, 127};
+#define SYNTH_LEVELS ((int)(sizeof(synth_levels) / sizeof(synth_levels[0])))
+
+/// The input of a run, synthetic or a capture, read again for every kernel.
+typedef struct source {
+    char const *name;
+    mrbeam_format_t format;
+    float full_scale;
+    // synthetic
+    uint32_t samp_rate;
+    uint64_t samples;
+    uint32_t seed;
+    int channels;
+    float offsets[MRBEAM_CHANNELS];
+    uint64_t pos;
+    uint64_t rng;
+    // capture
+    FILE *in;
+} source_t;
+
+/// The results of a kernel on a source.
+typedef struct run {
+    struct run const *ref;   ///< reference results, NULL for the reference itself
+    float *out;              ///< reference outputs in the order they came
+    size_t n, size;
+    uint32_t *layout;        ///< reference first position and outputs per block
+    size_t blocks, layout_size;
+    size_t at;               ///< next reference output to compare
+    size_t block;            ///< next reference block to compare
+    double max_error;
+    int mismatch;            ///< outputs at other positions than the reference
+    mrbeam_event_t *ev;
+    int events, ev_size;
+} run_t;
+
+static uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545f4914f6cdd1dULL;
+}
+
+/// About normal noise, the sum of four uniform values.
+static double synth_noise(uint64_t *s)
+{
+    double sum = 0;
+    for (int k = 0; k < 4; ++k)
+        sum += (xorshift(s) >> 11) * (1.0 / 9007199254740992.0);
+    return (sum - 2.0) * sqrt(3.0);
+}
+
+static void source_rewind(source_t *src)
+{
+    src->pos = 0;
+    src->rng = 0x9e3779b97f4a7c15ULL ^ src->seed;
+    if (src->in)
+        rewind(src->in);
+}
+
+static void synth_read(source_t *src, unsigned char *buf, size_t pairs)
+{
+    double fs = src->samp_rate;
+
+    for (size_t k = 0; k < pairs; ++k) {
+        double t  = (double)(src->pos + k) / fs;
+        double re = synth_noise(&src->rng) * SYNTH_NOISE;
+        double im = synth_noise(&src->rng) * SYNTH_NOISE;
+
+        // the light of this time, if any, pulsing at the blink rate
+        int j = (int)floor((t - 0.5) / SYNTH_SPACING);
+        double on = t - 0.5 - j * SYNTH_SPACING;
+        if (j >= 0 && on < SYNTH_LIGHT && fmod(on, 1.0 / SYNTH_BLINK_RATE) < SYNTH_PULSE) {
+            double level = synth_levels[j % SYNTH_LEVELS];
+            double freq  = src->offsets[j % src->channels] + (j % 5 - 2) * 200.0;
+            double phase = 2 * M_PI * fmod(freq * t, 1.0);
+            re += level * cos(phase);
+            im += level * sin(phase);
+        }
+        double i = round(SYNTH_DC + re);
+        double q = round(SYNTH_DC + im);
+        buf[2 * k]     = (unsigned char)(i < 0 ? 0 : i > 255 ? 255 : i);
+        buf[2 * k + 1] = (unsigned char)(q < 0 ? 0 : q > 255 ? 255 : q);
+    }
+    src->pos += pairs;
+}
+
+static size_t source_read(source_t *src, unsigned char *buf, size_t pairs)
+{
+    if (src->in)
+        return fread(buf, 2 * mrbeam_sample_size(src->format), pairs, src->in);
+
+    if (pairs > src->samples - src->pos)
+        pairs = (size_t)(src->samples - src->pos);
+    synth_read(src, buf, pairs);
+    return pairs;
+}
+
+static void run_event(mrbeam_event_t const *ev, void *ctx)
+{
+    run_t *run = ctx;
+
+    if (run->events == run->ev_size) {
+        run->ev_size = run->ev_size ? 2 * run->ev_size : 64;
+        run->ev = realloc(run->ev, run->ev_size * sizeof(*run->ev));
+        if (!run->ev)
+            FATAL_REALLOC("run_event()");
+    }
+    run->ev[run->events++] = *ev;
+}
+
+static void keep_outputs(run_t *run, mrbeam_frontend_block_t const *block)
+{
+    if (run->blocks + 2 > run->layout_size) {
+        run->layout_size = run->layout_size ? 2 * run->layout_size : 1024;
+        run->layout = realloc(run->layout, run->layout_size * sizeof(*run->layout));
+        if (!run->layout)
+            FATAL_REALLOC("keep_outputs()");
+    }
+    run->layout[run->blocks++] = block->first;
+    run->layout[run->blocks++] = (uint32_t)block->outputs;
+
+    size_t values = (size_t)block->channels * block->outputs * 2;
+    while (run->n + values > run->size) {
+        run->size = run->size ? 2 * run->size : 65536;
+        run->out = realloc(run->out, run->size * sizeof(*run->out));
+        if (!run->out)
+            FATAL_REALLOC("keep_outputs()");
+    }
+    for (int i = 0; i < block->channels; ++i) {
+        memcpy(&run->out[run->n], block->iq[i], block->outputs * 2 * sizeof(float));
+        run->n += block->outputs * 2;
+    }
+}
+
+static void compare_outputs(run_t *run, mrbeam_frontend_block_t const *block)
+{
+    run_t const *ref = run->ref;
+
+    if (run->mismatch)
+        return;
+    if (run->block + 2 > ref->blocks || ref->layout[run->block] != block->first
+            || ref->layout[run->block + 1] != (uint32_t)block->outputs) {
+        run->mismatch = 1;
+        return;
+    }
+    run->block += 2;
+
+    for (int i = 0; i < block->channels; ++i) {
+        float const *a = block->iq[i];
+        float const *b = &ref->out[run->at];
+        for (int k = 0; k < 2 * block->outputs; ++k) {
+            double err = fabs((double)a[k] - b[k]);
+            if (err > run->max_error || err != err)
+                run->max_error = err != err ? INFINITY : err;
+        }
+        run->at += block->outputs * 2;
+    }
+}
+
+static void run_outputs(mrbeam_frontend_block_t const *block, void *ctx)
+{
+    run_t *run = ctx;
+
+    if (run->ref)
+        compare_outputs(run, block);
+    else
+        keep_outputs(run, block);
+}
+
+static int same_float(float a, float b)
+{
+    return a == b || (a != a && b != b);
+}
+
+static int same_events(run_t const *a, run_t const *b)
+{
+    if (a->events != b->events)
+        return 0;
+    for (int k = 0; k < a->events; ++k) {
+        mrbeam_event_t const *x = &a->ev[k];
+        mrbeam_event_t const *y = &b->ev[k];
+        if (x->samplePos != y->samplePos || x->channel != y->channel || x->freq != y->freq
+                || x->count != y->count || x->kind != y->kind || x->time != y->time
+                || !same_float(x->level, y->level) || !same_float(x->snr, y->snr)
+                || !same_float(x->confidence, y->confidence))
+            return 0;
+    }
+    return 1;
+}
+
+/// Replay the source through a detector with the kernel.
+static int run_kernel(kernel_check_t *check, source_t *src, int kernel, run_t *run)
+{
+    r_cfg_t *cfg = check->cfg;
+
+    void *det = check->setup(check->setup_ctx);
+    if (!det || mrbeam_set_format(det, src->format, src->full_scale) || mrbeam_set_kernel(det, kernel)) {
+        fprintf(stderr, "%s: detector setup failed\n", src->name);
+        if (det)
+            mrbeam_free(det);
+        return -1;
+    }
+    mrbeam_set_replay(det);
+    // event times from the sample position alone
+    mrbeam_set_anchor(det, 0, 0.0);
+    mrbeam_set_event_cb(det, run_event, run);
+    mrbeam_set_frontend_cb(det, run_outputs, run);
+
+    size_t pair  = 2 * mrbeam_sample_size(src->format);
+    size_t pairs = cfg->out_block_size / pair;
+    unsigned char *buf = malloc(pairs * pair);
+    if (!buf)
+        FATAL_MALLOC("run_kernel()");
+
+    source_rewind(src);
+    size_t n_read;
+    while (!cfg->do_exit && (n_read = source_read(src, buf, pairs)) > 0)
+        sdr_callback(buf, (uint32_t)(n_read * pair), det);
+
+    int r = src->in && ferror(src->in) ? -1 : 0;
+    if (r)
+        fprintf(stderr, "%s: %s\n", src->name, strerror(errno));
+    free(buf);
+    mrbeam_free(det);
+    return r;
+}
+
+static void run_free(run_t *run)
+{
+    free(run->out);
+    free(run->layout);
+    free(run->ev);
+}
+
+static int check_source(kernel_check_t *check, source_t *src)
+{
+    run_t ref = {0};
+    int r = run_kernel(check, src, 0, &ref);
+
+    for (int k = 1; !r && k < mrbeam_kernels() && !check->cfg->do_exit; ++k) {
+        run_t run = {.ref = &ref};
+        r = run_kernel(check, src, k, &run);
+        if (r)
+            break;
+
+        double bound = mrbeam_kernel_error(k);
+        int outputs  = !run.mismatch && run.at == ref.n && run.block == ref.blocks && run.max_error <= bound;
+        int events   = same_events(&ref, &run);
+        if (!outputs || !events)
+            check->failed++;
+
+        fprintf(check->out, "%s: %s: ", src->name, mrbeam_kernel_name(k));
+        if (run.mismatch || run.at != ref.n)
+            fprintf(check->out, "outputs at other positions than the reference");
+        else
+            fprintf(check->out, "max error %.3g (bound %.3g)", run.max_error, bound);
+        fprintf(check->out, ", %d events %s, %s\n", run.events,
+                events ? "as the reference" : "differ from the reference",
+                outputs && events ? "ok" : "FAILED");
+        run_free(&run);
+    }
+    run_free(&ref);
+    return r < 0 || check->failed ? -1 : 0;
+}
+
+int kernel_check_synthetic(kernel_check_t *check, double secs, uint32_t seed)
+{
+    source_t src = {
+            .name       = "synthetic",
+            .format     = MRBEAM_CU8,
+            .full_scale = 128,
+            .samp_rate  = check->cfg->samp_rate,
+            .samples    = (uint64_t)(secs * check->cfg->samp_rate),
+            .seed       = seed,
+    };
+
+    // lights on the channels of the detector's plan
+    void *det = check->setup(check->setup_ctx);
+    if (!det)
+        return -1;
+    src.channels = mrbeam_get_channels(det, src.offsets);
+    mrbeam_free(det);
+
+    return check_source(check, &src);
+}
+
+int kernel_check_file(kernel_check_t *check, char const *path, mrbeam_format_t format, float full_scale)
+{
+    source_t src = {
+            .name       = path,
+            .format     = format,
+            .full_scale = full_scale,
+    };
+
+    src.in = fopen(path, "rb");
+    if (!src.in) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    int r = check_source(check, &src);
+    fclose(src.in);
+    return r;
+}
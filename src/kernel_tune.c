@@ -0,0 +1,289 @@
+/** @file
+    Front-end planning on the CPU at hand, kept in a wisdom file.
+*/
+
+#include "kernel_tune.h"
+#include "sample_clock.h"
+#include "fork_join.h"
+#include "fatal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#define WISDOM_HEADER "# rtl_mrbeam wisdom: cpu, format rate:channel plan options, kernel, block bytes, threads, speed\n"
+
+static uint32_t const block_sizes[] = {16384, 65536, 262144, 1048576};
+#define BLOCK_SIZES ((int)(sizeof(block_sizes) / sizeof(block_sizes[0])))
+
+static char const *const format_names[] = {
+    [MRBEAM_CU8] = "cu8", [MRBEAM_CS8] = "cs8", [MRBEAM_CS16] = "cs16", [MRBEAM_CF32] = "cf32",
+};
+
+/// The value of the first cpuinfo field of the names, without trailing space.
+static int cpuinfo_field(char const *const *names, char *value, size_t size)
+{
+    FILE *in = fopen("/proc/cpuinfo", "r");
+    if (!in)
+        return -1;
+
+    int found = 0;
+    char line[256];
+    for (int n = 0; names[n] && !found; ++n) {
+        rewind(in);
+        size_t len = strlen(names[n]);
+        while (!found && fgets(line, sizeof(line), in)) {
+            char *colon = strchr(line, ':');
+            if (!colon || strncmp(line, names[n], len) || strspn(line + len, " \t") != (size_t)(colon - line - len))
+                continue;
+            char *p = colon + 1 + strspn(colon + 1, " \t");
+            size_t end = strcspn(p, "\r\n");
+            while (end && (p[end - 1] == ' ' || p[end - 1] == '\t'))
+                end--;
+            p[end] = '\0';
+            snprintf(value, size, "%s", p);
+            found = *p != '\0';
+        }
+    }
+    fclose(in);
+    return found ? 0 : -1;
+}
+
+int kernel_tune_key(kernel_tune_t *tune, char *key, size_t size)
+{
+    // x86 names the CPU, most ARM boards only the board
+    static char const *const names[] = {"model name", "Model", "Hardware", "cpu model", NULL};
+    char cpu[128];
+    if (cpuinfo_field(names, cpu, sizeof(cpu)) < 0) {
+        struct utsname u;
+        snprintf(cpu, sizeof(cpu), "%s", uname(&u) < 0 ? "unknown" : u.machine);
+    }
+    for (char *p = cpu; *p; ++p) {
+        if (*p == '\t')
+            *p = ' ';
+    }
+
+    void *det = tune->setup(tune->setup_ctx);
+    if (!det)
+        return -1;
+    float offsets[MRBEAM_CHANNELS];
+    int channels = mrbeam_get_channels(det, offsets);
+    mrbeam_free(det);
+
+    r_cfg_t *cfg = tune->cfg;
+    int len = snprintf(key, size, "%s x%ld\t%s %u:", cpu, sysconf(_SC_NPROCESSORS_ONLN),
+            format_names[tune->format], cfg->samp_rate);
+    for (int i = 0; i < channels && len > 0 && (size_t)len < size; ++i)
+        len += snprintf(key + len, size - len, "%s%.0f", i ? "," : "", offsets[i]);
+    // the options that add work per decimated output
+    if (len > 0 && (size_t)len < size)
+        len += snprintf(key + len, size - len, "%s%s%s", cfg->afc_limit ? " afc" : "",
+                cfg->ppm_auto ? " ppm" : "", cfg->early_periods ? " early" : "");
+    if (len > 0 && (size_t)len < size && tune->block_size)
+        len += snprintf(key + len, size - len, " b%u", tune->block_size);
+    return len > 0 && (size_t)len < size ? 0 : -1;
+}
+
+/// Seconds to replay the input through a plan.
+static double time_plan(kernel_tune_t *tune, kernel_plan_t const *plan, unsigned char *buf, size_t len)
+{
+    void *det = tune->setup(tune->setup_ctx);
+    if (!det || mrbeam_set_format(det, tune->format, tune->full_scale) || mrbeam_set_kernel(det, plan->kernel)
+            || mrbeam_set_threads(det, plan->threads)) {
+        if (det)
+            mrbeam_free(det);
+        return -1;
+    }
+    mrbeam_set_replay(det);
+
+    double start = mono_time();
+    for (size_t pos = 0; pos < len && !tune->cfg->do_exit; pos += plan->block_size) {
+        size_t n = len - pos < plan->block_size ? len - pos : plan->block_size;
+        sdr_callback(buf + pos, (uint32_t)n, det);
+    }
+    double secs = mono_time() - start;
+    mrbeam_free(det);
+    return secs;
+}
+
+int kernel_tune(kernel_tune_t *tune, double secs, kernel_plan_t *plan)
+{
+    r_cfg_t *cfg = tune->cfg;
+
+    // low noise, the front-end does the same work on any input of the format
+    size_t values = (size_t)(secs * cfg->samp_rate) * 2;
+    size_t len    = values * mrbeam_sample_size(tune->format);
+    unsigned char *buf = malloc(len);
+    if (!buf)
+        FATAL_MALLOC("kernel_tune()");
+    uint32_t s = 0x2545f491;
+    for (size_t k = 0; k < values; ++k) {
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+        int v = (int)(s & 7) - 4;
+        switch (tune->format) {
+        case MRBEAM_CU8:
+            buf[k] = (unsigned char)(128 + v);
+            break;
+        case MRBEAM_CS8:
+            ((int8_t *)buf)[k] = (int8_t)v;
+            break;
+        case MRBEAM_CS16:
+            ((int16_t *)buf)[k] = (int16_t)(v * 256);
+            break;
+        case MRBEAM_CF32:
+            ((float *)buf)[k] = v / 128.0f;
+            break;
+        }
+    }
+
+    void *det = tune->setup(tune->setup_ctx);
+    if (!det) {
+        free(buf);
+        return -1;
+    }
+    float offsets[MRBEAM_CHANNELS];
+    int channels = mrbeam_get_channels(det, offsets);
+    mrbeam_free(det);
+
+    // powers of two up to a worker per channel
+    int max_threads = tune->max_threads < channels ? tune->max_threads : channels;
+    if (max_threads > FORK_JOIN_MAX_THREADS)
+        max_threads = FORK_JOIN_MAX_THREADS;
+    int threads[8];
+    int counts = 0;
+    for (int t = 1; t < max_threads && counts < 7; t *= 2)
+        threads[counts++] = t;
+    threads[counts++] = max_threads > 1 ? max_threads : 1;
+
+    uint32_t const *sizes = tune->block_size ? &tune->block_size : block_sizes;
+    int num_sizes = tune->block_size ? 1 : BLOCK_SIZES;
+
+    kernel_plan_t best = {.speed = 0};
+    for (int k = 0; k < mrbeam_kernels(); ++k) {
+        for (int b = 0; b < num_sizes; ++b) {
+            for (int n = 0; n < counts && !cfg->do_exit; ++n) {
+                int t = threads[n];
+                kernel_plan_t p = {.kernel = k, .block_size = sizes[b], .threads = t};
+                // the better of two runs, the first may pay for page faults
+                double t1 = time_plan(tune, &p, buf, len);
+                double t2 = time_plan(tune, &p, buf, len);
+                if (t1 < 0 || t2 < 0) {
+                    free(buf);
+                    return -1;
+                }
+                p.speed = secs / (t1 < t2 ? t1 : t2);
+                if (tune->out)
+                    fprintf(tune->out, "Kernel %s, %u byte blocks, %d thread%s: %.1f times real time\n",
+                            mrbeam_kernel_name(k), p.block_size, t, t > 1 ? "s" : "", p.speed);
+                if (p.speed > best.speed)
+                    best = p;
+            }
+        }
+    }
+    free(buf);
+    if (cfg->do_exit)
+        return -1;
+
+    *plan = best;
+    return 0;
+}
+
+/// Split a wisdom line into its tab separated fields, returns the fields.
+static int wisdom_fields(char *line, char **field, int max)
+{
+    int n = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+    for (char *p = line; n < max; ++n) {
+        field[n] = p;
+        p = strchr(p, '\t');
+        if (!p)
+            return n + 1;
+        *p++ = '\0';
+    }
+    return n;
+}
+
+/// Nonzero if the line holds the key in its first two fields.
+static int wisdom_match(char const *line, char const *key)
+{
+    size_t len = strlen(key);
+    return !strncmp(line, key, len) && line[len] == '\t';
+}
+
+int kernel_wisdom_load(char const *path, char const *key, kernel_plan_t *plan)
+{
+    FILE *in = fopen(path, "r");
+    if (!in)
+        return -1;
+
+    int r = -1;
+    char line[512];
+    while (r < 0 && fgets(line, sizeof(line), in)) {
+        if (line[0] == '#' || !wisdom_match(line, key))
+            continue;
+        char *field[6];
+        if (wisdom_fields(line, field, 6) != 6)
+            continue;
+        int k;
+        for (k = 0; k < mrbeam_kernels() && strcmp(field[2], mrbeam_kernel_name(k)); ++k)
+            ;
+        plan->kernel     = k;
+        plan->block_size = (uint32_t)strtoul(field[3], NULL, 10);
+        plan->threads    = atoi(field[4]);
+        plan->speed      = atof(field[5]);
+        // wisdom of another build or edited by hand
+        if (k < mrbeam_kernels() && plan->block_size >= MINIMAL_BUF_LENGTH && plan->block_size <= MAXIMAL_BUF_LENGTH
+                && plan->block_size % MINIMAL_BUF_LENGTH == 0 && plan->threads >= 1 && plan->threads <= FORK_JOIN_MAX_THREADS)
+            r = 0;
+    }
+    fclose(in);
+    return r;
+}
+
+int kernel_wisdom_save(char const *path, char const *key, kernel_plan_t const *plan)
+{
+    size_t len = strlen(path) + 32;
+    char *tmp_path = malloc(len);
+    if (!tmp_path)
+        FATAL_MALLOC("kernel_wisdom_save()");
+    snprintf(tmp_path, len, "%s.%ld.tmp", path, (long)getpid());
+
+    FILE *out = fopen(tmp_path, "w");
+    if (!out) {
+        fprintf(stderr, "%s: %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        return -1;
+    }
+    fputs(WISDOM_HEADER, out);
+
+    // the plans of other machines and channel plans stay
+    FILE *in = fopen(path, "r");
+    if (in) {
+        char line[512];
+        while (fgets(line, sizeof(line), in)) {
+            if (line[0] != '#' && !wisdom_match(line, key))
+                fputs(line, out);
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s\t%s\t%u\t%d\t%.1f\n", key, mrbeam_kernel_name(plan->kernel), plan->block_size,
+            plan->threads, plan->speed);
+
+    int r = ferror(out);
+    if (fclose(out))
+        r = 1;
+    if (r || rename(tmp_path, path) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        r = -1;
+    }
+    else {
+        r = 0;
+    }
+    free(tmp_path);
+    return r;
+}
@@ -1,7 +1,30 @@
 #include "common.h"
 #include "stream_buffer.h"
+#include "shm_ring.h"
+#include "parser.h"
+#include "sample_clock.h"
+#include "iq_balance.h"
+#include "fork_join.h"
 
 #define DECIMATION 69
+#define REFRACTORY_SECS 3       // default seconds before a light is reported again
+#define MIN_COUNT   175         // default pulses counted before a light is reported
+#define MAX_GAP     16          // default blink periods without a pulse that start the count over
+#define FIXED_LEVEL 0.2         // mag2 trigger level before the noise floor settled
+#define MIN_SNR     12          // dB above the noise floor for the adaptive trigger
+#define NOISE_ALPHA (1.0/1024)  // noise floor smoothing, about 75 ms of output samples
+#define NOISE_CREEP (1.0 + 1.0/65536) // rise per output above threshold, about 1 dB/s
+#define CAL_SNR     100         // mag2 above the noise floor (20 dB) for offset tracking outputs
+#define CAL_OUTPUTS 256         // pairs of strong outputs per tracking step
+#define CAL_GAIN    0.25        // fraction of the measured offset applied to the common offset
+#define AFC_GAIN    (1.0/16)    // fraction of the residual applied to a channel per step
+#define PULSE_WINDOW 10         // default decimated outputs searched for the peak of a pulse
+#define BLINK_RATE  254.5       // Hz, pulses of a light
+#define STATE_TOL    1e-3       // relative difference of float state that still matches
+#define STATE_HZ_TOL 0.1        // Hz, offset difference that still matches
+#define STATE_IQ_TOL 1e-5       // I/Q estimate difference that still matches
+#define CHANNEL_TAPS 12         // taps of the channel filter, its FIR loop is unrolled
+#define KERNEL_LANES 4          // channels the lanes kernel mixes in step
 
 typedef float float_type;
 struct mixer_t
@@ -16,13 +39,54 @@ struct mixer_t
 };
 typedef struct mixer_t Mixer;
 
-struct channel_state_t
+// Detector state of the channels of a hop, one array per field sized
+// from the channel plan. Each channel searches its own pulse window, so
+// lights on different channels are counted independently.
+struct channel_table_t
 {
-    long   lastSample;
-    double eventTsp;
-    int    count;
+    long  *lastSample;   // hop sample position of the last counted pulse
+    long  *eventSample;
+    int   *count;
+    int   *window;       // decimated outputs left in the pulse window, 0 if none open
+    float *peak;         // peak mag2 of the open pulse window
+    float *noise;        // noise floor mag2 of the decimated output
+    float *threshold;    // trigger level mag2
+    float *afcOffset;    // drift of the channel in Hz, on top of the common offset
+    // early detection, sums over the current correlation window
+    float *earlyRe;      // mag2 times the conjugate blink phasor
+    float *earlyIm;
+    float *earlySum;     // mag2
+    float *earlySq;      // mag2 squared
+    float *earlyPeak;
+    float *earlyWRe;     // conjugate blink phasor
+    float *earlyWIm;
+    int   *earlyN;       // outputs in the window
+    long  *earlySample;  // hop sample position of the last early event
 };
-typedef struct channel_state_t ChannelState;
+typedef struct channel_table_t ChannelTable;
+
+// Detector state of one center frequency, kept while other hops are
+// visited. Positions count only the samples processed on this hop so
+// pulse timing survives a visit elsewhere.
+struct hop_state_t
+{
+    ChannelTable ch;
+    long     samplePos;
+    uint32_t centerFreq;
+    float    calOffset;  // calibrated signal offset in Hz, all channels
+};
+typedef struct hop_state_t HopState;
+
+// Trigger and pulse counting settings, those of the detector and one per
+// parameter set of a sweep.
+struct trigger_t
+{
+    mrbeam_params_t params;
+    float_type levelLimit;  // fixed trigger mag2, 0 for adaptive
+    float_type snrMargin;   // adaptive trigger level above the noise floor
+    long refractory;        // samples before a light is reported again
+};
+typedef struct trigger_t Trigger;
 
 
 struct filter_t
@@ -59,25 +123,40 @@ Filter *filter_new (float_type *taps, int nTaps, int decimation)
     return f;
 }
 
-int filter_filter (Filter *f, float_type *in, float_type *out)
+/// The filter output over the last nTaps inputs.
+static inline void filter_output_taps (Filter *f, float_type *out, int nTaps)
 {
-    stream_buffer_insert (f->sb, in);
-
-    if (++f->cnt < f->decimation)
-        return 0;
-
-    f->cnt = 0;
     float_type (*buf)[2];
     uint len;
     stream_buffer_get (f->sb, & buf, & len);
 
     out[0] = 0;
     out[1] = 0;
-    for (int i=0; i<f->nTaps; i++)
+    for (int i=0; i<nTaps; i++)
     {
         out[0] += buf[len - 1 - i][0] * f->taps[i];
         out[1] += buf[len - 1 - i][1] * f->taps[i];
     }
+}
+
+static inline void filter_output (Filter *f, float_type *out)
+{
+    // a constant tap count lets the compiler unroll the channel filter
+    if (f->nTaps == CHANNEL_TAPS)
+        filter_output_taps (f, out, CHANNEL_TAPS);
+    else
+        filter_output_taps (f, out, f->nTaps);
+}
+
+int filter_filter (Filter *f, float_type *in, float_type *out)
+{
+    stream_buffer_insert (f->sb, in);
+
+    if (++f->cnt < f->decimation)
+        return 0;
+
+    f->cnt = 0;
+    filter_output (f, out);
     return 1;
 }
 
@@ -97,6 +176,14 @@ Mixer *mixer_new (unsigned long Fs, float_type f)
     return m;
 }
 
+void mixer_set_freq (Mixer *m, float_type f)
+{
+    m->f    = f;
+    m->v    = 2 * M_PI * f / (float_type) m->Fs;
+    m->cosv = cos (m->v);
+    m->sinv = sin (m->v);
+}
+
 Mixer *mixer_iterate (Mixer *m)
 {
     float_type ival = m->cosv * m->ival - m->sinv * m->qval;
@@ -120,19 +207,190 @@ Mixer *mixer_mix (Mixer *m, float_type *iqsrc, float_type *iqdst)
     return m;
 }
 
+// A front-end kernel mixes and filters a channel up to and including the
+// sample of the next output; it returns the samples used and sets output
+// if the last of them made one. Every kernel must leave the mixer and the
+// filter as the reference does, so kernels can change between blocks.
+typedef uint32_t (*KernelFn) (Mixer *m, Filter *f, float_type (*in)[2], uint32_t len, float_type *out, int *output);
+
+/// Mix and filter sample by sample.
+static uint32_t kernel_reference (Mixer *m, Filter *f, float_type (*in)[2], uint32_t len, float_type *out, int *output)
+{
+    for (uint32_t k=0; k<len; k++)
+    {
+        float_type iqMixed[2];
+
+        mixer_mix (m, in[k], iqMixed);
+        if (filter_filter (f, iqMixed, out))
+        {
+            *output = 1;
+            return k + 1;
+        }
+    }
+    return len;
+}
+
+/// Mix only the samples under the taps of the next output, the mixer still steps every sample.
+static uint32_t kernel_window (Mixer *m, Filter *f, float_type (*in)[2], uint32_t len, float_type *out, int *output)
+{
+    int skip = f->decimation - f->nTaps;
+
+    if (skip < 0)
+        return kernel_reference (m, f, in, len, out, output);
+    for (uint32_t k=0; k<len; k++)
+    {
+        mixer_iterate (m);
+        if (f->cnt >= skip)
+        {
+            float_type iqMixed[2];
+            iqMixed[0] = m->ival * in[k][0] - m->qval * in[k][1];
+            iqMixed[1] = m->qval * in[k][0] + m->ival * in[k][1];
+            stream_buffer_insert (f->sb, iqMixed);
+        }
+        if (++f->cnt < f->decimation)
+            continue;
+
+        f->cnt = 0;
+        filter_output (f, out);
+        *output = 1;
+        return k + 1;
+    }
+    return len;
+}
+
+struct kernel_t
+{
+    char const *name;
+    KernelFn run;
+    float maxError;     // output error against the reference in full scale units, 0 for exact
+    int lanes;          // channels a task mixes in step, 0 for a task per channel with run
+};
+typedef struct kernel_t Kernel;
+
+// the reference comes first
+static const Kernel kernels[] =
+{
+    { "reference", kernel_reference, 0, 0 },
+    { "window",    kernel_window,    0, 0 },
+    { "lanes",     kernel_window,    0, KERNEL_LANES },
+};
+#define KERNELS ((int) (sizeof (kernels) / sizeof (kernels[0])))
+
+// Events found by one channel in the current block.
+struct channel_events_t
+{
+    mrbeam_event_t *ev;
+    int n;
+    int next;
+    int size;
+};
+typedef struct channel_events_t ChannelEvents;
+
+// A parameter set of a sweep, triggered by the outputs of the detector.
+struct sweep_set_t
+{
+    Trigger trig;
+    ChannelTable ch;
+    ChannelEvents *events;
+    int next;               // next set with the same trigger level, -1 for none
+};
+typedef struct sweep_set_t SweepSet;
+
+// A decimated output kept for the sweep.
+struct sweep_output_t
+{
+    long pos;
+    float_type mag2;
+};
+typedef struct sweep_output_t SweepOutput;
+
+// The noise floor and trigger level after an output, shared by the sets of a group.
+struct sweep_level_t
+{
+    float_type noise;
+    float_type threshold;
+};
+typedef struct sweep_level_t SweepLevel;
+
 struct mrbeam_cfg_t
 {
     unsigned long Fs;
-    Mixer  *m[4];
-    Filter *f[4];
-    ChannelState channelStates[4];
-    int cnt;
-    float_type maxs[4];
+    int nChannels;
+    float  *channelFreqs;
+    Mixer  **m;
+    Filter **f;
+    Mixer  **blink;         // blink rate phasor per channel, one step per decimated output
+    HopState *hops;
+    int nHops;
+    int hopIndex;
+    long settle;
+    Trigger trig;
     long sampleCounter;
+    uint64_t clipped;
+    uint64_t gaps;
+    uint64_t lost;
+    int calibrate;
+    float afcLimit;            // channel drift limit in Hz, 0 for no AFC
+    float_type (*last)[2];     // previous decimated output per channel
+    float_type (*calAcc)[2];   // sum of output times conjugate previous output
+    int *calCount;
+    iq_balance_t iq;           // conversion tables with the DC and I/Q imbalance folded in
+    mrbeam_format_t format;    // input sample format
+    int sampleSize;            // bytes per I or Q value
+    float_type scale;          // wide input to full scale units
+    float clipLevel;           // wide input magnitude counted as clipped
+    int earlyOutputs;          // decimated outputs per correlation window, 0 for no early events
+    float earlyScore;          // correlation score for an early event
+    int confirm;               // report the counted light after an early event
+    float *calPending;         // common offset steps, applied after the block
+    // the block being processed, converted once and read by all channels
+    float_type (*conv)[2];
+    uint32_t convSize;
+    uint32_t blockLen;
+    long blockSample;          // input sample position before the first converted sample
+    long blockHopPos;          // hop sample position before the first converted sample
+    int *outputs;              // decimated outputs of the block per channel
+    ChannelEvents *events;     // events of the block per channel, reported in sample order
+    fork_join_t *pool;         // channel workers, NULL to run the channels in turn
+    sample_clock_t clock;
+    shm_ring_t *shm;
+    mrbeam_event_cb_t eventCb;
+    void *eventCbCtx;
+    // parameter sets of a sweep, fed the decimated outputs of each block
+    SweepSet *sweep;
+    int nSweep;
+    int *sweepGroups;          // first set of each group with the same level and minimum SNR
+    int nSweepGroups;
+    SweepOutput **sweepOut;    // outputs of the block per channel
+    SweepLevel **sweepLevel;   // levels of the block per group * channels + channel
+    uint32_t sweepSize;
+    mrbeam_sweep_cb_t sweepCb;
+    void *sweepCbCtx;
+    // decimated outputs of each block for the front-end callback, or
+    // the kept outputs fed in place of input
+    float_type (**frontendOut)[2];
+    uint32_t frontendSize;
+    mrbeam_frontend_cb_t frontendCb;
+    void *frontendCbCtx;
+    mrbeam_frontend_block_t const *frontendIn;
+    int kernel;                // front-end kernel of the channels
 };
 typedef struct mrbeam_cfg_t MrbeamCfg;
 
-static float_type rtlLookup[256];
+// constant, shared by all detector instances
+static const uint8_t clipLookup[256] = { [0] = 1, [255] = 1 };
+
+// mixer frequencies, channel i is centred at -channelFreqs[i] from the center frequency
+static const float defaultChannelFreqs[] = { -300e3, 300e3, 100e3, -100e3 };
+#define DEFAULT_CHANNELS ((int) (sizeof (defaultChannelFreqs) / sizeof (defaultChannelFreqs[0])))
+
+static void trigger_init (MrbeamCfg *cfg, Trigger *trig, mrbeam_params_t const *params)
+{
+    trig->params     = *params;
+    trig->levelLimit = params->levelDb ? pow (10.0, params->levelDb / 10.0) : 0;
+    trig->snrMargin  = pow (10.0, params->minSnrDb / 10.0);
+    trig->refractory = (long) (params->refractory * cfg->Fs);
+}
 
 void *mrbeam_setup (void)
 {
@@ -141,12 +399,37 @@ void *mrbeam_setup (void)
 
     cfg->Fs = 948000;
 
-    cfg->m[0] = mixer_new (cfg->Fs, -300e3);
-    cfg->m[1] = mixer_new (cfg->Fs,  300e3);
-    cfg->m[2] = mixer_new (cfg->Fs,  100e3);
-    cfg->m[3] = mixer_new (cfg->Fs, -100e3);
+    mrbeam_params_t params =
+    {
+        .levelDb    = 0,
+        .minSnrDb   = MIN_SNR,
+        .minCount   = MIN_COUNT,
+        .maxGap     = MAX_GAP,
+        .refractory = REFRACTORY_SECS,
+        .window     = PULSE_WINDOW,
+    };
+    trigger_init (cfg, & cfg->trig, & params);
+
+    float offsets[DEFAULT_CHANNELS];
+    for (int i=0; i<DEFAULT_CHANNELS; i++)
+        offsets[i] = -defaultChannelFreqs[i];
+    int r = mrbeam_set_channels (cfg, offsets, DEFAULT_CHANNELS);
+    assert (r == SUCCESS);
+    r = mrbeam_set_hops (cfg, 1);
+    assert (r == SUCCESS);
+
+    r = mrbeam_set_format (cfg, MRBEAM_CU8, 128);
+    assert (r == SUCCESS);
+
+    cfg->sampleCounter = 0;
+    sample_clock_init (& cfg->clock, cfg->Fs, 1);
+
+    return (void *) cfg;
+}
 
-    float_type taps[] =
+static Filter *channel_filter_new (void)
+{
+    static float_type taps[] =
     {
         0.0123713309415827,
         0.0243551437758347,
@@ -164,100 +447,1698 @@ void *mrbeam_setup (void)
 
     int nTaps = (int) (sizeof (taps) / sizeof (taps[0]));
 
-    cfg->f[0] = filter_new (taps, nTaps, DECIMATION);
-    cfg->f[1] = filter_new (taps, nTaps, DECIMATION);
-    cfg->f[2] = filter_new (taps, nTaps, DECIMATION);
-    cfg->f[3] = filter_new (taps, nTaps, DECIMATION);
-
-    bzero (cfg->channelStates, sizeof (cfg->channelStates));
+    return filter_new (taps, nTaps, DECIMATION);
+}
 
-    for (int i=0; i<256; i++)
-        rtlLookup[i] = (i - 127.4) * (1.0/128.0);
+static void filter_free (Filter *f)
+{
+    stream_buffer_delete (f->sb);
+    free (f->sb);
+    free (f->taps);
+    free (f);
+}
 
-    cfg->cnt = 0;
-    cfg->sampleCounter = 0;
+void mrbeam_set_replay (void *ctx)
+{
+    MrbeamCfg *cfg = ctx;
 
-    return (void *) cfg;
+    sample_clock_init (& cfg->clock, cfg->Fs, 0);
 }
 
-void sdr_callback(unsigned char *iq_buf, uint32_t len, void *ctx)
+void mrbeam_set_event_cb (void *ctx, mrbeam_event_cb_t cb, void *cbCtx)
 {
     MrbeamCfg *cfg = ctx;
-    //for (uint32_t i=0; i<len; i++)
-    //    fprintf (stderr, "%02x%s", iq_buf[i], ((i == len-1) || ((i+1) % 64 == 0)) ? "\n" : ((i+1) % 2 == 0) ? " " : "");
-    alarm(3); // require callback to run every 3 second, abort otherwise
 
-    assert (len % 2 == 0);
+    cfg->eventCb    = cb;
+    cfg->eventCbCtx = cbCtx;
+}
+
+static void channel_table_free (ChannelTable *t)
+{
+    free (t->lastSample);
+    free (t->eventSample);
+    free (t->count);
+    free (t->window);
+    free (t->peak);
+    free (t->noise);
+    free (t->threshold);
+    free (t->afcOffset);
+    free (t->earlyRe);
+    free (t->earlyIm);
+    free (t->earlySum);
+    free (t->earlySq);
+    free (t->earlyPeak);
+    free (t->earlyWRe);
+    free (t->earlyWIm);
+    free (t->earlyN);
+    free (t->earlySample);
+}
+
+static int channel_table_alloc (ChannelTable *t, int channels)
+{
+    t->lastSample  = calloc (channels, sizeof (*t->lastSample));
+    t->eventSample = calloc (channels, sizeof (*t->eventSample));
+    t->count       = calloc (channels, sizeof (*t->count));
+    t->window      = calloc (channels, sizeof (*t->window));
+    t->peak        = calloc (channels, sizeof (*t->peak));
+    t->noise       = calloc (channels, sizeof (*t->noise));
+    t->threshold   = calloc (channels, sizeof (*t->threshold));
+    t->afcOffset   = calloc (channels, sizeof (*t->afcOffset));
+    t->earlyRe     = calloc (channels, sizeof (*t->earlyRe));
+    t->earlyIm     = calloc (channels, sizeof (*t->earlyIm));
+    t->earlySum    = calloc (channels, sizeof (*t->earlySum));
+    t->earlySq     = calloc (channels, sizeof (*t->earlySq));
+    t->earlyPeak   = calloc (channels, sizeof (*t->earlyPeak));
+    t->earlyWRe    = calloc (channels, sizeof (*t->earlyWRe));
+    t->earlyWIm    = calloc (channels, sizeof (*t->earlyWIm));
+    t->earlyN      = calloc (channels, sizeof (*t->earlyN));
+    t->earlySample = calloc (channels, sizeof (*t->earlySample));
 
-    for (uint32_t i=0; i<len; i+=2)
+    if (!t->lastSample || !t->eventSample || !t->count || !t->window
+            || !t->peak || !t->noise || !t->threshold || !t->afcOffset
+            || !t->earlyRe || !t->earlyIm || !t->earlySum || !t->earlySq
+            || !t->earlyPeak || !t->earlyWRe || !t->earlyWIm || !t->earlyN
+            || !t->earlySample)
     {
-        cfg->sampleCounter++;
-        float_type iqIn[2] = { rtlLookup[iq_buf[i]], rtlLookup[iq_buf[i+1]] };
-        //fprintf (stderr, "%+f %+f\n", iqIn[0], iqIn[1]);
-        float_type iqMixed[2] = {0};
-        float_type iqFiltered[2] = {0};
+        channel_table_free (t);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/// Make room for more channels in a table, the state of the others stays.
+static int channel_table_grow (ChannelTable *t, int old, int channels)
+{
+    ChannelTable n;
+    if (channel_table_alloc (& n, channels) != SUCCESS)
+        return ERROR;
+
+#define KEEP(field) memcpy (n.field, t->field, old * sizeof (*n.field))
+    KEEP (lastSample);
+    KEEP (eventSample);
+    KEEP (count);
+    KEEP (window);
+    KEEP (peak);
+    KEEP (noise);
+    KEEP (threshold);
+    KEEP (afcOffset);
+    KEEP (earlyRe);
+    KEEP (earlyIm);
+    KEEP (earlySum);
+    KEEP (earlySq);
+    KEEP (earlyPeak);
+    KEEP (earlyWRe);
+    KEEP (earlyWIm);
+    KEEP (earlyN);
+    KEEP (earlySample);
+#undef KEEP
+
+    channel_table_free (t);
+    *t = n;
+    return SUCCESS;
+}
+
+static void channel_state_init (Trigger const *trig, ChannelTable *t, int i)
+{
+    t->lastSample[i]  = 0;
+    t->eventSample[i] = -trig->refractory;
+    t->count[i]       = 0;
+    t->window[i]      = 0;
+    t->peak[i]        = 0;
+    // start out at the fixed level, the floor drops to the noise quickly
+    t->noise[i]       = FIXED_LEVEL / trig->snrMargin;
+    t->threshold[i]   = trig->levelLimit ? trig->levelLimit : FIXED_LEVEL;
+    t->afcOffset[i]   = 0;
+    t->earlySample[i] = -trig->refractory;
+}
 
-        int nl = 0;
-        if (cfg->cnt && --cfg->cnt == 0)
+/// Start a new correlation window on a channel.
+static void early_reset (ChannelTable *t, int i)
+{
+    t->earlyRe[i]   = 0;
+    t->earlyIm[i]   = 0;
+    t->earlySum[i]  = 0;
+    t->earlySq[i]   = 0;
+    t->earlyPeak[i] = 0;
+    t->earlyWRe[i]  = 0;
+    t->earlyWIm[i]  = 0;
+    t->earlyN[i]    = 0;
+}
+
+static void free_hops (HopState *h, int hops)
+{
+    for (int n=0; n<hops; n++)
+        channel_table_free (& h[n].ch);
+    free (h);
+}
+
+/// Allocate detector state for the hops and the channel plan, existing state is dropped.
+static HopState *alloc_hops (MrbeamCfg *cfg, int hops)
+{
+    HopState *h = calloc (hops, sizeof (HopState));
+    if (!h)
+        return NULL;
+
+    for (int n=0; n<hops; n++)
+    {
+        if (channel_table_alloc (& h[n].ch, cfg->nChannels) != SUCCESS)
         {
-            float_type m = 0;
-            int channel = 0;
-            for (int i=0; i<4; i++)
-            {
-                if (m < cfg->maxs[i])
-                {
-                    m = cfg->maxs[i];
-                    channel = i;
-                }
-            }
+            free_hops (h, n);
+            return NULL;
+        }
+        for (int i=0; i<cfg->nChannels; i++)
+            channel_state_init (& cfg->trig, & h[n].ch, i);
+    }
+    return h;
+}
 
-            double periodTime = 1.0 / 254.5;
-            long   elapsedSampels = cfg->sampleCounter - cfg->channelStates[channel].lastSample;
-            double timeElapsed = elapsedSampels / (double) cfg->Fs;
-            int nPeriods = timeElapsed / periodTime;
+int mrbeam_set_hops (void *ctx, int hops)
+{
+    MrbeamCfg *cfg = ctx;
 
-            if (nPeriods > 16)
-                cfg->channelStates[channel].count = 0;
+    HopState *h = alloc_hops (cfg, hops);
+    if (!h)
+        return ERROR;
 
-            cfg->channelStates[channel].lastSample = cfg->sampleCounter;
-            cfg->channelStates[channel].count++;
-            //print_debug ("channel:%d count:%d", channel, cfg->channelStates[channel].count);
+    free_hops (cfg->hops, cfg->nHops);
+    cfg->hops     = h;
+    cfg->nHops    = hops;
+    cfg->hopIndex = 0;
 
-            if (cfg->channelStates[channel].count > 175)
-            {
-               double tsp = get_time ();
-               if (tsp - cfg->channelStates[channel].eventTsp > 3)
-               {
-                   cfg->channelStates[channel].eventTsp = tsp;
-                   fprintf (stderr, "%f channel %d triggered\n", get_time (), channel);
-                   printf ("%d\n", channel);
-                   fflush (stdout);
-               }
-            }
+    return SUCCESS;
+}
+
+void mrbeam_set_level (void *ctx, float levelDb, float minSnrDb)
+{
+    MrbeamCfg *cfg = ctx;
+    mrbeam_params_t params = cfg->trig.params;
+
+    params.levelDb  = levelDb;
+    params.minSnrDb = minSnrDb;
+    mrbeam_set_params (cfg, & params);
+}
+
+int mrbeam_set_params (void *ctx, mrbeam_params_t const *params)
+{
+    MrbeamCfg *cfg = ctx;
+
+    if (params->minCount < 1 || params->maxGap < 1 || params->refractory < 0 || params->window < 1)
+        return ERROR;
+
+    trigger_init (cfg, & cfg->trig, params);
+    for (int n=0; n<cfg->nHops; n++)
+    {
+        ChannelTable *t = & cfg->hops[n].ch;
+        for (int i=0; i<cfg->nChannels; i++)
+            t->threshold[i] = cfg->trig.levelLimit ? cfg->trig.levelLimit : t->noise[i] * cfg->trig.snrMargin;
+    }
+    return SUCCESS;
+}
+
+void mrbeam_get_params (void *ctx, mrbeam_params_t *params)
+{
+    MrbeamCfg *cfg = ctx;
+
+    *params = cfg->trig.params;
+}
+
+/// Tune the mixers to the offsets tracked for a hop.
+static void set_mixers (MrbeamCfg *cfg, HopState *hop)
+{
+    for (int i=0; i<cfg->nChannels; i++)
+        mixer_set_freq (cfg->m[i], cfg->channelFreqs[i] - hop->calOffset - hop->ch.afcOffset[i]);
+}
+
+/// Forget the bursts in progress, they belong to the previous tuning.
+static void reset_tracking (MrbeamCfg *cfg)
+{
+    for (int i=0; i<cfg->nChannels; i++)
+    {
+        cfg->calAcc[i][0] = cfg->calAcc[i][1] = 0;
+        cfg->last[i][0]   = cfg->last[i][1]   = 0;
+        cfg->calCount[i]  = 0;
+    }
+}
+
+void mrbeam_retune (void *ctx, int hop, uint32_t centerFreq, uint32_t settleSamples)
+{
+    MrbeamCfg *cfg = ctx;
+
+    assert (hop >= 0 && hop < cfg->nHops);
+
+    cfg->hopIndex = hop;
+    cfg->hops[hop].centerFreq = centerFreq;
+    // samples before the tuner settled are of no use, the windows in
+    // progress belong to the previous hop
+    cfg->settle = settleSamples;
+    for (int i=0; i<cfg->nChannels; i++)
+    {
+        cfg->hops[hop].ch.window[i] = 0;
+        early_reset (& cfg->hops[hop].ch, i);
+        for (int n=0; n<cfg->nSweep; n++)
+            cfg->sweep[n].ch.window[i] = 0;
+    }
+    reset_tracking (cfg);
+
+    set_mixers (cfg, & cfg->hops[hop]);
+}
+
+void mrbeam_input_gap (void *ctx, uint64_t lostSamples)
+{
+    MrbeamCfg *cfg = ctx;
+    HopState *hop = & cfg->hops[cfg->hopIndex];
+
+    cfg->gaps++;
+    cfg->lost += lostSamples;
+    // positions count stream samples, so the times after the gap stay right
+    cfg->sampleCounter += lostSamples;
+    hop->samplePos     += lostSamples;
+    cfg->settle = cfg->settle > (long) lostSamples ? cfg->settle - (long) lostSamples : 0;
+    // pulses on both sides of the gap must not add up to a light
+    for (int i=0; i<cfg->nChannels; i++)
+    {
+        hop->ch.count[i]  = 0;
+        hop->ch.window[i] = 0;
+        early_reset (& hop->ch, i);
+        for (int n=0; n<cfg->nSweep; n++)
+        {
+            cfg->sweep[n].ch.count[i]  = 0;
+            cfg->sweep[n].ch.window[i] = 0;
         }
+    }
+    reset_tracking (cfg);
+}
+
+static void free_channels (MrbeamCfg *cfg)
+{
+    for (int i=0; i<cfg->nChannels; i++)
+    {
+        filter_free (cfg->f[i]);
+        free (cfg->m[i]);
+        free (cfg->blink[i]);
+        free (cfg->events[i].ev);
+        if (cfg->frontendOut)
+            free (cfg->frontendOut[i]);
+    }
+    free (cfg->frontendOut);
+    cfg->frontendOut  = NULL;
+    cfg->frontendSize = 0;
+    free (cfg->f);
+    free (cfg->m);
+    free (cfg->blink);
+    free (cfg->channelFreqs);
+    free (cfg->last);
+    free (cfg->calAcc);
+    free (cfg->calCount);
+    free (cfg->calPending);
+    free (cfg->outputs);
+    free (cfg->events);
+}
+
+/// Free the outputs of a block kept for the sweep, reserve_sweep () makes room again.
+static void free_sweep_outputs (MrbeamCfg *cfg)
+{
+    for (int i=0; cfg->sweepOut && i<cfg->nChannels; i++)
+        free (cfg->sweepOut[i]);
+    for (int n=0; cfg->sweepLevel && n<cfg->nSweepGroups * cfg->nChannels; n++)
+        free (cfg->sweepLevel[n]);
+    free (cfg->sweepOut);
+    free (cfg->sweepLevel);
+    cfg->sweepOut   = NULL;
+    cfg->sweepLevel = NULL;
+    cfg->sweepSize  = 0;
+}
+
+static void free_sweep (MrbeamCfg *cfg)
+{
+    for (int n=0; n<cfg->nSweep; n++)
+    {
+        SweepSet *set = & cfg->sweep[n];
+        channel_table_free (& set->ch);
+        if (set->events)
+            for (int i=0; i<cfg->nChannels; i++)
+                free (set->events[i].ev);
+        free (set->events);
+        memset (& set->ch, 0, sizeof (set->ch));
+        set->events = NULL;
+    }
+    free_sweep_outputs (cfg);
+}
 
-        for (int i=0; i<4; i++)
+/// Allocate the state of the sweep sets for the channel plan.
+static int alloc_sweep (MrbeamCfg *cfg)
+{
+    for (int n=0; n<cfg->nSweep; n++)
+    {
+        SweepSet *set = & cfg->sweep[n];
+        set->events = calloc (cfg->nChannels, sizeof (*set->events));
+        if (!set->events || channel_table_alloc (& set->ch, cfg->nChannels) != SUCCESS)
         {
-            mixer_mix (cfg->m[i], iqIn, iqMixed);
-            if (filter_filter (cfg->f[i], iqMixed, iqFiltered))
-            {
-                float_type mag2 = iqFiltered[0] * iqFiltered[0] + iqFiltered[1] * iqFiltered[1];
-                if (cfg->cnt)
-                {
-                    if (cfg->maxs[i] < mag2)
-                        cfg->maxs[i] = mag2;
-                }
-                else if (mag2 > 0.2)
-                {
-                    cfg->cnt = DECIMATION * 10;
-                    cfg->maxs[0] = 0;
-                    cfg->maxs[1] = 0;
-                    cfg->maxs[2] = 0;
-                    cfg->maxs[3] = 0;
+            free (set->events);
+            set->events = NULL;
+            return ERROR;
+        }
+        for (int i=0; i<cfg->nChannels; i++)
+            channel_state_init (& set->trig, & set->ch, i);
+    }
+    return SUCCESS;
+}
 
-                    cfg->maxs[i] = mag2;
-                }
-            }
+/// Make room for the outputs of a block.
+static void reserve_sweep (MrbeamCfg *cfg, uint32_t outputs)
+{
+    if (outputs <= cfg->sweepSize)
+        return;
+    int levels = cfg->nSweepGroups * cfg->nChannels;
+    if (!cfg->sweepOut)
+    {
+        cfg->sweepOut   = calloc (cfg->nChannels, sizeof (*cfg->sweepOut));
+        cfg->sweepLevel = calloc (levels, sizeof (*cfg->sweepLevel));
+        assert (cfg->sweepOut && cfg->sweepLevel);
+    }
+    for (int i=0; i<cfg->nChannels; i++)
+    {
+        free (cfg->sweepOut[i]);
+        cfg->sweepOut[i] = malloc (outputs * sizeof (**cfg->sweepOut));
+        assert (cfg->sweepOut[i]);
+    }
+    for (int n=0; n<levels; n++)
+    {
+        free (cfg->sweepLevel[n]);
+        cfg->sweepLevel[n] = malloc (outputs * sizeof (**cfg->sweepLevel));
+        assert (cfg->sweepLevel[n]);
+    }
+    cfg->sweepSize = outputs;
+}
+
+/// Make room for the front-end outputs of a block.
+static void reserve_frontend (MrbeamCfg *cfg, uint32_t outputs)
+{
+    if (outputs <= cfg->frontendSize)
+        return;
+    if (!cfg->frontendOut)
+    {
+        cfg->frontendOut = calloc (cfg->nChannels, sizeof (*cfg->frontendOut));
+        assert (cfg->frontendOut);
+    }
+    for (int i=0; i<cfg->nChannels; i++)
+    {
+        free (cfg->frontendOut[i]);
+        cfg->frontendOut[i] = malloc (outputs * sizeof (**cfg->frontendOut));
+        assert (cfg->frontendOut[i]);
+    }
+    cfg->frontendSize = outputs;
+}
+
+int mrbeam_set_channels (void *ctx, float const *offsets, int channels)
+{
+    MrbeamCfg *cfg = ctx;
+
+    if (channels < 1 || channels > MRBEAM_CHANNELS)
+        return ERROR;
+
+    free_sweep (cfg);
+    free_channels (cfg);
+    cfg->nChannels    = channels;
+    cfg->channelFreqs = calloc (channels, sizeof (*cfg->channelFreqs));
+    cfg->m            = calloc (channels, sizeof (*cfg->m));
+    cfg->f            = calloc (channels, sizeof (*cfg->f));
+    cfg->last         = calloc (channels, sizeof (*cfg->last));
+    cfg->calAcc       = calloc (channels, sizeof (*cfg->calAcc));
+    cfg->calCount     = calloc (channels, sizeof (*cfg->calCount));
+    cfg->blink        = calloc (channels, sizeof (*cfg->blink));
+    cfg->calPending   = calloc (channels, sizeof (*cfg->calPending));
+    cfg->outputs      = calloc (channels, sizeof (*cfg->outputs));
+    cfg->events       = calloc (channels, sizeof (*cfg->events));
+    assert (cfg->channelFreqs && cfg->m && cfg->f && cfg->last && cfg->calAcc && cfg->calCount
+            && cfg->blink && cfg->calPending && cfg->outputs && cfg->events);
+
+    for (int i=0; i<channels; i++)
+    {
+        cfg->channelFreqs[i] = -offsets[i];
+        cfg->m[i] = mixer_new (cfg->Fs, cfg->channelFreqs[i]);
+        cfg->f[i] = channel_filter_new ();
+        cfg->blink[i] = mixer_new (cfg->Fs / DECIMATION, -BLINK_RATE);
+    }
+
+    // a new plan starts all channels over
+    if (cfg->hops)
+    {
+        HopState *h = alloc_hops (cfg, cfg->nHops);
+        assert (h);
+        for (int n=0; n<cfg->nHops; n++)
+        {
+            h[n].samplePos  = cfg->hops[n].samplePos;
+            h[n].centerFreq = cfg->hops[n].centerFreq;
+            h[n].calOffset  = cfg->hops[n].calOffset;
         }
+        free_hops (cfg->hops, cfg->nHops);
+        cfg->hops = h;
+        set_mixers (cfg, & cfg->hops[cfg->hopIndex]);
+    }
+    if (cfg->nSweep)
+    {
+        int r = alloc_sweep (cfg);
+        assert (r == SUCCESS);
+    }
+
+    if (cfg->shm)
+    {
+        float freq[MRBEAM_CHANNELS] = {0};
+        for (int i=0; i<channels; i++)
+            freq[i] = offsets[i];
+        shm_ring_set_channel_freq (cfg->shm, freq);
+    }
+    return SUCCESS;
+}
+
+/// Resize a per-channel array, the new entries are zero.
+static void *grow_channels (void *p, size_t size, int old, int channels)
+{
+    char *q = realloc (p, channels * size);
+    assert (q);
+    memset (q + old * size, 0, (channels - old) * size);
+    return q;
+}
+
+int mrbeam_add_channels (void *ctx, float const *offsets, int channels)
+{
+    MrbeamCfg *cfg = ctx;
+    int old = cfg->nChannels;
+    int n = old + channels;
+
+    if (channels < 1 || n > MRBEAM_CHANNELS)
+        return ERROR;
+
+    // the outputs of a block are made room for again with the new plan
+    free_sweep_outputs (cfg);
+    if (cfg->frontendOut)
+        for (int i=0; i<old; i++)
+            free (cfg->frontendOut[i]);
+    free (cfg->frontendOut);
+    cfg->frontendOut  = NULL;
+    cfg->frontendSize = 0;
+
+    cfg->channelFreqs = grow_channels (cfg->channelFreqs, sizeof (*cfg->channelFreqs), old, n);
+    cfg->m            = grow_channels (cfg->m, sizeof (*cfg->m), old, n);
+    cfg->f            = grow_channels (cfg->f, sizeof (*cfg->f), old, n);
+    cfg->last         = grow_channels (cfg->last, sizeof (*cfg->last), old, n);
+    cfg->calAcc       = grow_channels (cfg->calAcc, sizeof (*cfg->calAcc), old, n);
+    cfg->calCount     = grow_channels (cfg->calCount, sizeof (*cfg->calCount), old, n);
+    cfg->blink        = grow_channels (cfg->blink, sizeof (*cfg->blink), old, n);
+    cfg->calPending   = grow_channels (cfg->calPending, sizeof (*cfg->calPending), old, n);
+    cfg->outputs      = grow_channels (cfg->outputs, sizeof (*cfg->outputs), old, n);
+    cfg->events       = grow_channels (cfg->events, sizeof (*cfg->events), old, n);
+
+    for (int i=old; i<n; i++)
+    {
+        cfg->channelFreqs[i] = -offsets[i - old];
+        cfg->m[i] = mixer_new (cfg->Fs, cfg->channelFreqs[i]);
+        cfg->f[i] = channel_filter_new ();
+        cfg->blink[i] = mixer_new (cfg->Fs / DECIMATION, -BLINK_RATE);
+        // the channels of a frame decimate in step
+        cfg->f[i]->cnt = cfg->f[0]->cnt;
+    }
+
+    for (int h=0; h<cfg->nHops; h++)
+    {
+        int r = channel_table_grow (& cfg->hops[h].ch, old, n);
+        assert (r == SUCCESS);
+        for (int i=old; i<n; i++)
+            channel_state_init (& cfg->trig, & cfg->hops[h].ch, i);
+    }
+    for (int s=0; s<cfg->nSweep; s++)
+    {
+        SweepSet *set = & cfg->sweep[s];
+        int r = channel_table_grow (& set->ch, old, n);
+        assert (r == SUCCESS);
+        set->events = grow_channels (set->events, sizeof (*set->events), old, n);
+        for (int i=old; i<n; i++)
+            channel_state_init (& set->trig, & set->ch, i);
+    }
+    cfg->nChannels = n;
+    if (cfg->hops)
+        set_mixers (cfg, & cfg->hops[cfg->hopIndex]);
+
+    if (cfg->shm)
+    {
+        float freq[MRBEAM_CHANNELS] = {0};
+        for (int i=0; i<n; i++)
+            freq[i] = -cfg->channelFreqs[i];
+        shm_ring_set_channel_freq (cfg->shm, freq);
+    }
+    return SUCCESS;
+}
+
+void mrbeam_set_calibration (void *ctx, int enable)
+{
+    MrbeamCfg *cfg = ctx;
+
+    cfg->calibrate = enable;
+}
+
+void mrbeam_set_afc (void *ctx, float limitHz)
+{
+    MrbeamCfg *cfg = ctx;
+
+    cfg->afcLimit = limitHz;
+}
+
+void mrbeam_set_iq_correction (void *ctx, int enable)
+{
+    MrbeamCfg *cfg = ctx;
+
+    iq_balance_enable (& cfg->iq, enable);
+}
+
+int mrbeam_sample_size (mrbeam_format_t format)
+{
+    switch (format)
+    {
+    case MRBEAM_CU8:
+    case MRBEAM_CS8:
+        return 1;
+    case MRBEAM_CS16:
+        return 2;
+    case MRBEAM_CF32:
+        return 4;
+    }
+    return 0;
+}
+
+int mrbeam_set_format (void *ctx, mrbeam_format_t format, float fullScale)
+{
+    MrbeamCfg *cfg = ctx;
+
+    int sampleSize = mrbeam_sample_size (format);
+    if (!sampleSize || !(fullScale > 0))
+        return ERROR;
+
+    cfg->format     = format;
+    cfg->sampleSize = sampleSize;
+    cfg->scale      = 1 / fullScale;
+    // the largest magnitude of a 12 bit CS16 source with full scale 2048 is 2047
+    cfg->clipLevel  = format == MRBEAM_CS16 ? fullScale - 1 : fullScale;
+
+    // the estimate starts over from the offset of the new format
+    int enabled = cfg->iq.enabled;
+    iq_balance_init (& cfg->iq, cfg->Fs, format == MRBEAM_CU8 ? IQ_BALANCE_DC_CU8 : 0);
+    iq_balance_enable (& cfg->iq, enabled);
+    return SUCCESS;
+}
+
+void mrbeam_set_early (void *ctx, int periods, float confidence, int confirm)
+{
+    MrbeamCfg *cfg = ctx;
+
+    cfg->earlyOutputs = periods > 0 ? (int) (periods * cfg->Fs / (double) DECIMATION / BLINK_RATE + 0.5) : 0;
+    // the score of noise is exponentially distributed with mean 1
+    cfg->earlyScore = -log (1.0 - confidence);
+    cfg->confirm = confirm;
+    for (int n=0; n<cfg->nHops; n++)
+        for (int i=0; i<cfg->nChannels; i++)
+            early_reset (& cfg->hops[n].ch, i);
+}
+
+int mrbeam_set_sweep (void *ctx, mrbeam_params_t const *sets, int nSets, mrbeam_sweep_cb_t cb, void *cbCtx)
+{
+    MrbeamCfg *cfg = ctx;
+
+    for (int n=0; n<nSets; n++)
+        if (sets[n].minCount < 1 || sets[n].maxGap < 1 || sets[n].refractory < 0 || sets[n].window < 1)
+            return ERROR;
+
+    free_sweep (cfg);
+    free (cfg->sweep);
+    free (cfg->sweepGroups);
+    cfg->sweep        = NULL;
+    cfg->sweepGroups  = NULL;
+    cfg->nSweep       = 0;
+    cfg->nSweepGroups = 0;
+    if (nSets < 1)
+        return SUCCESS;
+
+    cfg->sweep       = calloc (nSets, sizeof (*cfg->sweep));
+    cfg->sweepGroups = calloc (nSets, sizeof (*cfg->sweepGroups));
+    if (!cfg->sweep || !cfg->sweepGroups)
+    {
+        free (cfg->sweep);
+        free (cfg->sweepGroups);
+        cfg->sweep       = NULL;
+        cfg->sweepGroups = NULL;
+        return ERROR;
+    }
+    cfg->nSweep     = nSets;
+    cfg->sweepCb    = cb;
+    cfg->sweepCbCtx = cbCtx;
+    // sets with the same level and minimum SNR follow the same noise floor,
+    // each group tracks it once and its sets only count pulses
+    for (int n=0; n<nSets; n++)
+    {
+        SweepSet *set = & cfg->sweep[n];
+        trigger_init (cfg, & set->trig, & sets[n]);
+        set->next = -1;
+
+        int g = 0;
+        while (g < cfg->nSweepGroups && (sets[cfg->sweepGroups[g]].levelDb != sets[n].levelDb
+                    || sets[cfg->sweepGroups[g]].minSnrDb != sets[n].minSnrDb))
+            g++;
+        if (g == cfg->nSweepGroups)
+        {
+            cfg->sweepGroups[cfg->nSweepGroups++] = n;
+            continue;
+        }
+        int last = cfg->sweepGroups[g];
+        while (cfg->sweep[last].next >= 0)
+            last = cfg->sweep[last].next;
+        cfg->sweep[last].next = n;
+    }
+    if (alloc_sweep (cfg) != SUCCESS)
+    {
+        mrbeam_set_sweep (cfg, NULL, 0, NULL, NULL);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+int mrbeam_set_threads (void *ctx, int threads)
+{
+    MrbeamCfg *cfg = ctx;
+
+    fork_join_free (cfg->pool);
+    cfg->pool = NULL;
+    if (threads > 1)
+    {
+        cfg->pool = fork_join_create (threads);
+        if (!cfg->pool)
+            return ERROR;
+    }
+    return SUCCESS;
+}
+
+void mrbeam_adjust_ppm (void *ctx, double ppm)
+{
+    MrbeamCfg *cfg = ctx;
+
+    // the tuner now corrects this much, the mixers keep the remainder
+    for (int n=0; n<cfg->nHops; n++)
+        cfg->hops[n].calOffset += ppm * 1e-6 * cfg->hops[n].centerFreq;
+
+    set_mixers (cfg, & cfg->hops[cfg->hopIndex]);
+}
+
+int mrbeam_publish_shm (void *ctx, char const *name)
+{
+    MrbeamCfg *cfg = ctx;
+
+    float offsets[MRBEAM_CHANNELS] = {0};
+    for (int i=0; i<cfg->nChannels; i++)
+        offsets[i] = -cfg->channelFreqs[i];
+
+    // room for any channel plan, unused channels have a zero frequency
+    cfg->shm = shm_ring_create (name, MRBEAM_CHANNELS, SHM_RING_DEFAULT_SLOTS, cfg->Fs, DECIMATION, offsets);
+
+    return cfg->shm ? SUCCESS : ERROR;
+}
+
+void mrbeam_get_stats (void *ctx, mrbeam_stats_t *stats)
+{
+    MrbeamCfg *cfg = ctx;
+    HopState *hop = & cfg->hops[cfg->hopIndex];
+
+    stats->samples = cfg->sampleCounter - cfg->lost;
+    stats->clipped = cfg->clipped;
+    stats->gaps    = cfg->gaps;
+    stats->lost    = cfg->lost;
+    stats->channels = cfg->nChannels;
+    for (int i=0; i<cfg->nChannels; i++)
+    {
+        stats->noise[i] = 10 * log10 (hop->ch.noise[i]);
+        stats->drift[i] = hop->ch.afcOffset[i];
+    }
+    stats->dc[0] = cfg->iq.dc_i * 128;
+    stats->dc[1] = cfg->iq.dc_q * 128;
+    stats->iqGain  = 20 * log10 (cfg->iq.gain);
+    stats->iqPhase = asin (cfg->iq.sin_phase) * (180 / M_PI);
+    stats->freqOffset = hop->calOffset;
+    stats->ppm = hop->centerFreq ? -1e6 * hop->calOffset / hop->centerFreq : 0;
+}
+
+void mrbeam_set_position (void *ctx, uint64_t samplePos)
+{
+    MrbeamCfg *cfg = ctx;
+
+    // as if the detector had been started at the position
+    cfg->sampleCounter = samplePos;
+    for (int n=0; n<cfg->nHops; n++)
+    {
+        ChannelTable *t = & cfg->hops[n].ch;
+        cfg->hops[n].samplePos = samplePos;
+        for (int i=0; i<cfg->nChannels; i++)
+        {
+            t->lastSample[i]  += samplePos;
+            t->eventSample[i] += samplePos;
+            t->earlySample[i] += samplePos;
+        }
+    }
+    iq_balance_align (& cfg->iq, samplePos);
+}
+
+void mrbeam_set_anchor (void *ctx, uint64_t samplePos, double time)
+{
+    MrbeamCfg *cfg = ctx;
+
+    sample_clock_anchor (& cfg->clock, samplePos, time);
+}
+
+uint64_t mrbeam_position (void *ctx)
+{
+    MrbeamCfg *cfg = ctx;
+
+    return cfg->sampleCounter;
+}
+
+uint64_t mrbeam_alignment (void *ctx)
+{
+    MrbeamCfg *cfg = ctx;
+
+    // decimator phase and correlation windows, I/Q estimates align
+    // themselves to the position
+    return DECIMATION * (uint64_t) (cfg->earlyOutputs ? cfg->earlyOutputs : 1);
+}
+
+int mrbeam_get_channels (void *ctx, float *offsets)
+{
+    MrbeamCfg *cfg = ctx;
+
+    for (int i=0; i<cfg->nChannels; i++)
+        offsets[i] = -cfg->channelFreqs[i];
+    return cfg->nChannels;
+}
+
+/// FNV-1a over len bytes, continuing hash h.
+static uint64_t hash_bytes (uint64_t h, void const *data, size_t len)
+{
+    unsigned char const *p = data;
+
+    for (size_t i=0; i<len; i++)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+uint64_t mrbeam_frontend_hash (void *ctx)
+{
+    MrbeamCfg *cfg = ctx;
+    Filter const *f = cfg->f[0];
+    int decimation = DECIMATION;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    h = hash_bytes (h, & cfg->Fs, sizeof (cfg->Fs));
+    h = hash_bytes (h, & cfg->format, sizeof (cfg->format));
+    h = hash_bytes (h, & cfg->scale, sizeof (cfg->scale));
+    h = hash_bytes (h, & cfg->iq.enabled, sizeof (cfg->iq.enabled));
+    h = hash_bytes (h, & cfg->iq.nominal_dc, sizeof (cfg->iq.nominal_dc));
+    h = hash_bytes (h, & cfg->hops[cfg->hopIndex].calOffset, sizeof (cfg->hops[cfg->hopIndex].calOffset));
+    h = hash_bytes (h, & cfg->nChannels, sizeof (cfg->nChannels));
+    h = hash_bytes (h, cfg->channelFreqs, cfg->nChannels * sizeof (*cfg->channelFreqs));
+    h = hash_bytes (h, & decimation, sizeof (decimation));
+    h = hash_bytes (h, & f->nTaps, sizeof (f->nTaps));
+    h = hash_bytes (h, f->taps, f->nTaps * sizeof (*f->taps));
+    // exact kernels share their outputs
+    if (kernels[cfg->kernel].maxError)
+        h = hash_bytes (h, kernels[cfg->kernel].name, strlen (kernels[cfg->kernel].name));
+    return h;
+}
+
+int mrbeam_kernels (void)
+{
+    return KERNELS;
+}
+
+char const *mrbeam_kernel_name (int kernel)
+{
+    return kernel >= 0 && kernel < KERNELS ? kernels[kernel].name : NULL;
+}
+
+float mrbeam_kernel_error (int kernel)
+{
+    return kernel >= 0 && kernel < KERNELS ? kernels[kernel].maxError : 0;
+}
+
+int mrbeam_set_kernel (void *ctx, int kernel)
+{
+    MrbeamCfg *cfg = ctx;
+
+    if (kernel < 0 || kernel >= KERNELS)
+        return ERROR;
+    cfg->kernel = kernel;
+    return SUCCESS;
+}
+
+void mrbeam_set_frontend_cb (void *ctx, mrbeam_frontend_cb_t cb, void *cbCtx)
+{
+    MrbeamCfg *cfg = ctx;
+
+    cfg->frontendCb    = cb;
+    cfg->frontendCbCtx = cbCtx;
+}
+
+// State of a channel that decides on future events.
+struct mrbeam_channel_state
+{
+    long  lastSample;
+    long  eventSample;
+    long  earlySample;
+    int   count;
+    int   window;
+    int   earlyN;
+    int   calCount;
+    float peak;
+    float noise;
+    float afcOffset;
+    float earlySum;
+    float earlySq;
+    float earlyPeak;
+    float earlyCorr;     // magnitude of the correlation without the mean, free of the blink phase
+    float lastMag2;
+    float calAcc[2];
+};
+
+struct mrbeam_state
+{
+    long samplePos;
+    int nChannels;
+    float calOffset;
+    double dcI, dcQ, gain, sinPhase;
+    struct mrbeam_channel_state ch[MRBEAM_CHANNELS];
+};
+
+mrbeam_state_t *mrbeam_save_state (void *ctx)
+{
+    MrbeamCfg *cfg = ctx;
+    HopState *hop = & cfg->hops[cfg->hopIndex];
+    ChannelTable *t = & hop->ch;
+
+    mrbeam_state_t *s = calloc (1, sizeof (*s));
+    if (!s)
+        return NULL;
+
+    s->samplePos = hop->samplePos;
+    s->nChannels = cfg->nChannels;
+    s->calOffset = hop->calOffset;
+    s->dcI       = cfg->iq.dc_i;
+    s->dcQ       = cfg->iq.dc_q;
+    s->gain      = cfg->iq.gain;
+    s->sinPhase  = cfg->iq.sin_phase;
+    for (int i=0; i<cfg->nChannels; i++)
+    {
+        struct mrbeam_channel_state *c = & s->ch[i];
+        float mean = t->earlyN[i] ? t->earlySum[i] / t->earlyN[i] : 0;
+
+        c->lastSample  = t->lastSample[i];
+        c->eventSample = t->eventSample[i];
+        c->earlySample = t->earlySample[i];
+        c->count       = t->count[i];
+        c->window      = t->window[i];
+        c->earlyN      = t->earlyN[i];
+        c->calCount    = cfg->calCount[i];
+        c->peak        = t->peak[i];
+        c->noise       = t->noise[i];
+        c->afcOffset   = t->afcOffset[i];
+        c->earlySum    = t->earlySum[i];
+        c->earlySq     = t->earlySq[i];
+        c->earlyPeak   = t->earlyPeak[i];
+        c->earlyCorr   = hypotf (t->earlyRe[i] - mean * t->earlyWRe[i], t->earlyIm[i] - mean * t->earlyWIm[i]);
+        c->lastMag2    = cfg->last[i][0] * cfg->last[i][0] + cfg->last[i][1] * cfg->last[i][1];
+        c->calAcc[0]   = cfg->calAcc[i][0];
+        c->calAcc[1]   = cfg->calAcc[i][1];
+    }
+    return s;
+}
+
+static int close_to (double a, double b, double tol)
+{
+    return fabs (a - b) <= tol * fmax (fabs (a), fabs (b));
+}
+
+/// Positions matter while they are within reach of the next pulse or event.
+static int recent (long pos, long a, long b, long reach)
+{
+    return pos - a <= reach || pos - b <= reach;
+}
+
+int mrbeam_state_match (void *ctx, mrbeam_state_t const *state)
+{
+    mrbeam_state_t *s = mrbeam_save_state (ctx);
+    if (!s)
+        return 0;
+
+    MrbeamCfg *cfg = ctx;
+    long pos = s->samplePos;
+    // the count starts over after maxGap blink periods without a pulse
+    long countReach = (long) ((cfg->trig.params.maxGap + 1) * cfg->Fs / BLINK_RATE) + 1;
+    long refractory = cfg->trig.refractory;
+
+    int match = s->samplePos == state->samplePos && s->nChannels == state->nChannels
+            && fabsf (s->calOffset - state->calOffset) <= STATE_HZ_TOL
+            && fabs (s->dcI - state->dcI) <= STATE_IQ_TOL && fabs (s->dcQ - state->dcQ) <= STATE_IQ_TOL
+            && fabs (s->gain - state->gain) <= STATE_IQ_TOL && fabs (s->sinPhase - state->sinPhase) <= STATE_IQ_TOL;
+
+    for (int i=0; match && i<s->nChannels; i++)
+    {
+        struct mrbeam_channel_state const *a = & s->ch[i];
+        struct mrbeam_channel_state const *b = & state->ch[i];
+
+        if (recent (pos, a->lastSample, b->lastSample, countReach))
+            match = a->lastSample == b->lastSample && a->count == b->count;
+        if (recent (pos, a->eventSample, b->eventSample, refractory))
+            match = match && a->eventSample == b->eventSample;
+        if (recent (pos, a->earlySample, b->earlySample, refractory))
+            match = match && a->earlySample == b->earlySample;
+
+        match = match && a->window == b->window && a->earlyN == b->earlyN && a->calCount == b->calCount
+                && (!a->window || close_to (a->peak, b->peak, STATE_TOL))
+                && close_to (a->noise, b->noise, STATE_TOL)
+                && fabsf (a->afcOffset - b->afcOffset) <= STATE_HZ_TOL
+                && close_to (a->earlySum, b->earlySum, STATE_TOL)
+                && close_to (a->earlySq, b->earlySq, STATE_TOL)
+                && close_to (a->earlyPeak, b->earlyPeak, STATE_TOL)
+                && close_to (a->earlyCorr, b->earlyCorr, STATE_TOL)
+                && close_to (a->lastMag2, b->lastMag2, STATE_TOL)
+                && close_to (a->calAcc[0], b->calAcc[0], STATE_TOL)
+                && close_to (a->calAcc[1], b->calAcc[1], STATE_TOL);
+    }
+    free (s);
+    return match;
+}
+
+void mrbeam_free (void *ctx)
+{
+    MrbeamCfg *cfg = ctx;
+
+    mrbeam_set_sweep (cfg, NULL, 0, NULL, NULL);
+    free_channels (cfg);
+    shm_ring_free (cfg->shm);
+    free_hops (cfg->hops, cfg->nHops);
+    fork_join_free (cfg->pool);
+    free (cfg->conv);
+    free (cfg);
+}
+
+/// Steer the channel mixer by the residual offset measured over its strong bursts.
+static void track_offset (MrbeamCfg *cfg, HopState *hop, int channel)
+{
+    float *afcOffset = & hop->ch.afcOffset[channel];
+    double outputRate = cfg->Fs / (double) DECIMATION;
+    double residual = atan2 (cfg->calAcc[channel][1], cfg->calAcc[channel][0]) * outputRate / (2 * M_PI);
+
+    // the common offset follows the total offset of the lights, the
+    // channel AFC takes up what is left for this light; the common
+    // offset is shared by all channels and changes after the block
+    if (cfg->calibrate)
+        cfg->calPending[channel] += CAL_GAIN * (*afcOffset + residual);
+    if (cfg->afcLimit)
+    {
+        *afcOffset += AFC_GAIN * residual;
+        if (*afcOffset > cfg->afcLimit)
+            *afcOffset = cfg->afcLimit;
+        if (*afcOffset < -cfg->afcLimit)
+            *afcOffset = -cfg->afcLimit;
+    }
+
+    mixer_set_freq (cfg->m[channel], cfg->channelFreqs[channel] - hop->calOffset - *afcOffset);
+
+    cfg->calAcc[channel][0] = 0;
+    cfg->calAcc[channel][1] = 0;
+    cfg->calCount[channel]  = 0;
+}
+
+/// Apply the common offset steps of all channels.
+static void apply_calibration (MrbeamCfg *cfg, HopState *hop)
+{
+    double outputRate = cfg->Fs / (double) DECIMATION;
+    float step = 0;
+
+    for (int i=0; i<cfg->nChannels; i++)
+    {
+        step += cfg->calPending[i];
+        cfg->calPending[i] = 0;
+    }
+    if (!step)
+        return;
+
+    hop->calOffset += step;
+    // beyond half the output rate the phase slope aliases
+    if (hop->calOffset > outputRate / 2)
+        hop->calOffset = outputRate / 2;
+    if (hop->calOffset < -outputRate / 2)
+        hop->calOffset = -outputRate / 2;
+    set_mixers (cfg, hop);
+}
+
+/// Queue an event of a channel, reported once the block is done.
+static void add_event (ChannelEvents *e, mrbeam_event_t const *ev)
+{
+    if (e->n == e->size)
+    {
+        int size = e->size ? 2 * e->size : 4;
+        mrbeam_event_t *p = realloc (e->ev, size * sizeof (*p));
+        if (!p)
+            return;
+        e->ev   = p;
+        e->size = size;
+    }
+    e->ev[e->n++] = *ev;
+}
+
+/// Report the events of the block in sample order, lower channels first at the same sample.
+/// Set is the sweep parameter set of the events, -1 for those of the detector.
+static void flush_events (MrbeamCfg *cfg, ChannelEvents *events, int set)
+{
+    for (;;)
+    {
+        int best = -1;
+        for (int i=0; i<cfg->nChannels; i++)
+        {
+            ChannelEvents *e = & events[i];
+            if (e->next < e->n && (best < 0
+                    || e->ev[e->next].samplePos < events[best].ev[events[best].next].samplePos))
+                best = i;
+        }
+        if (best < 0)
+            break;
+        mrbeam_event_t const *ev = & events[best].ev[events[best].next];
+        if (set >= 0)
+            cfg->sweepCb (set, ev, cfg->sweepCbCtx);
+        else if (cfg->eventCb)
+            cfg->eventCb (ev, cfg->eventCbCtx);
+        events[best].next++;
+    }
+    for (int i=0; i<cfg->nChannels; i++)
+        events[i].n = events[i].next = 0;
+}
+
+/// Count a pulse whose window closed with the given peak, report the light once enough were seen.
+/// Early is nonzero if the light was reported early, the count only confirms it then.
+static void count_pulse (MrbeamCfg *cfg, HopState *hop, Trigger const *trig, ChannelTable *t, int channel,
+        float_type peak, long pos, ChannelEvents *e, int early)
+{
+    long   hopPos = cfg->blockHopPos + pos;
+    double periodTime = 1.0 / BLINK_RATE;
+    long   elapsedSampels = hopPos - t->lastSample[channel];
+    double timeElapsed = elapsedSampels / (double) cfg->Fs;
+    int nPeriods = timeElapsed / periodTime;
+
+    if (nPeriods > trig->params.maxGap)
+        t->count[channel] = 0;
+
+    t->lastSample[channel] = hopPos;
+    t->count[channel]++;
+    //print_debug ("channel:%d count:%d", channel, t->count[channel]);
+
+    if (t->count[channel] > trig->params.minCount)
+    {
+       if (hopPos - t->eventSample[channel] > trig->refractory)
+       {
+           t->eventSample[channel] = hopPos;
+           // with early events the count only confirms, if asked to
+           if (!early || cfg->confirm)
+           {
+               long samplePos = cfg->blockSample + pos;
+               mrbeam_event_t ev =
+               {
+                   .time      = sample_clock_time (& cfg->clock, samplePos),
+                   .samplePos = samplePos,
+                   .channel   = cfg->hopIndex * MRBEAM_CHANNELS + channel,
+                   .freq      = hop->centerFreq ? hop->centerFreq - (long) cfg->channelFreqs[channel] : 0,
+                   .count     = t->count[channel],
+                   .level     = peak,
+                   .snr       = 10 * log10 (peak / t->noise[channel]),
+                   .confidence = 1,
+                   .kind      = early ? MRBEAM_EVENT_CONFIRMED : MRBEAM_EVENT_LIGHT,
+               };
+               add_event (e, & ev);
+           }
+       }
+    }
+}
+
+/// Close a correlation window: report the channel if its envelope follows the blink rate.
+static void early_detect (MrbeamCfg *cfg, HopState *hop, int i, long pos)
+{
+    ChannelTable *t = & hop->ch;
+    long  hopPos = cfg->blockHopPos + pos;
+    float n = t->earlyN[i];
+
+    // correlate the envelope without its mean, a steady carrier has none at the blink rate
+    float mean = t->earlySum[i] / n;
+    float var  = t->earlySq[i] / n - mean * mean;
+    float re   = t->earlyRe[i] - mean * t->earlyWRe[i];
+    float im   = t->earlyIm[i] - mean * t->earlyWIm[i];
+    // normalized so that noise scores are exponentially distributed with mean 1
+    float score = var > 0 ? (re * re + im * im) / (n * var) : 0;
+
+    // the pulses must also reach the trigger level
+    if (score >= cfg->earlyScore && t->earlyPeak[i] >= t->threshold[i]
+            && hopPos - t->earlySample[i] > cfg->trig.refractory)
+    {
+        long samplePos = cfg->blockSample + pos;
+        mrbeam_event_t ev =
+        {
+            .time      = sample_clock_time (& cfg->clock, samplePos),
+            .samplePos = samplePos,
+            .channel   = cfg->hopIndex * MRBEAM_CHANNELS + i,
+            .freq      = hop->centerFreq ? hop->centerFreq - (long) cfg->channelFreqs[i] : 0,
+            .count     = t->count[i],
+            .level     = t->earlyPeak[i],
+            .snr       = 10 * log10 (t->earlyPeak[i] / t->noise[i]),
+            .confidence = 1 - exp (-score),
+            .kind      = MRBEAM_EVENT_EARLY,
+        };
+        t->earlySample[i] = hopPos;
+        add_event (& cfg->events[i], & ev);
+    }
+    early_reset (t, i);
+}
+
+/// Follow the noise floor of a channel with an output, the trigger level follows it.
+static inline void track_noise (Trigger const *trig, ChannelTable *t, int i, float_type mag2)
+{
+    // gated floor: outputs above the threshold are signal, but
+    // let the floor creep up so it cannot lock below a raised noise
+    if (mag2 < t->threshold[i])
+        t->noise[i] += (mag2 - t->noise[i]) * NOISE_ALPHA;
+    else
+        t->noise[i] *= NOISE_CREEP;
+    if (!trig->levelLimit)
+        t->threshold[i] = t->noise[i] * trig->snrMargin;
+}
+
+/// Open a pulse window on an output above the trigger level, count the pulse once it closes.
+static inline void track_pulse (MrbeamCfg *cfg, HopState *hop, Trigger const *trig, ChannelTable *t, int i,
+        float_type mag2, long pos, ChannelEvents *e, int early)
+{
+    // the pulse is credited with its peak once the window closes
+    if (t->window[i])
+    {
+        if (--t->window[i] == 0)
+            count_pulse (cfg, hop, trig, t, i, t->peak[i], pos, e, early);
+        else if (t->peak[i] < mag2)
+            t->peak[i] = mag2;
+    }
+    else if (mag2 > t->threshold[i])
+    {
+        t->window[i] = trig->params.window;
+        t->peak[i]   = mag2;
+    }
+}
+
+/// Run the detector of a channel on a decimated output at block position pos.
+static inline void channel_output (MrbeamCfg *cfg, HopState *hop, int i, float_type const *iqFiltered, long pos,
+        int outputs)
+{
+    ChannelTable *t = & hop->ch;
+    Mixer *blink = cfg->blink[i];
+
+    float_type mag2 = iqFiltered[0] * iqFiltered[0] + iqFiltered[1] * iqFiltered[1];
+    track_noise (& cfg->trig, t, i, mag2);
+
+    if (cfg->calibrate || cfg->afcLimit)
+    {
+        // phase advance between two strong outputs of a burst
+        float_type *last = cfg->last[i];
+        float_type lastMag2 = last[0] * last[0] + last[1] * last[1];
+        float_type strong = t->noise[i] * CAL_SNR;
+        if (mag2 > strong && lastMag2 > strong)
+        {
+            cfg->calAcc[i][0] += iqFiltered[0] * last[0] + iqFiltered[1] * last[1];
+            cfg->calAcc[i][1] += iqFiltered[1] * last[0] - iqFiltered[0] * last[1];
+            if (++cfg->calCount[i] >= CAL_OUTPUTS)
+                track_offset (cfg, hop, i);
+        }
+        last[0] = iqFiltered[0];
+        last[1] = iqFiltered[1];
+    }
+    if (cfg->earlyOutputs)
+    {
+        t->earlyRe[i]  += mag2 * blink->ival;
+        t->earlyIm[i]  += mag2 * blink->qval;
+        t->earlySum[i] += mag2;
+        t->earlySq[i]  += mag2 * mag2;
+        if (t->earlyPeak[i] < mag2)
+            t->earlyPeak[i] = mag2;
+        t->earlyWRe[i] += blink->ival;
+        t->earlyWIm[i] += blink->qval;
+        mixer_iterate (blink);
+        if (++t->earlyN[i] >= cfg->earlyOutputs)
+            early_detect (cfg, hop, i, pos);
+    }
+    if (cfg->shm)
+    {
+        shm_ring_sample_t *s = & shm_ring_frame_at (cfg->shm, outputs)[i];
+        s->i    = iqFiltered[0];
+        s->q    = iqFiltered[1];
+        s->mag2 = mag2;
+        // the channels share a frame, the first one labels it
+        if (i == 0)
+            shm_ring_set_info (cfg->shm, outputs, cfg->blockSample + pos, cfg->hopIndex);
+    }
+    if (cfg->nSweep)
+    {
+        cfg->sweepOut[i][outputs].pos  = pos;
+        cfg->sweepOut[i][outputs].mag2 = mag2;
+    }
+    track_pulse (cfg, hop, & cfg->trig, t, i, mag2, pos, & cfg->events[i], cfg->earlyOutputs != 0);
+}
+
+/// Run one channel over the converted block, only the state of that channel is touched.
+static void channel_block (void *ctx, int i)
+{
+    MrbeamCfg *cfg = ctx;
+    HopState *hop = & cfg->hops[cfg->hopIndex];
+    Mixer  *m = cfg->m[i];
+    Filter *f = cfg->f[i];
+    KernelFn kernel = kernels[cfg->kernel].run;
+    int outputs = 0;
+
+    // the detector runs between the outputs, AFC may steer the mixer
+    for (uint32_t k=0; k<cfg->blockLen;)
+    {
+        float_type iqFiltered[2] = {0};
+        int output = 0;
+
+        k += kernel (m, f, cfg->conv + k, cfg->blockLen - k, iqFiltered, & output);
+        if (!output)
+            break;
+
+        if (cfg->frontendCb)
+        {
+            cfg->frontendOut[i][outputs][0] = iqFiltered[0];
+            cfg->frontendOut[i][outputs][1] = iqFiltered[1];
+        }
+        channel_output (cfg, hop, i, iqFiltered, k, outputs);
+        outputs++;
+    }
+    cfg->outputs[i] = outputs;
+}
+
+/// Run channels first to first + n - 1 over the converted block as the window kernel does,
+/// their mixers iterate together in one vector with the arithmetic of mixer_iterate ().
+static inline void lane_group (MrbeamCfg *cfg, HopState *hop, int first, int n)
+{
+    Mixer  **m = cfg->m + first;
+    Filter **f = cfg->f + first;
+    int skip = f[0]->decimation - f[0]->nTaps;
+    int cnt = f[0]->cnt;
+    int outputs = 0;
+    float_type ival[KERNEL_LANES], qval[KERNEL_LANES], cosv[KERNEL_LANES], sinv[KERNEL_LANES];
+
+    for (int l=0; l<n; l++)
+    {
+        ival[l] = m[l]->ival;
+        qval[l] = m[l]->qval;
+        cosv[l] = m[l]->cosv;
+        sinv[l] = m[l]->sinv;
+    }
+    for (uint32_t k=0; k<cfg->blockLen; k++)
+    {
+        float_type const *in = cfg->conv[k];
+
+        for (int l=0; l<n; l++)
+        {
+            float_type i = cosv[l] * ival[l] - sinv[l] * qval[l];
+            float_type q = sinv[l] * ival[l] + cosv[l] * qval[l];
+            float_type mag2 = i * i + q * q;
+            float_type mag  = 0.5f * (1.0f + mag2);
+            float_type correction = 2.0f - mag;
+
+            ival[l] = i * correction;
+            qval[l] = q * correction;
+        }
+        if (cnt >= skip)
+        {
+            for (int l=0; l<n; l++)
+            {
+                float_type iqMixed[2];
+                iqMixed[0] = ival[l] * in[0] - qval[l] * in[1];
+                iqMixed[1] = qval[l] * in[0] + ival[l] * in[1];
+                stream_buffer_insert (f[l]->sb, iqMixed);
+            }
+        }
+        if (++cnt < f[0]->decimation)
+            continue;
+
+        // the detector runs between the outputs, AFC may steer the mixers
+        cnt = 0;
+        for (int l=0; l<n; l++)
+        {
+            float_type iqFiltered[2];
+
+            m[l]->ival = ival[l];
+            m[l]->qval = qval[l];
+            f[l]->cnt = 0;
+            filter_output (f[l], iqFiltered);
+            if (cfg->frontendCb)
+            {
+                cfg->frontendOut[first + l][outputs][0] = iqFiltered[0];
+                cfg->frontendOut[first + l][outputs][1] = iqFiltered[1];
+            }
+            channel_output (cfg, hop, first + l, iqFiltered, k + 1, outputs);
+            cosv[l] = m[l]->cosv;
+            sinv[l] = m[l]->sinv;
+        }
+        outputs++;
+    }
+    for (int l=0; l<n; l++)
+    {
+        m[l]->ival = ival[l];
+        m[l]->qval = qval[l];
+        f[l]->cnt = cnt;
+        cfg->outputs[first + l] = outputs;
+    }
+}
+
+/// Run a group of KERNEL_LANES channels with the lanes kernel, the filters decimate in step.
+static void lane_block (void *ctx, int group)
+{
+    MrbeamCfg *cfg = ctx;
+    HopState *hop = & cfg->hops[cfg->hopIndex];
+    int first = group * KERNEL_LANES;
+    int n = cfg->nChannels - first < KERNEL_LANES ? cfg->nChannels - first : KERNEL_LANES;
+
+    if (cfg->f[first]->decimation < cfg->f[first]->nTaps)
+    {
+        for (int i=first; i<first + n; i++)
+            channel_block (ctx, i);
+    }
+    // a full group gets loops of known length
+    else if (n == KERNEL_LANES)
+        lane_group (cfg, hop, first, KERNEL_LANES);
+    else
+        lane_group (cfg, hop, first, n);
+}
+
+/// Run one channel over the kept outputs of a block.
+static void frontend_block (void *ctx, int i)
+{
+    MrbeamCfg *cfg = ctx;
+    HopState *hop = & cfg->hops[cfg->hopIndex];
+    mrbeam_frontend_block_t const *block = cfg->frontendIn;
+    float const *iq = block->iq[i];
+
+    for (int n=0; n<block->outputs; n++)
+        channel_output (cfg, hop, i, & iq[2 * n], block->first + (long) n * DECIMATION, n);
+    cfg->outputs[i] = block->outputs;
+}
+
+/// Run a group of sweep sets over the outputs of one channel, task is group * channels + channel.
+static void sweep_block (void *ctx, int task)
+{
+    MrbeamCfg *cfg = ctx;
+    HopState *hop = & cfg->hops[cfg->hopIndex];
+    int i = task % cfg->nChannels;
+    SweepOutput const *out = cfg->sweepOut[i];
+    SweepLevel *level = cfg->sweepLevel[task];
+    int first = cfg->sweepGroups[task / cfg->nChannels];
+    int outputs = cfg->outputs[i];
+
+    // the same as track_noise (), once for the group, on locals so the
+    // loop over the outputs stays in registers
+    Trigger const *trig = & cfg->sweep[first].trig;
+    float_type noise = cfg->sweep[first].ch.noise[i];
+    float_type threshold = cfg->sweep[first].ch.threshold[i];
+    for (int n=0; n<outputs; n++)
+    {
+        float_type mag2 = out[n].mag2;
+        if (mag2 < threshold)
+            noise += (mag2 - noise) * NOISE_ALPHA;
+        else
+            noise *= NOISE_CREEP;
+        if (!trig->levelLimit)
+            threshold = noise * trig->snrMargin;
+        level[n].noise     = noise;
+        level[n].threshold = threshold;
+    }
+
+    // the same as track_pulse () for every set of the group
+    for (int k=first; k>=0; k=cfg->sweep[k].next)
+    {
+        SweepSet *set = & cfg->sweep[k];
+        ChannelTable *t = & set->ch;
+        float_type peak = t->peak[i];
+        int window = t->window[i];
+        for (int n=0; n<outputs; n++)
+        {
+            float_type mag2 = out[n].mag2;
+            if (window)
+            {
+                if (--window == 0)
+                {
+                    t->noise[i] = level[n].noise;
+                    count_pulse (cfg, hop, & set->trig, t, i, peak, out[n].pos, & set->events[i], 0);
+                }
+                else if (peak < mag2)
+                    peak = mag2;
+            }
+            else if (mag2 > level[n].threshold)
+            {
+                window = set->trig.params.window;
+                peak   = mag2;
+            }
+        }
+        t->noise[i]     = noise;
+        t->threshold[i] = threshold;
+        t->peak[i]      = peak;
+        t->window[i]    = window;
+    }
+}
+
+/// Count the I and Q values at full scale.
+static uint64_t count_clipped (MrbeamCfg const *cfg, unsigned char const *iq_buf, uint32_t values)
+{
+    uint64_t clipped = 0;
+
+    switch (cfg->format)
+    {
+    case MRBEAM_CU8:
+        for (uint32_t i=0; i<values; i++)
+            clipped += clipLookup[iq_buf[i]];
+        break;
+    case MRBEAM_CS8:
+        for (uint32_t i=0; i<values; i++)
+            clipped += clipLookup[iq_buf[i] ^ 0x80];
+        break;
+    case MRBEAM_CS16:
+    {
+        int16_t const *in = (int16_t const *) iq_buf;
+        int level = (int) cfg->clipLevel;
+        for (uint32_t i=0; i<values; i++)
+            clipped += in[i] >= level || in[i] <= -level;
+        break;
+    }
+    case MRBEAM_CF32:
+    {
+        float const *in = (float const *) iq_buf;
+        for (uint32_t i=0; i<values; i++)
+            clipped += fabsf (in[i]) >= cfg->clipLevel;
+        break;
+    }
+    }
+    return clipped;
+}
+
+/// Convert 8 bit input through the tables, flip 0x80 turns CS8 into table indices.
+static void convert_8bit (MrbeamCfg *cfg, unsigned char const *iq_buf, uint32_t samples, unsigned char flip)
+{
+    // tables rebuilt by the estimate apply from the next buffer on
+    float const *lutI = cfg->iq.lut_i;
+    float const *lutQ = cfg->iq.lut_q;
+    float_type phase  = cfg->iq.phase;
+    for (uint32_t k=0; k<samples; k++)
+    {
+        float_type i = lutI[iq_buf[2 * k] ^ flip];
+        cfg->conv[k][0] = i;
+        cfg->conv[k][1] = lutQ[iq_buf[2 * k + 1] ^ flip] - phase * i;
+    }
+}
+
+static void convert_cs16 (float_type (*out)[2], int16_t const *in, uint32_t samples, float_type scale)
+{
+    for (uint32_t k=0; k<samples; k++)
+    {
+        out[k][0] = in[2 * k] * scale;
+        out[k][1] = in[2 * k + 1] * scale;
+    }
+}
+
+static void convert_cf32 (float_type (*out)[2], float const *in, uint32_t samples, float_type scale)
+{
+    for (uint32_t k=0; k<samples; k++)
+    {
+        out[k][0] = in[2 * k] * scale;
+        out[k][1] = in[2 * k + 1] * scale;
+    }
+}
+
+/// Correct converted wide input in place with the estimate before this block.
+static void correct_block (MrbeamCfg *cfg, uint32_t samples)
+{
+    float_type offI   = cfg->iq.off_i;
+    float_type offQ   = cfg->iq.off_q;
+    float_type scaleQ = cfg->iq.scale_q;
+    float_type phase  = cfg->iq.phase;
+
+    iq_balance_feed_float (& cfg->iq, (float const (*)[2]) cfg->conv, samples);
+
+    for (uint32_t k=0; k<samples; k++)
+    {
+        float_type i = cfg->conv[k][0] - offI;
+        cfg->conv[k][0] = i;
+        cfg->conv[k][1] = (cfg->conv[k][1] - offQ) * scaleQ - phase * i;
+    }
+}
+
+/// Convert the input after the settle time for the channels, returns the samples converted.
+static uint32_t convert_block (MrbeamCfg *cfg, unsigned char const *iq_buf, uint32_t len)
+{
+    uint32_t samples = len / (2 * cfg->sampleSize);
+    uint32_t skip = cfg->settle < samples ? cfg->settle : samples;
+
+    cfg->clipped += count_clipped (cfg, iq_buf, 2 * samples);
+
+    // samples before the tuner settled are of no use
+    cfg->settle -= skip;
+    cfg->blockSample = cfg->sampleCounter + skip;
+    cfg->sampleCounter += samples;
+    samples -= skip;
+    iq_buf += 2 * skip * cfg->sampleSize;
+
+    if (samples > cfg->convSize)
+    {
+        free (cfg->conv);
+        cfg->conv = malloc (samples * sizeof (*cfg->conv));
+        assert (cfg->conv);
+        cfg->convSize = samples;
+    }
+
+    switch (cfg->format)
+    {
+    case MRBEAM_CU8:
+        convert_8bit (cfg, iq_buf, samples, 0);
+        break;
+    case MRBEAM_CS8:
+        convert_8bit (cfg, iq_buf, samples, 0x80);
+        break;
+    case MRBEAM_CS16:
+        convert_cs16 (cfg->conv, (int16_t const *) iq_buf, samples, cfg->scale);
+        correct_block (cfg, samples);
+        break;
+    case MRBEAM_CF32:
+        convert_cf32 (cfg->conv, (float const *) iq_buf, samples, cfg->scale);
+        correct_block (cfg, samples);
+        break;
+    }
+    return samples;
+}
+
+/// Run the channels over a block of samples, then report its events.
+static void run_block (MrbeamCfg *cfg, HopState *hop, uint32_t samples, fork_join_task_t channelTask, int tasks)
+{
+    // the channels share nothing but the converted block, events and
+    // common offset steps are collected per channel and applied after
+    cfg->blockLen    = samples;
+    cfg->blockHopPos = hop->samplePos;
+    if (cfg->nSweep)
+        reserve_sweep (cfg, samples / DECIMATION + 1);
+    // readers must not copy the frames of this block while they are filled
+    if (cfg->shm)
+        shm_ring_reserve (cfg->shm, samples / DECIMATION + 1);
+    fork_join_run (cfg->pool, tasks, channelTask, cfg);
+    // the sets trigger on the same outputs, one task per group and channel
+    if (cfg->nSweep)
+        fork_join_run (cfg->pool, cfg->nSweepGroups * cfg->nChannels, sweep_block, cfg);
+    hop->samplePos += samples;
+
+    if (cfg->shm)
+        shm_ring_commit_n (cfg->shm, cfg->outputs[0]);
+    flush_events (cfg, cfg->events, -1);
+    for (int n=0; n<cfg->nSweep; n++)
+        flush_events (cfg, cfg->sweep[n].events, n);
+    apply_calibration (cfg, hop);
+}
+
+void sdr_callback(unsigned char *iq_buf, uint32_t len, void *ctx)
+{
+    MrbeamCfg *cfg = ctx;
+    //for (uint32_t i=0; i<len; i++)
+    //    fprintf (stderr, "%02x%s", iq_buf[i], ((i == len-1) || ((i+1) % 64 == 0)) ? "\n" : ((i+1) % 2 == 0) ? " " : "");
+
+    assert (len % (2 * cfg->sampleSize) == 0);
+
+    // the last sample of this buffer arrived just now
+    sample_clock_arrival (& cfg->clock, cfg->sampleCounter + len / (2 * cfg->sampleSize));
+
+    HopState *hop = & cfg->hops[cfg->hopIndex];
+    long start = cfg->sampleCounter;
+    uint64_t clipped = cfg->clipped;
+    // all channel filters decimate in step
+    uint32_t first = DECIMATION - cfg->f[0]->cnt;
+
+    uint32_t samples = convert_block (cfg, iq_buf, len);
+    // wide input fed the estimate while converting
+    if (cfg->sampleSize == 1)
+        iq_balance_feed (& cfg->iq, iq_buf, len, cfg->format == MRBEAM_CS8 ? 0x80 : 0);
+
+    if (cfg->frontendCb)
+        reserve_frontend (cfg, samples / DECIMATION + 1);
+    if (samples)
+    {
+        int lanes = kernels[cfg->kernel].lanes;
+        if (lanes)
+            run_block (cfg, hop, samples, lane_block, (cfg->nChannels + lanes - 1) / lanes);
+        else
+            run_block (cfg, hop, samples, channel_block, cfg->nChannels);
+    }
+
+    if (cfg->frontendCb)
+    {
+        mrbeam_frontend_block_t block =
+        {
+            .samples  = len / (2 * cfg->sampleSize),
+            .skip     = (uint32_t) (cfg->blockSample - start),
+            .clipped  = cfg->clipped - clipped,
+            .first    = first,
+            .outputs  = samples ? cfg->outputs[0] : 0,
+            .channels = cfg->nChannels,
+        };
+        for (int i=0; i<cfg->nChannels; i++)
+            block.iq[i] = cfg->frontendOut[i][0];
+        cfg->frontendCb (& block, cfg->frontendCbCtx);
+    }
+}
+
+int mrbeam_feed_frontend (void *ctx, mrbeam_frontend_block_t const *block)
+{
+    MrbeamCfg *cfg = ctx;
+
+    // the outputs were mixed at fixed offsets
+    if (block->channels != cfg->nChannels || block->skip > block->samples || cfg->calibrate || cfg->afcLimit)
+        return ERROR;
+
+    sample_clock_arrival (& cfg->clock, cfg->sampleCounter + block->samples);
+
+    HopState *hop = & cfg->hops[cfg->hopIndex];
+    cfg->clipped += block->clipped;
+    cfg->settle = cfg->settle > (long) block->skip ? cfg->settle - (long) block->skip : 0;
+    cfg->blockSample = cfg->sampleCounter + block->skip;
+    cfg->sampleCounter += block->samples;
+
+    uint32_t samples = block->samples - block->skip;
+    if (samples)
+    {
+        cfg->frontendIn = block;
+        run_block (cfg, hop, samples, frontend_block, cfg->nChannels);
+        cfg->frontendIn = NULL;
     }
+    return SUCCESS;
 }
@@ -23,19 +23,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "sdr.h"
 #include "rtl_mrbeam.h"
 #include "parser.h"
+#include "event_out.h"
+#include "watchdog.h"
+#include "agc.h"
+#include "scan.h"
+#include "batch.h"
+#include "chunk_replay.h"
+#include "sweep.h"
+#include "frontend_cache.h"
+#include "kernel_check.h"
+#include "kernel_tune.h"
+#include "fork_join.h"
+#include "sample_clock.h"
 #include "term_ctl.h"
 #include "confparse.h"
 #include "optparse.h"
+#include "fatal.h"
 
 static r_cfg_t g_cfg;
 
@@ -58,9 +75,6 @@ static void sighandler(int signum)
         sdr_stop(g_cfg.dev);
         return;
     }
-    else if (signum == SIGALRM) {
-        fprintf(stderr, "Async read stalled, exiting!\n");
-    }
     else {
         fprintf(stderr, "Signal caught, exiting!\n");
     }
@@ -91,13 +105,34 @@ static void usage(int exit_code)
             "  [-v] Increase verbosity (can be used multiple times).\n"
             "       -v : verbose, -vv : verbose decoders, -vvv : debug decoders, -vvvv : trace decoding).\n"
             "  [-d <RTL-SDR USB device index> | :<RTL-SDR USB device serial> | <SoapySDR device query> | rtl_tcp | help]\n"
-            "  [-g <gain> | help] (default: auto)\n"
+            "  [-g <gain> | agc[:<gain>] | help] (default: auto)\n"
+            "  [-p <ppm_error> | auto | help] Correct rtl-sdr tuner frequency offset error (default: 0)\n"
+            "\t\t= Tuner and trigger options =\n"
+            "  [-f <frequency>] Receive frequency(s) (default: %i Hz)\n"
+            "  [-H <seconds>] Hop interval for polling of multiple frequencies (default: %i seconds)\n"
+            "  [-C <Hz>[,<Hz>...] | scan[:<seconds>[:<interval>]] | help] Channel plan (default: -300k,300k,100k,-100k)\n"
+            "  [-Y level=<dB level> | minsnr=<dB> | afc[=<Hz>] | help] Detector options\n"
+            "  [-X <setting>=<value>[:<value>...][,...] | help] Sweep trigger settings over a replay\n"
+            "  [-j <threads>] Worker threads sharing the channels of each block (default: 1),\n"
+            "       with a batch of -r captures the captures replayed at a time\n"
+            "  [-k <kernel> | auto[:<wisdom file>] | check[:<seconds>] | help] Front-end kernel (default: reference)\n"
+            "\t\t= Input and output options =\n"
+            "  [-r <filename> | help] Read data from input file instead of a receiver\n"
+            "  [-P <jobs>[:<overlap>]] Replay a single capture in chunks, <jobs> at a time\n"
+            "  [-K <directory>] Keep the decimated channels of a replay to skip the front-end next time\n"
+            "  [-E <seconds>] Evaluate replays against the ground truth in <capture>.truth\n"
+            "  [-b <bytes>] Input block size (default: %d, with -k auto the plan's)\n"
+            "  [-F stdout | file:<path> | udp:<host>:<port> | unix:<path> | help] Add an event output (default: stdout)\n"
+            "  [-O plain | json | binary | help] Event output format (default: plain)\n"
+            "  [-M time[:<options>] | level | stats[:<interval>] | help] Add various meta data to each output.\n"
+            "  [-S <name>] Publish decimated channel samples to a shared memory ring, e.g. -S /mrbeam\n"
             "  [-h] Output this usage help and exit\n"
-            "       Use -d, -g, -R, -X, -F, -M, -r, -w, or -W without argument for more help\n\n");
+            "       Use -d, -g, -p, -f, -Y, -F, -O, -M, or -r without argument for more help\n\n",
+            DEFAULT_FREQUENCY, DEFAULT_HOP_TIME, DEFAULT_BUF_LENGTH);
     exit(exit_code);
 }
 
-#define OPTSTRING "hVv:r:w:W:d:g:s"
+#define OPTSTRING "hVv:r:w:W:d:g:p:f:H:C:Y:X:j:k:P:K:E:b:sS:F:O:M:"
 
 // these should match the short options exactly
 static struct conf_keywords const conf_keywords[] = {
@@ -106,9 +141,25 @@ static struct conf_keywords const conf_keywords[] = {
         {"version", 'V'},
         {"device", 'd'},
         {"gain", 'g'},
+        {"ppm_error", 'p'},
+        {"frequency", 'f'},
+        {"hop_interval", 'H'},
+        {"channels", 'C'},
+        {"threads", 'j'},
+        {"kernel", 'k'},
+        {"pulse_detect", 'Y'},
+        {"sweep", 'X'},
         {"read_file", 'r'},
+        {"parallel_replay", 'P'},
+        {"frontend_cache", 'K'},
+        {"evaluate", 'E'},
         {"write_file", 'w'},
         {"overwrite_file", 'W'},
+        {"block_size", 'b'},
+        {"shm", 'S'},
+        {"output", 'F'},
+        {"output_format", 'O'},
+        {"report_meta", 'M'},
         {NULL, 0}
 };
 
@@ -156,7 +207,221 @@ static void help_gain(void)
             "  [-g <gain>] (default: auto)\n"
             "\tFor RTL-SDR: gain in dB (\"0\" is auto).\n"
             "\tFor SoapySDR: gain in dB for automatic distribution (\"\" is auto), or string of gain elements.\n"
-            "\tE.g. \"LNA=20,TIA=8,PGA=2\" for LimeSDR.\n");
+            "\tE.g. \"LNA=20,TIA=8,PGA=2\" for LimeSDR.\n"
+            "  [-g agc[:<gain>]] Software gain control, starting at the given gain (default: %s)\n"
+            "\tSteps through the tuner gain table (RTL-SDR and rtl_tcp): down when the\n"
+            "\tinput clips or the channel noise floor is above %d dB, up when it is\n"
+            "\tbelow %d dB and the input does not clip. At most one step per %.0f s.\n",
+            DEFAULT_GAIN, AGC_NOISE_HIGH, AGC_NOISE_LOW, AGC_HOLD);
+    exit(0);
+}
+
+static void help_ppm(void)
+{
+    term_help_printf(
+            "\t\t= Frequency correction option =\n"
+            "  [-p <ppm_error>] Correct rtl-sdr tuner frequency offset error (default: 0)\n"
+            "  [-p auto] Calibrate from the known channel frequencies of strong bursts.\n"
+            "\tThe phase slope of the decimated channel outputs gives the offset of\n"
+            "\tthe lights, the channel mixers follow it to keep the lights centred.\n"
+            "\tWhole ppm are moved to the tuner frequency correction, at most every %d s.\n",
+            DEFAULT_PPM_HOLD);
+    exit(0);
+}
+
+static void help_frequency(void)
+{
+    term_help_printf(
+            "\t\t= Frequency hopping =\n"
+            "  [-f <frequency>] Receive frequency (default: %i Hz)\n"
+            "\tUse -f multiple times to hop through several center frequencies,\n"
+            "\tthe channels of hop n are reported as n*%d + channel.\n"
+            "  [-H <seconds>] Dwell time per frequency (default: %i seconds)\n"
+            "\tUse -H multiple times to set the dwell of each frequency in order,\n"
+            "\tthe last one given applies to the remaining frequencies.\n"
+            "\tEach frequency keeps its own detector state, pulse counts carry over\n"
+            "\tbetween visits. The first %d ms after each retune are discarded.\n",
+            DEFAULT_FREQUENCY, MRBEAM_CHANNELS, DEFAULT_HOP_TIME, DEFAULT_SETTLE_TIME);
+    exit(0);
+}
+
+static void help_channels(void)
+{
+    term_help_printf(
+            "\t\t= Channel plan option =\n"
+            "  [-C <Hz>[,<Hz>...]] Channel offsets from the center frequency, up to %d\n"
+            "\t(default: -300000,300000,100000,-100000)\n"
+            "  [-C scan[:<seconds>[:<interval>]]] Find the channels in a spectrum scan\n"
+            "\tAverages the spectrum over the given seconds of input (default: %d) and\n"
+            "\tpicks the peaks blinking at %.1f Hz, strongest first. Detection starts once\n"
+            "\tthe scan is done. With an interval in seconds the scan is repeated while\n"
+            "\tdetecting and adds a channel for each light farther than %.0f kHz from the\n"
+            "\tplan, up to %d; the channels of the plan keep their state. File input is\n"
+            "\tscanned from the start and then rewound (stdin is not rewound).\n",
+            MRBEAM_CHANNELS, DEFAULT_SCAN_TIME, SCAN_BLINK_RATE, SCAN_MIN_SPACING / 1e3, MRBEAM_CHANNELS);
+    exit(0);
+}
+
+static void help_level(void)
+{
+    term_help_printf(
+            "\t\t= Trigger level option =\n"
+            "  [-Y level=<dB level>] Fixed trigger level in dB of the channel power, full scale is 0 dB\n"
+            "\t(default: 0 for an adaptive level per channel, -7 was the previous fixed level)\n"
+            "  [-Y minsnr=<dB>] Adaptive trigger level above the channel noise floor (default: %d dB)\n"
+            "\tEach channel tracks its noise floor, events report the SNR of the pulse peak.\n"
+            "  [-Y afc[=<Hz>]] Track the drift of each light (default limit: %d Hz)\n"
+            "\tA frequency discriminator on strong bursts steers the channel mixer\n"
+            "\tslowly towards the light, up to the limit. Drift shows in -M stats.\n"
+            "  [-Y iq=<on|off>] Correct the DC offset and I/Q imbalance of the input (default: on)\n"
+            "\tThe estimate is refreshed every quarter second, it shows in -M stats.\n"
+            "  [-Y early[=<periods>]] Report a light as soon as its envelope follows the blink rate\n"
+            "\tCorrelates windows of the given blink periods (default: %d, about %d ms)\n"
+            "\tinstead of waiting for 176 counted pulses (about 700 ms).\n"
+            "  [-Y confidence=<p>] Chance an early event is not noise (default: %g)\n"
+            "  [-Y confirm] Also report the counted light after an early event\n"
+            "  [-Y count=<n>] Report a light once more than <n> pulses were counted (default: 175)\n"
+            "  [-Y gap=<n>] Start the count over after <n> blink periods without a pulse (default: 16)\n"
+            "  [-Y refractory=<seconds>] Time before a light is reported again (default: 3)\n"
+            "  [-Y window=<n>] Decimated outputs searched for the peak of a pulse (default: 10)\n"
+            "\tOptions can be combined, e.g. \"-Y level=-20,minsnr=9\".\n",
+            DEFAULT_MIN_SNR, DEFAULT_AFC_LIMIT, DEFAULT_EARLY_PERIODS,
+            (int)(DEFAULT_EARLY_PERIODS * 1000 / 254.5), DEFAULT_EARLY_CONFIDENCE);
+    exit(0);
+}
+
+static void help_output(void)
+{
+    term_help_printf(
+            "\t\t= Output option =\n"
+            "  [-F stdout | file:<path> | udp:<host>:<port> | unix:<path>] (default: stdout)\n"
+            "\tEvents are queued by the detector and written by a separate thread,\n"
+            "\ta slow output drops events instead of stalling sample processing.\n"
+            "\tfile: appends to the file, udp: and unix: send one datagram per event.\n"
+            "\tUse -F multiple times for more outputs.\n");
+    exit(0);
+}
+
+static void help_format(void)
+{
+    term_help_printf(
+            "\t\t= Output format option =\n"
+            "  [-O plain | json | binary] (default: plain)\n"
+            "\tplain: the channel number per line, prefixed by the time if -M time is given.\n"
+            "\tjson: one JSON object per line with time, sample position, channel and\n"
+            "\t  channel frequency (live only),\n"
+            "\t  -M level adds pulse count, peak level and SNR in dB.\n"
+            "\tbinary: a fixed %d byte little endian record per event (version %d), see event_fmt.h.\n",
+            EVENT_RECORD_SIZE, EVENT_RECORD_VERSION);
+    exit(0);
+}
+
+static void help_meta(void)
+{
+    term_help_printf(
+            "\t\t= Meta information option =\n"
+            "  [-M time[:<options>]|level] Add various metadata to every output line.\n"
+            "\tUse \"time\" to add current date and time meta data (preset for live inputs).\n"
+            "\tUse \"time:unix\" to show the seconds since unix epoch as time meta data.\n"
+            "\tUse \"time:iso\" to show the time with ISO-8601 format (YYYY-MM-DD\"T\"hh:mm:ss).\n"
+            "\tUse \"time:samples\" to show the sample position as time meta data.\n"
+            "\tUse \"time:off\" to remove time meta data.\n"
+            "\tUse \"time:usec\" to add microseconds to date time meta data.\n"
+            "\tUse \"time:tz\" to output time with timezone offset.\n"
+            "\tUse \"time:utc\" to output time in UTC.\n"
+            "\t\tA time option can be combined with other options, e.g. \"time:unix:usec\".\n"
+            "\tUse \"level\" to add pulse count, peak level and SNR meta data.\n"
+            "\tUse \"stats[:<interval>]\" to report detector statistics to stderr every interval\n"
+            "\t(default: %d s) and on SIGINFO: gain, frequency offset, noise floor and drift.\n",
+            DEFAULT_STATS_INTERVAL);
+    exit(0);
+}
+
+static void help_read(void)
+{
+    term_help_printf(
+            "\t\t= Read file option =\n"
+            "  [-r <filename>] Read data from input file instead of a receiver\n"
+            "\tThe file must hold I/Q samples at 948 kS/s, use \"-\" to read from stdin.\n"
+            "\tThe format is CU8, CS8, CS16 (full scale 32768) or CF32 (full scale 1.0),\n"
+            "\ttaken from a \"cs16:\" style prefix or the file extension, else CU8.\n"
+            "\tAll detector timing uses the sample position, so a replay produces the\n"
+            "\tsame events as live operation at any speed. Event times count from the\n"
+            "\tstart of the replay, use -M time:samples for file positions.\n"
+            "  [-r <filename> -r <filename> ... | -r <directory>] Replay a batch of captures\n"
+            "\tA directory adds its .cu8, .cs8, .cs16 and .cf32 files. Each capture runs\n"
+            "\tthrough a detector of its own, -j captures at a time (default: one per CPU).\n"
+            "\tThe events of a capture go to <capture>.log, .json or .bin after -O,\n"
+            "\ta summary of all captures goes to stdout.\n"
+            "  [-r <filename> -P <jobs>[:<overlap>]] Replay a single capture in chunks\n"
+            "\tThe chunks run <jobs> at a time, each warmed up on <overlap> seconds of\n"
+            "\tthe capture before it (default: %d). A chunk that does not start out\n"
+            "\tthe way the one before ended is replayed again in sequence, the events\n"
+            "\tare the same as without -P. Not for stdin.\n"
+            "  [-r <filename> -K <directory>] Cache the front-end of a replay\n"
+            "\tThe decimated I/Q of every channel goes to a file in <directory>, keyed\n"
+            "\ton the capture contents and the front-end settings (format, -p, I/Q\n"
+            "\tcorrection, channel plan). A later replay with the same key reads the\n"
+            "\tfile instead of mixing and filtering the capture, e.g. to try other -Y\n"
+            "\tor -X trigger settings. The events are the same as without -K. Not with\n"
+            "\t-p auto or -Y afc, which retune the channels, nor for stdin, -P or a batch.\n"
+            "  [-r <filename> ... -E <seconds>] Evaluate the detector on labelled captures\n"
+            "\tReplays the captures as a batch, each with a ground truth <capture>.truth\n"
+            "\tof a line per light: seconds from the start of the capture and channel,\n"
+            "\t\"#\" starts a comment. A detection within <seconds> of a light on its\n"
+            "\tchannel finds it. Stdout gets a JSON line per capture and one for the total\n"
+            "\twith precision (found lights per detection, duplicates count against it),\n"
+            "\tprecision_ignoring_duplicates (only false alarms count against it),\n"
+            "\trecall, timing error and CPU seconds per second of signal, the batch\n"
+            "\tsummary goes to stderr. E.g. -r captures/ -E 2 -j 1\n",
+            DEFAULT_CHUNK_OVERLAP);
+    exit(0);
+}
+
+static void help_sweep(void)
+{
+    term_help_printf(
+            "\t\t= Sweep option =\n"
+            "  [-X <setting>=<value>[:<value>...][,<setting>=...]] Sweep trigger settings over a replay\n"
+            "\tSettings are level, minsnr, count, gap, refractory and window, see -Y.\n"
+            "\tEvery combination of the values runs as a parameter set of its own on\n"
+            "\tthe outputs of the one detector, the mixers and filters run once. Settings\n"
+            "\tnot swept keep the -Y value. The events of the detector go to the outputs\n"
+            "\tas usual, after the replay stdout gets a line per set with its event\n"
+            "\tcounts, followed by its events in the -O format (none for binary).\n"
+            "\tE.g. -r capture.cu8 -X count=150:175:200,minsnr=9:12:15 (9 sets)\n"
+            "\tAt most %d sets, a single -r capture only.\n",
+            SWEEP_MAX_SETS);
+    exit(0);
+}
+
+static void help_kernel(void)
+{
+    term_help_printf(
+            "\t\t= Kernel option =\n"
+            "  [-k <kernel>] Front-end kernel that mixes and decimates the channels\n"
+            "\tThe reference mixes and filters every sample; the others take short cuts\n"
+            "\tand must give the same decimated outputs, within the error bound below.\n");
+    for (int k = 0; k < mrbeam_kernels(); ++k)
+        term_help_printf("\t  %-12s max error %g\n", mrbeam_kernel_name(k), mrbeam_kernel_error(k));
+    term_help_printf(
+            "  [-k auto[:<wisdom file>]] Plan the front-end for this CPU\n"
+            "\tTimes every kernel at input blocks of 16 KiB to 1 MiB, or the -b size,\n"
+            "\tand 1 up to a worker thread per channel on %d s of noise in the input\n"
+            "\tformat, with the options and channel plan of the command line, and runs\n"
+            "\tthe fastest. The plan is kept in the wisdom file (default: $HOME/%s) for\n"
+            "\tthe CPU model, input format, sample rate, channel plan, -Y afc, -p auto,\n"
+            "\tearly detection and -b, later starts read it from there. A receiver is\n"
+            "\tplanned once it is open. A plan should run %g times faster than real\n"
+            "\ttime, else a warning is given. The threads of the plan are used if there\n"
+            "\tis no -j and no batch. Remove the file to plan again.\n"
+            "  [-k check[:<seconds>]] Check every kernel against the reference and exit\n"
+            "\tEach kernel replays <seconds> (default: %d) of synthetic lights on the\n"
+            "\tchannel plan and each -r capture, with the detector options of the\n"
+            "\tcommand line. A line per kernel and input gives the largest output error\n"
+            "\tand whether the events are the same as those of the reference; the exit\n"
+            "\tcode is 1 on a failure. The tests run it, see tests/CMakeLists.txt.\n",
+            DEFAULT_TUNE_TIME, DEFAULT_WISDOM_FILE, TUNE_REALTIME, DEFAULT_KERNEL_CHECK_TIME);
     exit(0);
 }
 
@@ -188,7 +453,268 @@ static void parse_conf_option(r_cfg_t *cfg, int opt, char *arg)
         if (!arg)
             help_gain();
 
-        cfg->gain_str = arg;
+        if (!strncasecmp(arg, "agc", 3)) {
+            char *p = arg_param(arg);
+            cfg->agc_mode = 1;
+            if (p)
+                cfg->gain_str = p;
+        }
+        else
+            cfg->gain_str = arg;
+        break;
+    case 'p':
+        if (!arg)
+            help_ppm();
+
+        if (!strcasecmp(arg, "auto"))
+            cfg->ppm_auto = 1;
+        else
+            cfg->ppm_error = atoi(arg);
+        break;
+    case 'f':
+        if (!arg)
+            help_frequency();
+
+        if (cfg->frequencies < MAX_FREQS) {
+            uint32_t sr = atouint32_metric(arg, "-f: ");
+            cfg->frequency[cfg->frequencies++] = sr;
+        }
+        else
+            fprintf(stderr, "Max number of frequencies reached %d\n", MAX_FREQS);
+        break;
+    case 'H':
+        if (!arg)
+            help_frequency();
+
+        if (cfg->hop_times < MAX_FREQS)
+            cfg->hop_time[cfg->hop_times++] = atoi_time(arg, "-H: ");
+        else
+            fprintf(stderr, "Max number of hop times reached %d\n", MAX_FREQS);
+        break;
+    case 'j':
+        if (!arg)
+            usage(1);
+
+        cfg->threads = atoi(arg);
+        break;
+    case 'k':
+        if (!arg)
+            help_kernel();
+
+        if (!strncasecmp(arg, "check", 5) && (!arg[5] || arg[5] == ':')) {
+            cfg->kernel_check = arg_param(arg) ? atoi_time(arg_param(arg), "-k check: ") : DEFAULT_KERNEL_CHECK_TIME;
+            if (cfg->kernel_check <= 0) {
+                fprintf(stderr, "Kernel check time must be positive\n");
+                exit(1);
+            }
+            break;
+        }
+        if (!strncasecmp(arg, "auto", 4) && (!arg[4] || arg[4] == ':')) {
+            cfg->wisdom_file = arg_param(arg);
+            char const *home = getenv("HOME");
+            if (!cfg->wisdom_file && home) {
+                size_t len = strlen(home) + sizeof(DEFAULT_WISDOM_FILE) + 1;
+                char *path = malloc(len);
+                if (!path)
+                    FATAL_MALLOC("parse_conf_option()");
+                snprintf(path, len, "%s/%s", home, DEFAULT_WISDOM_FILE);
+                cfg->wisdom_file = path;
+            }
+            else if (!cfg->wisdom_file) {
+                cfg->wisdom_file = DEFAULT_WISDOM_FILE;
+            }
+            break;
+        }
+        for (n = 0; n < mrbeam_kernels() && strcasecmp(arg, mrbeam_kernel_name(n)); ++n)
+            ;
+        if (n == mrbeam_kernels()) {
+            fprintf(stderr, "Unknown kernel \"%s\", see -k help\n", arg);
+            exit(1);
+        }
+        cfg->kernel = n;
+        break;
+    case 'P':
+        if (!arg)
+            help_read();
+
+        cfg->chunk_jobs    = atoi(arg);
+        cfg->chunk_overlap = arg_param(arg) ? atof(arg_param(arg)) : DEFAULT_CHUNK_OVERLAP;
+        break;
+    case 'K':
+        if (!arg)
+            help_read();
+
+        cfg->cache_dir = arg;
+        break;
+    case 'E':
+        if (!arg)
+            help_read();
+
+        cfg->eval_tolerance = atof(arg);
+        if (cfg->eval_tolerance <= 0) {
+            fprintf(stderr, "Evaluation tolerance must be positive\n");
+            exit(1);
+        }
+        break;
+    case 'C':
+        if (!arg)
+            help_channels();
+
+        if (!strncasecmp(arg, "scan", 4)) {
+            char *p = arg_param(arg);
+            char *secs = asepc(&p, ':');
+            cfg->scan_time     = secs && *secs ? atoi_time(secs, "-C scan: ") : DEFAULT_SCAN_TIME;
+            cfg->scan_interval = p ? atoi_time(p, "-C scan: ") : 0;
+            cfg->channel_plan  = NULL;
+        }
+        else {
+            cfg->channel_plan = arg;
+            cfg->scan_time    = 0;
+        }
+        break;
+    case 'Y':
+        if (!arg)
+            help_level();
+
+        for (char *p = arg, *key, *val; p && *p;) {
+            getkwargs(&p, &key, &val);
+            if (key && val && !strcasecmp(key, "level"))
+                cfg->level_limit = atof(val);
+            else if (key && val && !strcasecmp(key, "minsnr"))
+                cfg->min_snr = atof(val);
+            else if (key && !strcasecmp(key, "afc"))
+                cfg->afc_limit = val ? atof(val) : DEFAULT_AFC_LIMIT;
+            else if (key && !strcasecmp(key, "iq"))
+                cfg->iq_correction = atobv(val, 1);
+            else if (key && !strcasecmp(key, "early"))
+                cfg->early_periods = atoiv(val, DEFAULT_EARLY_PERIODS);
+            else if (key && val && !strcasecmp(key, "confidence"))
+                cfg->early_confidence = atof(val);
+            else if (key && !strcasecmp(key, "confirm"))
+                cfg->early_confirm = atobv(val, 1);
+            else if (key && val && !strcasecmp(key, "count"))
+                cfg->min_count = atoi(val);
+            else if (key && val && !strcasecmp(key, "gap"))
+                cfg->max_gap = atoi(val);
+            else if (key && val && !strcasecmp(key, "refractory"))
+                cfg->refractory = atof(val);
+            else if (key && val && !strcasecmp(key, "window"))
+                cfg->pulse_window = atoi(val);
+            else {
+                fprintf(stderr, "Unknown trigger level option \"%s\"\n", key ? key : "");
+                help_level();
+            }
+        }
+        break;
+    case 'X':
+        if (!arg)
+            help_sweep();
+
+        cfg->sweep_spec = arg;
+        break;
+    case 'r':
+        if (!arg)
+            help_read();
+
+        if (!cfg->in_filename)
+            cfg->in_filename = arg;
+        cfg->in_files = realloc(cfg->in_files, (cfg->in_files_count + 1) * sizeof(*cfg->in_files));
+        if (!cfg->in_files)
+            FATAL_REALLOC("parse_conf_option()");
+        cfg->in_files[cfg->in_files_count++] = arg;
+        break;
+    case 'b':
+        if (!arg)
+            usage(1);
+
+        cfg->out_block_size = atouint32_metric(arg, "-b: ");
+        if (cfg->out_block_size < MINIMAL_BUF_LENGTH || cfg->out_block_size > MAXIMAL_BUF_LENGTH
+                || cfg->out_block_size % MINIMAL_BUF_LENGTH) {
+            fprintf(stderr, "Block size must be a multiple of %d from %d to %d bytes\n",
+                    MINIMAL_BUF_LENGTH, MINIMAL_BUF_LENGTH, MAXIMAL_BUF_LENGTH);
+            exit(1);
+        }
+        break;
+    case 'S':
+        if (!arg)
+            usage(1);
+
+        cfg->shm_name = arg;
+        break;
+    case 'F':
+        if (!arg)
+            help_output();
+
+        if (cfg->outputs >= MAX_OUTPUTS) {
+            fprintf(stderr, "Too many outputs (max %d)\n", MAX_OUTPUTS);
+            exit(1);
+        }
+        cfg->output_spec[cfg->outputs++] = arg;
+        break;
+    case 'O':
+        if (!arg)
+            help_format();
+
+        if (!strcasecmp(arg, "plain"))
+            cfg->output_format = EVENT_FMT_PLAIN;
+        else if (!strcasecmp(arg, "json"))
+            cfg->output_format = EVENT_FMT_JSON;
+        else if (!strcasecmp(arg, "binary") || !strcasecmp(arg, "bin"))
+            cfg->output_format = EVENT_FMT_BINARY;
+        else
+            help_format();
+        break;
+    case 'M':
+        if (!arg)
+            help_meta();
+
+        if (!strncasecmp(arg, "time", 4)) {
+            char *p = arg_param(arg);
+            // time  time:1  time:on  time:yes
+            // time:0  time:off  time:no
+            // time:date (default)
+            // time:unix
+            // time:iso
+            // time:samples
+            // time:usec  time:tz  time:utc
+            if (!p)
+                cfg->report_time = REPORT_TIME_DATE;
+            while (p && *p) {
+                char *opt_end = strchr(p, ':');
+                if (opt_end)
+                    *opt_end++ = '\0';
+                if (!strcasecmp(p, "date") || atobv(p, 0) == 1)
+                    cfg->report_time = REPORT_TIME_DATE;
+                else if (!strcasecmp(p, "unix"))
+                    cfg->report_time = REPORT_TIME_UNIX;
+                else if (!strcasecmp(p, "iso"))
+                    cfg->report_time = REPORT_TIME_ISO;
+                else if (!strcasecmp(p, "samples"))
+                    cfg->report_time = REPORT_TIME_SAMPLES;
+                else if (!strcasecmp(p, "off") || !strcasecmp(p, "no") || !strcmp(p, "0"))
+                    cfg->report_time = REPORT_TIME_OFF;
+                else if (!strcasecmp(p, "usec"))
+                    cfg->report_time_hires = 1;
+                else if (!strcasecmp(p, "tz"))
+                    cfg->report_time_tz = 1;
+                else if (!strcasecmp(p, "utc"))
+                    cfg->report_time_utc = 1;
+                else {
+                    fprintf(stderr, "Unknown time option \"%s\"\n", p);
+                    help_meta();
+                }
+                p = opt_end;
+            }
+        }
+        else if (!strcasecmp(arg, "level"))
+            cfg->report_meta = 1;
+        else if (!strncasecmp(arg, "stats", 5)) {
+            char *p = arg_param(arg);
+            cfg->report_stats   = 1;
+            cfg->stats_interval = p ? atoi_time(p, "-M stats: ") : DEFAULT_STATS_INTERVAL;
+        }
+        else
+            help_meta();
         break;
     default:
         usage(1);
@@ -197,6 +723,698 @@ static void parse_conf_option(r_cfg_t *cfg, int opt, char *arg)
 }
 
 
+static int set_channel_plan(r_cfg_t *cfg, float const *offsets, int channels)
+{
+    if (mrbeam_set_channels(cfg->mrbeam, offsets, channels)) {
+        fprintf(stderr, "Invalid channel plan (1 to %d channels)\n", MRBEAM_CHANNELS);
+        return -1;
+    }
+    fprintf(stderr, "Channel plan:");
+    for (int i = 0; i < channels; ++i)
+        fprintf(stderr, " %+.1f kHz", offsets[i] / 1e3);
+    fprintf(stderr, "\n");
+    return 0;
+}
+
+/// Parse a channel plan into MRBEAM_CHANNELS offsets at most, returns the channels or -1.
+static int parse_offsets(char const *spec, float *offsets)
+{
+    int channels = 0;
+    char *end;
+
+    while (*spec) {
+        double offset = strtod(spec, &end);
+        if (end == spec || (*end && *end != ',') || channels >= MRBEAM_CHANNELS) {
+            fprintf(stderr, "Invalid channel plan \"%s\"\n", spec);
+            return -1;
+        }
+        offsets[channels++] = (float)offset;
+        spec = *end ? end + 1 : end;
+    }
+    return channels;
+}
+
+static int parse_channel_plan(r_cfg_t *cfg, char const *spec)
+{
+    float offsets[MRBEAM_CHANNELS];
+    int channels = parse_offsets(spec, offsets);
+    if (channels < 0)
+        return -1;
+    return set_channel_plan(cfg, offsets, channels);
+}
+
+/// Add the lights of a later scan that have no channel yet, the channels of quiet lights stay.
+static void merge_channel_plan(r_cfg_t *cfg, float const *found, int channels)
+{
+    float plan[MRBEAM_CHANNELS];
+    int planned = mrbeam_get_channels(cfg->mrbeam, plan);
+
+    float offsets[MRBEAM_CHANNELS];
+    int added = 0;
+    for (int n = 0; n < channels && planned + added < MRBEAM_CHANNELS; ++n) {
+        int near = 0;
+        for (int i = 0; i < planned; ++i)
+            near |= fabsf(plan[i] - found[n]) < SCAN_MIN_SPACING;
+        if (!near)
+            offsets[added++] = found[n];
+    }
+    if (!added || mrbeam_add_channels(cfg->mrbeam, offsets, added)) {
+        fprintf(stderr, "Scan found no new lights, keeping the channel plan.\n");
+        return;
+    }
+    fprintf(stderr, "Channel plan adds:");
+    for (int i = 0; i < added; ++i)
+        fprintf(stderr, " %+.1f kHz", offsets[i] / 1e3);
+    fprintf(stderr, "\n");
+}
+
+/// Apply the result of a finished scan, keeps the plan if no lights were found.
+static void finish_scan(r_cfg_t *cfg)
+{
+    float offsets[MRBEAM_CHANNELS];
+    int channels = scan_result(cfg->scan, offsets, MRBEAM_CHANNELS);
+
+    if (channels > 0 && cfg->scan_startup)
+        set_channel_plan(cfg, offsets, channels);
+    else if (channels > 0)
+        merge_channel_plan(cfg, offsets, channels);
+    else
+        fprintf(stderr, "Scan found no lights, keeping the channel plan.\n");
+
+    scan_reset(cfg->scan);
+    cfg->scan_active = 0;
+    cfg->scan_next   = mrbeam_position(cfg->mrbeam) + (uint64_t)cfg->scan_interval * cfg->samp_rate;
+}
+
+/// Feed the scan if one is due, returns nonzero while the startup scan runs.
+static int scan_input(r_cfg_t *cfg, unsigned char const *iq_buf, uint32_t len)
+{
+    if (!cfg->scan_active) {
+        if (!cfg->scan_interval || mrbeam_position(cfg->mrbeam) < cfg->scan_next)
+            return 0;
+        cfg->scan_active = 1;
+    }
+    int startup = cfg->scan_startup;
+    if (scan_feed(cfg->scan, iq_buf, len)) {
+        finish_scan(cfg);
+        cfg->scan_startup = 0;
+    }
+    return startup;
+}
+
+/// Parse a sample format name, returns -1 if unknown.
+static int parse_format(char const *name, size_t len, mrbeam_format_t *format)
+{
+    static struct {
+        char const *name;
+        mrbeam_format_t format;
+    } const formats[] = {
+        {"cu8", MRBEAM_CU8}, {"cs8", MRBEAM_CS8}, {"cs16", MRBEAM_CS16}, {"cf32", MRBEAM_CF32},
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(*formats); ++i) {
+        if (strlen(formats[i].name) == len && !strncasecmp(name, formats[i].name, len)) {
+            *format = formats[i].format;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/// Hand the input format to the detector and the scan.
+static int set_input_format(r_cfg_t *cfg, mrbeam_format_t format, double full_scale)
+{
+    if (mrbeam_set_format(cfg->mrbeam, format, (float)full_scale)) {
+        fprintf(stderr, "Unsupported input format (full scale %g)\n", full_scale);
+        return -1;
+    }
+    if (cfg->scan)
+        scan_set_format(cfg->scan, format, (float)full_scale);
+    cfg->sample_size  = mrbeam_sample_size(format);
+    cfg->input_format = format;
+    cfg->full_scale   = (float)full_scale;
+    return 0;
+}
+
+/// Full scale of the capture file formats.
+static double const capture_full_scale[] = {
+    [MRBEAM_CU8] = 128.0, [MRBEAM_CS8] = 128.0, [MRBEAM_CS16] = 32768.0, [MRBEAM_CF32] = 1.0,
+};
+
+/// Split off a "cs16:" style format prefix, else go by the extension, else CU8; returns the path.
+static char const *capture_format(char const *path, mrbeam_format_t *format)
+{
+    char const *colon = strchr(path, ':');
+    char const *dot   = strrchr(path, '.');
+
+    *format = MRBEAM_CU8;
+    if (colon && !parse_format(path, colon - path, format))
+        return colon + 1;
+    if (dot)
+        parse_format(dot + 1, strlen(dot + 1), format);
+    return path;
+}
+
+/// Scan the start of a capture for its channels and rewind it.
+static void scan_file(r_cfg_t *cfg, FILE *in_file, unsigned char *buf)
+{
+    size_t pair = 2 * cfg->sample_size;
+    size_t pairs = cfg->out_block_size / pair;
+    size_t n_read;
+    int done = 0;
+    while (!done && !cfg->do_exit && (n_read = fread(buf, pair, pairs, in_file)) > 0)
+        done = scan_feed(cfg->scan, buf, (uint32_t)(n_read * pair));
+    finish_scan(cfg);
+    if (in_file != stdin)
+        rewind(in_file);
+}
+
+static int replay_file(r_cfg_t *cfg, void *mrbeamCtx)
+{
+    FILE *in_file;
+
+    mrbeam_format_t format;
+    cfg->in_filename = capture_format(cfg->in_filename, &format);
+    if (set_input_format(cfg, format, capture_full_scale[format]) < 0)
+        return -1;
+
+    if (strcmp(cfg->in_filename, "-") == 0) { // read samples from stdin
+        in_file = stdin;
+        cfg->in_filename = "<stdin>";
+    }
+    else {
+        in_file = fopen(cfg->in_filename, "rb");
+        if (!in_file) {
+            fprintf(stderr, "Opening file \"%s\" failed!\n", cfg->in_filename);
+            return -1;
+        }
+    }
+    fprintf(stderr, "Reading samples from file: %s\n", cfg->in_filename);
+
+    unsigned char *buf = malloc(cfg->out_block_size);
+    if (!buf) {
+        WARN_MALLOC("replay_file()");
+        return -1;
+    }
+
+    mrbeam_set_replay(mrbeamCtx);
+    // whole I/Q pairs only
+    size_t pair = 2 * cfg->sample_size;
+    size_t pairs = cfg->out_block_size / pair;
+    size_t n_read;
+    if (cfg->scan)
+        scan_file(cfg, in_file, buf);
+
+    // the key covers the channel plan, so the scan comes first
+    frontend_cache_t *cache = NULL;
+    if (cfg->cache_dir) {
+        uint64_t key;
+        if (frontend_cache_key(cfg->in_filename, mrbeam_frontend_hash(mrbeamCtx), cfg->out_block_size, &key) < 0) {
+            free(buf);
+            fclose(in_file);
+            return -1;
+        }
+        cache = frontend_cache_open(cfg->cache_dir, key);
+        if (cache) {
+            fprintf(stderr, "Reading the front-end from cache: %s/%016" PRIx64 ".fec\n", cfg->cache_dir, key);
+            int r = frontend_cache_replay(cache, mrbeamCtx, &cfg->do_exit);
+            frontend_cache_close(cache, 0);
+            free(buf);
+            fclose(in_file);
+            return r;
+        }
+        cache = frontend_cache_create(cfg->cache_dir, key);
+        if (cache)
+            mrbeam_set_frontend_cb(mrbeamCtx, frontend_cache_write, cache);
+    }
+
+    while (!cfg->do_exit && (n_read = fread(buf, pair, pairs, in_file)) > 0) {
+        n_read *= pair;
+        sdr_callback(buf, (uint32_t)n_read, mrbeamCtx);
+        cfg->input_pos += n_read;
+    }
+
+    if (cache) {
+        mrbeam_set_frontend_cb(mrbeamCtx, NULL, NULL);
+        int complete = !cfg->do_exit && !ferror(in_file);
+        if (frontend_cache_close(cache, complete) == 0 && complete)
+            fprintf(stderr, "Kept the front-end in cache: %s\n", cfg->cache_dir);
+    }
+    free(buf);
+    if (in_file != stdin)
+        fclose(in_file);
+    return 0;
+}
+
+static int is_directory(char const *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static int cmp_batch_file(void const *a, void const *b)
+{
+    return strcmp(((batch_file_t const *)a)->path, ((batch_file_t const *)b)->path);
+}
+
+static void add_batch_file(batch_t *batch, char const *path)
+{
+    mrbeam_format_t format;
+    path = capture_format(path, &format);
+
+    batch->files = realloc(batch->files, (batch->count + 1) * sizeof(*batch->files));
+    if (!batch->files)
+        FATAL_REALLOC("add_batch_file()");
+    batch_file_t *file = &batch->files[batch->count++];
+    memset(file, 0, sizeof(*file));
+    file->path = strdup(path);
+    if (!file->path)
+        FATAL_STRDUP("add_batch_file()");
+    file->format     = format;
+    file->full_scale = (float)capture_full_scale[format];
+}
+
+/// Add the captures of a directory, the files of a known format in name order.
+static int add_batch_dir(batch_t *batch, char const *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "Opening directory \"%s\" failed!\n", dir);
+        return -1;
+    }
+    int first = batch->count;
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        char const *dot = strrchr(entry->d_name, '.');
+        mrbeam_format_t format;
+        if (!dot || parse_format(dot + 1, strlen(dot + 1), &format) < 0)
+            continue;
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (!is_directory(path))
+            add_batch_file(batch, path);
+    }
+    closedir(d);
+    qsort(&batch->files[first], batch->count - first, sizeof(*batch->files), cmp_batch_file);
+    return 0;
+}
+
+/// Set up the detector options of the command line.
+static void configure_detector(r_cfg_t *cfg, void *mrbeamCtx)
+{
+    mrbeam_params_t params;
+    mrbeam_get_params(mrbeamCtx, &params);
+    params.levelDb  = cfg->level_limit;
+    params.minSnrDb = cfg->min_snr;
+    if (cfg->min_count)
+        params.minCount = cfg->min_count;
+    if (cfg->max_gap)
+        params.maxGap = cfg->max_gap;
+    if (cfg->refractory)
+        params.refractory = cfg->refractory;
+    if (cfg->pulse_window)
+        params.window = cfg->pulse_window;
+    if (mrbeam_set_params(mrbeamCtx, &params)) {
+        fprintf(stderr, "Invalid trigger settings\n");
+        exit(1);
+    }
+    mrbeam_set_calibration(mrbeamCtx, cfg->ppm_auto);
+    mrbeam_set_afc(mrbeamCtx, cfg->afc_limit);
+    mrbeam_set_iq_correction(mrbeamCtx, cfg->iq_correction);
+    mrbeam_set_early(mrbeamCtx, cfg->early_periods, cfg->early_confidence, cfg->early_confirm);
+    mrbeam_set_kernel(mrbeamCtx, cfg->kernel);
+}
+
+static void *batch_setup(void *ctx)
+{
+    r_cfg_t *cfg = ctx;
+    void *mrbeamCtx = mrbeam_setup();
+    configure_detector(cfg, mrbeamCtx);
+
+    float offsets[MRBEAM_CHANNELS];
+    int channels = cfg->channel_plan ? parse_offsets(cfg->channel_plan, offsets) : 0;
+    if (channels > 0)
+        mrbeam_set_channels(mrbeamCtx, offsets, channels);
+    return mrbeamCtx;
+}
+
+static int replay_batch(r_cfg_t *cfg)
+{
+    batch_t batch = {.cfg = cfg, .setup = batch_setup, .setup_ctx = cfg, .tolerance = cfg->eval_tolerance};
+
+    for (int i = 0; i < cfg->in_files_count; ++i) {
+        if (is_directory(cfg->in_files[i])) {
+            if (add_batch_dir(&batch, cfg->in_files[i]) < 0)
+                return -1;
+        }
+        else {
+            add_batch_file(&batch, cfg->in_files[i]);
+        }
+    }
+
+    int jobs = cfg->threads > 0 ? cfg->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs < 1)
+        jobs = 1;
+    if (jobs > FORK_JOIN_MAX_THREADS)
+        jobs = FORK_JOIN_MAX_THREADS;
+    fprintf(stderr, "Replaying %d captures, %d at a time\n", batch.count, jobs);
+
+    double start = mono_time();
+    int r = batch_run(&batch, jobs);
+    // an evaluation is for scripts, stdout gets the JSON only
+    batch_summary(&batch, batch.tolerance ? stderr : stdout, mono_time() - start);
+    if (batch.tolerance)
+        batch_evaluation(&batch, stdout);
+
+    for (int i = 0; i < batch.count; ++i)
+        free(batch.files[i].path);
+    free(batch.files);
+    return r;
+}
+
+/// Check the kernels on synthetic input and the -r captures.
+static int check_kernels(r_cfg_t *cfg)
+{
+    kernel_check_t check = {.cfg = cfg, .setup = batch_setup, .setup_ctx = cfg, .out = stdout};
+    batch_t batch = {0};
+
+    for (int i = 0; i < cfg->in_files_count; ++i) {
+        if (is_directory(cfg->in_files[i])) {
+            if (add_batch_dir(&batch, cfg->in_files[i]) < 0)
+                return -1;
+        }
+        else {
+            add_batch_file(&batch, cfg->in_files[i]);
+        }
+    }
+
+    int r = kernel_check_synthetic(&check, cfg->kernel_check, 1);
+    for (int i = 0; i < batch.count && !cfg->do_exit; ++i) {
+        batch_file_t *file = &batch.files[i];
+        if (kernel_check_file(&check, file->path, file->format, file->full_scale) < 0)
+            r = -1;
+    }
+    fprintf(stderr, "%s\n", r < 0 ? "Kernel check failed" : "All kernels match the reference");
+
+    for (int i = 0; i < batch.count; ++i)
+        free(batch.files[i].path);
+    free(batch.files);
+    return r < 0 ? 1 : 0;
+}
+
+/// Take the front-end plan for this CPU and input format from the wisdom file, else time the plans and keep the fastest.
+static void plan_frontend(r_cfg_t *cfg, void *mrbeamCtx, int batch_mode, mrbeam_format_t format, float full_scale,
+        uint32_t block_size)
+{
+    kernel_tune_t tune = {
+            .cfg         = cfg,
+            .setup       = batch_setup,
+            .setup_ctx   = cfg,
+            .format      = format,
+            .full_scale  = full_scale,
+            .block_size  = block_size,
+            .out         = cfg->verbosity ? stderr : NULL,
+            .max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN),
+    };
+    char key[512];
+    if (kernel_tune_key(&tune, key, sizeof(key)) < 0)
+        exit(1);
+
+    kernel_plan_t plan;
+    if (kernel_wisdom_load(cfg->wisdom_file, key, &plan) < 0) {
+        fprintf(stderr, "Planning the front-end for this CPU...\n");
+        if (kernel_tune(&tune, DEFAULT_TUNE_TIME, &plan) < 0)
+            exit(1);
+        if (kernel_wisdom_save(cfg->wisdom_file, key, &plan) == 0)
+            fprintf(stderr, "Kept the plan in %s\n", cfg->wisdom_file);
+    }
+    fprintf(stderr, "Front-end plan: kernel %s, %u byte blocks, %d thread%s, %.1f times real time\n",
+            mrbeam_kernel_name(plan.kernel), plan.block_size, plan.threads, plan.threads > 1 ? "s" : "", plan.speed);
+    if (plan.speed < TUNE_REALTIME)
+        fprintf(stderr, "WARNING: the fastest plan runs at %.1f times real time, less than %g\n", plan.speed, TUNE_REALTIME);
+
+    cfg->kernel         = plan.kernel;
+    cfg->out_block_size = plan.block_size;
+    if (!cfg->threads && !batch_mode)
+        cfg->threads = plan.threads;
+    mrbeam_set_kernel(mrbeamCtx, cfg->kernel);
+}
+
+static int setup_device(r_cfg_t *cfg)
+{
+    int r;
+    int sample_size = 1;
+
+    r = sdr_open(&cfg->dev, &sample_size, cfg->dev_query, cfg->verbosity);
+    if (r < 0)
+        return r;
+
+    double full_scale;
+    mrbeam_format_t format;
+    char const *name = sdr_get_sample_format(cfg->dev, &full_scale);
+    if (!name || parse_format(name, strlen(name), &format) < 0) {
+        fprintf(stderr, "Unsupported sample format %s\n", name ? name : "(none)");
+        r = -1;
+    }
+    else {
+        r = set_input_format(cfg, format, full_scale);
+    }
+    if (r < 0) {
+        sdr_close(cfg->dev);
+        cfg->dev = NULL;
+        return r;
+    }
+
+    /* Set the sample rate */
+    r = sdr_set_sample_rate(cfg->dev, cfg->samp_rate, 1); // always verbose
+    r = sdr_apply_settings(cfg->dev, cfg->settings_str, 1); // always verbose for soapy
+    r = sdr_set_tuner_gain(cfg->dev, cfg->gain_str, 1); // always verbose
+    r = sdr_set_center_freq(cfg->dev, cfg->center_frequency, 1); // always verbose
+
+    if (cfg->ppm_error)
+        r = sdr_set_freq_correction(cfg->dev, cfg->ppm_error, 1); // always verbose
+
+    /* Reset endpoint before we start reading from it (mandatory) */
+    r = sdr_reset(cfg->dev, cfg->verbosity);
+    if (r < 0)
+        fprintf(stderr, "WARNING: Failed to reset buffers.\n");
+    r = sdr_activate(cfg->dev);
+
+    return r;
+}
+
+/// Close and reopen the device after a stall, retrying for a while.
+static int recover_device(r_cfg_t *cfg)
+{
+    cfg->recoveries++;
+    fprintf(stderr, "Reopening device (recovery #%u)...\n", cfg->recoveries);
+
+    sdr_dev_t *dev = cfg->dev;
+    cfg->dev = NULL; // signal handlers must not touch the closed device
+    sdr_deactivate(dev);
+    sdr_close(dev);
+
+    for (int attempt = 0; attempt < DEFAULT_RECOVERY_ATTEMPTS && !cfg->do_exit; ++attempt) {
+        if (attempt)
+            sleep(1);
+        if (setup_device(cfg) >= 0)
+            return 0;
+    }
+    fprintf(stderr, "Device recovery failed, exiting!\n");
+    return -1;
+}
+
+static void print_stats(r_cfg_t *cfg, mrbeam_stats_t const *stats)
+{
+    fprintf(stderr, "Stats: %.1f s of samples, %.4f %% clipped, gain %s dB",
+            (double)stats->samples / cfg->samp_rate,
+            stats->samples ? 50.0 * stats->clipped / stats->samples : 0.0,
+            cfg->gain_str);
+    if (cfg->center_frequency && !cfg->in_filename)
+        fprintf(stderr, ", %.3f MHz, offset %+.0f Hz (%+.1f ppm, %d ppm in tuner)\n",
+                cfg->center_frequency / 1e6, stats->freqOffset, stats->ppm, cfg->ppm_error);
+    else
+        fprintf(stderr, ", offset %+.0f Hz\n", stats->freqOffset);
+    fprintf(stderr, "  input: DC I %+.2f Q %+.2f, I/Q gain %+.2f dB, phase %+.2f deg\n",
+            stats->dc[0], stats->dc[1], stats->iqGain, stats->iqPhase);
+    if (stats->gaps)
+        fprintf(stderr, "  input: %" PRIu64 " gaps, %.3f s of samples lost\n",
+                stats->gaps, (double)stats->lost / cfg->samp_rate);
+    for (int i = 0; i < stats->channels; ++i)
+        fprintf(stderr, "  channel %d: noise floor %.1f dB, drift %+.0f Hz\n",
+                cfg->frequency_index * MRBEAM_CHANNELS + i, stats->noise[i], stats->drift[i]);
+}
+
+static void report_stats(r_cfg_t *cfg)
+{
+    mrbeam_stats_t stats;
+    mrbeam_get_stats(cfg->mrbeam, &stats);
+    print_stats(cfg, &stats);
+}
+
+/// Set up a chunk detector with the options and the plan of the replay detector.
+static void *chunk_setup(void *ctx)
+{
+    r_cfg_t *cfg = ctx;
+    void *mrbeamCtx = mrbeam_setup();
+    configure_detector(cfg, mrbeamCtx);
+
+    float offsets[MRBEAM_CHANNELS];
+    mrbeam_set_channels(mrbeamCtx, offsets, mrbeam_get_channels(cfg->mrbeam, offsets));
+    return mrbeamCtx;
+}
+
+static int replay_chunks(r_cfg_t *cfg, event_out_t *events)
+{
+    chunk_replay_t replay = {
+            .cfg       = cfg,
+            .setup     = chunk_setup,
+            .setup_ctx = cfg,
+            .overlap   = cfg->chunk_overlap,
+            .event_cb  = event_out_push_wait,
+            .event_ctx = events,
+    };
+    replay.path = capture_format(cfg->in_filename, &replay.format);
+    replay.full_scale = (float)capture_full_scale[replay.format];
+    cfg->in_filename = replay.path;
+    if (set_input_format(cfg, replay.format, replay.full_scale) < 0)
+        return -1;
+
+    if (cfg->scan) {
+        FILE *in_file = fopen(replay.path, "rb");
+        unsigned char *buf = malloc(cfg->out_block_size);
+        if (!in_file || !buf) {
+            fprintf(stderr, "Opening file \"%s\" failed!\n", replay.path);
+            free(buf);
+            if (in_file)
+                fclose(in_file);
+            return -1;
+        }
+        scan_file(cfg, in_file, buf);
+        free(buf);
+        fclose(in_file);
+    }
+
+    int jobs = cfg->chunk_jobs < FORK_JOIN_MAX_THREADS ? cfg->chunk_jobs : FORK_JOIN_MAX_THREADS;
+    fprintf(stderr, "Reading samples from file: %s, %d chunks at a time\n", replay.path, jobs);
+    double start = mono_time();
+    int r = chunk_replay_run(&replay, jobs);
+    fprintf(stderr, "Replayed %d chunks in %.2f s, %d again in sequence\n",
+            replay.chunks, mono_time() - start, replay.reruns);
+
+    if (cfg->ppm_auto || cfg->report_stats)
+        print_stats(cfg, &replay.stats);
+    return r;
+}
+
+/// Set the gain chosen by the software gain control, also used to reopen the device.
+static void apply_agc_gain(r_cfg_t *cfg)
+{
+    snprintf(cfg->agc_gain_str, sizeof(cfg->agc_gain_str), "%.1f", agc_gain(cfg->agc) / 10.0);
+    cfg->gain_str = cfg->agc_gain_str;
+    fprintf(stderr, "Gain control: tuner gain %s dB.\n", cfg->gain_str);
+    sdr_set_tuner_gain(cfg->dev, cfg->gain_str, cfg->verbosity);
+}
+
+static int setup_agc(r_cfg_t *cfg, agc_t *agc)
+{
+    int gains[SDR_MAX_GAINS];
+    int gains_count = sdr_get_tuner_gains(cfg->dev, gains, SDR_MAX_GAINS);
+
+    // a gain of 0 selects the tuner AGC, leave it out
+    int n = 0;
+    for (int i = 0; i < gains_count; ++i) {
+        if (gains[i])
+            gains[n++] = gains[i];
+    }
+    if (agc_init(agc, gains, n, (int)(atof(cfg->gain_str) * 10), cfg->samp_rate) < 0) {
+        fprintf(stderr, "WARNING: No tuner gain table, software gain control disabled.\n");
+        return -1;
+    }
+    cfg->agc = agc;
+    apply_agc_gain(cfg);
+    return 0;
+}
+
+static void sdr_read_callback(unsigned char *iq_buf, uint32_t len, sdr_buffer_info_t const *info, void *ctx)
+{
+    r_cfg_t *cfg = ctx;
+
+    watchdog_beat(cfg->wd_read);
+    if (info->flags & SDR_BUFFER_OVERFLOW) {
+        mrbeam_input_gap(cfg->mrbeam, info->lost);
+        cfg->hop_pos += info->lost;
+        if (cfg->verbosity)
+            fprintf(stderr, "Input gap before sample %" PRIu64 ", %" PRIu64 " samples lost\n",
+                    info->sample_index, info->lost);
+    }
+    if (cfg->scan && scan_input(cfg, iq_buf, len))
+        return; // no channel plan yet
+
+    // the device's clock beats the arrival time, which carries the USB and scheduling latency
+    if (info->flags & SDR_BUFFER_HW_TIME)
+        mrbeam_set_anchor(cfg->mrbeam, mrbeam_position(cfg->mrbeam), info->time_ns * 1e-9);
+
+    watchdog_busy(cfg->wd_dsp);
+    sdr_callback(iq_buf, len, cfg->mrbeam);
+    watchdog_beat(cfg->wd_dsp);
+    watchdog_idle(cfg->wd_dsp);
+
+    if (cfg->stats_now || (cfg->report_stats && time(NULL) >= cfg->stats_time)) {
+        cfg->stats_now  = 0;
+        cfg->stats_time = time(NULL) + cfg->stats_interval;
+        report_stats(cfg);
+    }
+
+    // gain and frequency corrections are applied between async reads, like retunes
+    if ((cfg->agc || cfg->ppm_auto) && !cfg->do_exit_async) {
+        mrbeam_stats_t stats;
+        mrbeam_get_stats(cfg->mrbeam, &stats);
+        if (cfg->agc && agc_update(cfg->agc, &stats))
+            cfg->gain_changed = 1;
+        if (cfg->ppm_auto && fabs(stats.ppm) >= 1 && stats.samples >= cfg->ppm_next) {
+            cfg->ppm_step = (int)lround(stats.ppm);
+            cfg->ppm_next = stats.samples + (uint64_t)DEFAULT_PPM_HOLD * cfg->samp_rate;
+        }
+        if (cfg->gain_changed || cfg->ppm_step) {
+            cfg->do_exit_async = 1;
+            sdr_stop(cfg->dev);
+        }
+    }
+
+    // dwell is counted in samples, like all other detector timing
+    cfg->hop_pos += len / (2 * cfg->sample_size);
+    if (cfg->frequencies > 1 && !cfg->do_exit_async && cfg->hop_pos >= cfg->hop_samples) {
+        cfg->do_exit_async = 1;
+        sdr_stop(cfg->dev);
+    }
+}
+
+/// Runs on the watchdog thread: recover first, then give up.
+static void stall_handler(watchdog_stage_t *stage, double stalled_secs, int reports, void *ctx)
+{
+    r_cfg_t *cfg = ctx;
+
+    if (reports >= 3) {
+        fprintf(stderr, "%s stalled for %.1f s, aborting!\n", stage->name, stalled_secs);
+        exit(1);
+    }
+    if (cfg->do_exit) {
+        // shutting down already, give it a push and time to flush the events
+        fprintf(stderr, "WARNING: %s stalled for %.1f s while exiting.\n", stage->name, stalled_secs);
+        sdr_stop(cfg->dev);
+    }
+    else if (reports == 1) {
+        fprintf(stderr, "WARNING: %s stalled for %.1f s, restarting device.\n", stage->name, stalled_secs);
+        __atomic_store_n(&cfg->recover_device, 1, __ATOMIC_RELEASE);
+        sdr_stop(cfg->dev);
+    }
+    else {
+        fprintf(stderr, "%s stalled for %.1f s, exiting!\n", stage->name, stalled_secs);
+        __atomic_store_n(&cfg->do_exit, 1, __ATOMIC_RELEASE);
+        sdr_stop(cfg->dev);
+    }
+}
+
 int main(int argc, char **argv) {
     struct sigaction sigact;
     FILE *in_file;
@@ -204,28 +1422,116 @@ int main(int argc, char **argv) {
     unsigned i;
     r_cfg_t *cfg = &g_cfg;
 
-    void *mrbeamCtx = mrbeam_setup ();
-
-    cfg->out_block_size  = DEFAULT_BUF_LENGTH;
     cfg->samp_rate       = 948000;
-    cfg->gain_str        = "13";
+    cfg->sample_size     = 1;
+    cfg->gain_str        = DEFAULT_GAIN;
     cfg->conversion_mode = CONVERT_NATIVE;
     cfg->dev_query = NULL;
     cfg->verbosity = 0;
     cfg->center_frequency = DEFAULT_FREQUENCY;
+    cfg->level_limit = DEFAULT_LEVEL_LIMIT;
+    cfg->min_snr     = DEFAULT_MIN_SNR;
+    cfg->iq_correction = 1;
+    cfg->early_confidence = DEFAULT_EARLY_CONFIDENCE;
 
     parse_conf_args(cfg, argc, argv);
+    // 0 unless given with -b, a plan keeps it
+    uint32_t block_size = cfg->out_block_size;
+    if (!cfg->out_block_size)
+        cfg->out_block_size = DEFAULT_BUF_LENGTH;
+
+    if (cfg->frequencies == 0) {
+        cfg->frequency[0] = DEFAULT_FREQUENCY;
+        cfg->frequencies  = 1;
+    }
+    if (cfg->hop_times == 0) {
+        cfg->hop_time[0] = DEFAULT_HOP_TIME;
+        cfg->hop_times   = 1;
+    }
+    cfg->center_frequency = cfg->frequency[0];
 
     setbuf(stdout, NULL);
     setbuf(stderr, NULL);
 
     fprintf (stderr, "dvb rtl gain: %s\n", cfg->gain_str);
 
-    // Normal case, no test data, no in files
-    int sample_size = 1;
-    r = sdr_open(& cfg->dev, & sample_size, cfg->dev_query, cfg->verbosity);
-    if (r < 0) {
+    event_fmt_t fmt;
+    event_fmt_init(&fmt, cfg->output_format, cfg);
+    event_out_t *events = event_out_create(&fmt, cfg->verbosity);
+    if (!events)
+        exit(1);
+    for (int n = 0; n < cfg->outputs; ++n) {
+        if (event_out_add_sink(events, cfg->output_spec[n]) < 0)
+            exit(1);
+    }
+    if (event_out_start(events) < 0)
+        exit(1);
+
+    if (cfg->early_confidence <= 0 || cfg->early_confidence >= 1) {
+        fprintf(stderr, "Early detection confidence must be between 0 and 1\n");
+        exit(1);
+    }
+    void *mrbeamCtx = mrbeam_setup ();
+    mrbeam_set_event_cb(mrbeamCtx, event_out_push, events);
+    configure_detector(cfg, mrbeamCtx);
+    // in a batch -j counts the captures replayed at a time
+    int batch_mode = cfg->in_files_count > 1 || (cfg->in_filename && is_directory(cfg->in_filename))
+            || (cfg->in_filename && cfg->eval_tolerance);
+    // a receiver's format is known once it is open
+    if (cfg->wisdom_file && cfg->in_filename) {
+        mrbeam_format_t format;
+        capture_format(cfg->in_filename, &format);
+        plan_frontend(cfg, mrbeamCtx, batch_mode, format, (float)capture_full_scale[format], block_size);
+    }
+    if (!batch_mode && mrbeam_set_threads(mrbeamCtx, cfg->threads))
+        exit(1);
+    cfg->mrbeam     = mrbeamCtx;
+    cfg->stats_time = time(NULL) + cfg->stats_interval;
+    cfg->ppm_next = (uint64_t)DEFAULT_PPM_HOLD * cfg->samp_rate; // let the estimate settle first
+    if (cfg->shm_name && mrbeam_publish_shm (mrbeamCtx, cfg->shm_name))
+        exit(1);
+    if (cfg->channel_plan && parse_channel_plan(cfg, cfg->channel_plan) < 0)
         exit(1);
+    if (cfg->scan_time) {
+        cfg->scan = scan_create(cfg->samp_rate, cfg->scan_time);
+        if (!cfg->scan)
+            exit(1);
+        cfg->scan_active  = 1;
+        cfg->scan_startup = 1;
+        fprintf(stderr, "Scanning %d s of input for channels...\n", cfg->scan_time);
+    }
+    if (cfg->cache_dir) {
+        // cached outputs were mixed at fixed channel offsets
+        if (!cfg->in_filename || batch_mode || cfg->chunk_jobs > 1 || !strcmp(cfg->in_filename, "-")) {
+            fprintf(stderr, "A front-end cache needs a single -r capture, not stdin or -P\n");
+            exit(1);
+        }
+        if (cfg->ppm_auto || cfg->afc_limit) {
+            fprintf(stderr, "A front-end cache does not go with -p auto or -Y afc\n");
+            exit(1);
+        }
+    }
+    sweep_t sweep = {0};
+    if (cfg->sweep_spec) {
+        if (!cfg->in_filename || batch_mode) {
+            fprintf(stderr, "A sweep needs a single -r capture\n");
+            exit(1);
+        }
+        mrbeam_params_t base;
+        mrbeam_get_params(mrbeamCtx, &base);
+        if (sweep_parse(&sweep, cfg->sweep_spec, &base) < 0)
+            exit(1);
+        mrbeam_params_t *sets = malloc(sweep.count * sizeof(*sets));
+        if (!sets)
+            FATAL_MALLOC("main()");
+        for (int n = 0; n < sweep.count; ++n)
+            sets[n] = sweep.sets[n].params;
+        if (mrbeam_set_sweep(mrbeamCtx, sets, sweep.count, sweep_event, &sweep)) {
+            fprintf(stderr, "Invalid sweep settings\n");
+            exit(1);
+        }
+        free(sets);
+        fprintf(stderr, "Sweeping %d parameter sets\n", sweep.count);
     }
 
     sigact.sa_handler = sighandler;
@@ -237,46 +1543,126 @@ int main(int argc, char **argv) {
     sigaction(SIGPIPE, &sigact, NULL);
     sigaction(SIGUSR1, &sigact, NULL);
     sigaction(SIGINFO, &sigact, NULL);
-    /* Set the sample rate */
-    r = sdr_set_sample_rate(cfg->dev, cfg->samp_rate, 1); // always verbose
-    r = sdr_apply_settings(cfg->dev, cfg->settings_str, 1); // always verbose for soapy
-    r = sdr_set_tuner_gain(cfg->dev, cfg->gain_str, 1); // always verbose
-    r = sdr_set_center_freq(cfg->dev, cfg->center_frequency, 1); // always verbose
 
-    if (cfg->ppm_error)
-        r = sdr_set_freq_correction(cfg->dev, cfg->ppm_error, 1); // always verbose
+    if (cfg->kernel_check) {
+        r = check_kernels(cfg);
+        scan_free(cfg->scan);
+        mrbeam_free(mrbeamCtx);
+        event_out_free(events);
+        free(cfg->in_files);
+        return r;
+    }
 
-    /* Reset endpoint before we start reading from it (mandatory) */
-    r = sdr_reset(cfg->dev, cfg->verbosity);
-    if (r < 0)
-        fprintf(stderr, "WARNING: Failed to reset buffers.\n");
-    r = sdr_activate(cfg->dev);
+    if (batch_mode) {
+        r = replay_batch(cfg);
+        scan_free(cfg->scan);
+        mrbeam_free(mrbeamCtx);
+        event_out_free(events);
+        free(cfg->in_files);
+        return r >= 0 ? r : -r;
+    }
 
-    uint32_t samp_rate = cfg->samp_rate;
-    while (!cfg->do_exit) {
-        time(&cfg->hop_start_time);
+    // a sweep follows the one detector through the capture
+    if (cfg->in_filename && cfg->chunk_jobs > 1 && strcmp(cfg->in_filename, "-") && !sweep.count) {
+        r = replay_chunks(cfg, events);
+        scan_free(cfg->scan);
+        mrbeam_free(mrbeamCtx);
+        event_out_free(events);
+        return r >= 0 ? r : -r;
+    }
+
+    if (cfg->in_filename) {
+        r = replay_file(cfg, mrbeamCtx);
+        if (cfg->ppm_auto || cfg->report_stats)
+            report_stats(cfg);
+        scan_free(cfg->scan);
+        mrbeam_free(mrbeamCtx);
+        event_out_free(events);
+        if (sweep.count) {
+            sweep_report(&sweep, stdout, &fmt);
+            sweep_free(&sweep);
+        }
+        return r >= 0 ? r : -r;
+    }
+
+    // Normal case, no test data, no in files
+    r = setup_device(cfg);
+    if (r < 0) {
+        exit(1);
+    }
+    if (cfg->wisdom_file) {
+        plan_frontend(cfg, mrbeamCtx, 0, cfg->input_format, cfg->full_scale, block_size);
+        if (mrbeam_set_threads(mrbeamCtx, cfg->threads))
+            exit(1);
+    }
+    agc_t agc;
+    if (cfg->agc_mode)
+        setup_agc(cfg, &agc);
+
+    watchdog_t *watchdog = watchdog_create(DEFAULT_STALL_TIMEOUT, stall_handler, cfg);
+    if (!watchdog)
+        exit(1);
+    cfg->wd_read = watchdog_add_stage(watchdog, "async read");
+    cfg->wd_dsp  = watchdog_add_stage(watchdog, "sample processing");
+    if (watchdog_start(watchdog) < 0)
+        exit(1);
 
-        /* Set the cfg->frequency */
-        //cfg->center_frequency = cfg->frequency[cfg->frequency_index];
-        //r = sdr_set_center_freq(cfg->dev, cfg->center_frequency, 1); // always verbose
+    if (mrbeam_set_hops(mrbeamCtx, cfg->frequencies))
+        exit(1);
+    int hop = 1;
+    while (!cfg->do_exit) {
+        if (hop) {
+            time(&cfg->hop_start_time);
 
-        //if (samp_rate != cfg->samp_rate) {
-        //    r = sdr_set_sample_rate(cfg->dev, cfg->samp_rate, 1); // always verbose
-        //    samp_rate = cfg->samp_rate;
-        //}
+            /* Set the cfg->frequency */
+            if (cfg->center_frequency != cfg->frequency[cfg->frequency_index]) {
+                cfg->center_frequency = cfg->frequency[cfg->frequency_index];
+                r = sdr_set_center_freq(cfg->dev, cfg->center_frequency, 1); // always verbose
+            }
+            int hop_time = cfg->hop_time[cfg->frequency_index < cfg->hop_times ? cfg->frequency_index : cfg->hop_times - 1];
+            cfg->hop_samples = (uint64_t)hop_time * cfg->samp_rate;
+            cfg->hop_pos     = 0;
+        }
+        mrbeam_retune(mrbeamCtx, cfg->frequency_index, cfg->center_frequency,
+                (uint32_t)((uint64_t)cfg->samp_rate * DEFAULT_SETTLE_TIME / 1000));
 
-        signal(SIGALRM, sighandler);
-        alarm(3); // require callback to run every 3 second, abort otherwise
-        r = sdr_start(cfg->dev, sdr_callback, (void *)mrbeamCtx,
+        watchdog_busy(cfg->wd_read); // require callback to run every few seconds
+        r = sdr_start(cfg->dev, sdr_read_callback, (void *)cfg,
                 DEFAULT_ASYNC_BUF_NUMBER, cfg->out_block_size);
+        watchdog_idle(cfg->wd_read);
+        if (__atomic_exchange_n(&cfg->recover_device, 0, __ATOMIC_ACQ_REL) && !cfg->do_exit) {
+            r = recover_device(cfg);
+            if (r < 0)
+                break;
+            continue;
+        }
         if (r < 0) {
             fprintf(stderr, "WARNING: async read failed (%i).\n", r);
             break;
         }
-        alarm(0); // cancel the watchdog timer
         cfg->do_exit_async = 0;
-        //cfg->frequency_index = (cfg->frequency_index + 1) % cfg->frequencies;
+
+        // a correction alone keeps the current frequency
+        hop = !(cfg->gain_changed || cfg->ppm_step) || cfg->hop_pos >= cfg->hop_samples;
+        if (cfg->gain_changed) {
+            cfg->gain_changed = 0;
+            apply_agc_gain(cfg);
+        }
+        if (cfg->ppm_step) {
+            // whole ppm go to the tuner, the mixers keep the remainder
+            cfg->ppm_error += cfg->ppm_step;
+            sdr_set_freq_correction(cfg->dev, cfg->ppm_error, 1); // always verbose
+            mrbeam_adjust_ppm(mrbeamCtx, cfg->ppm_step);
+            cfg->ppm_step = 0;
+        }
+        if (hop)
+            cfg->frequency_index = (cfg->frequency_index + 1) % cfg->frequencies;
     }
 
+    watchdog_free(watchdog);
+    scan_free(cfg->scan);
+    mrbeam_free(mrbeamCtx);
+    event_out_free(events);
+
     return r >= 0 ? r : -r;
 }
@@ -0,0 +1,65 @@
+/** @file
+    Sample-clock timestamps anchored to the system clocks.
+*/
+
+#include "sample_clock.h"
+
+#include <string.h>
+#include <time.h>
+
+static double timespec_secs(struct timespec const *ts)
+{
+    return (double)ts->tv_sec + ts->tv_nsec * 1e-9;
+}
+
+double mono_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_secs(&ts);
+}
+
+void sample_clock_init(sample_clock_t *clk, uint32_t samp_rate, int live)
+{
+    memset(clk, 0, sizeof(*clk));
+    clk->samp_rate = samp_rate;
+    clk->live      = live;
+    clk->interval  = samp_rate; // one second
+}
+
+void sample_clock_anchor(sample_clock_t *clk, uint64_t sample, double real_time)
+{
+    clk->anchor_sample = sample;
+    clk->anchor_real   = real_time;
+    clk->anchor_mono   = mono_time();
+    clk->anchored      = 1;
+    clk->external      = 1;
+}
+
+void sample_clock_arrival(sample_clock_t *clk, uint64_t sample_end)
+{
+    if (clk->external || (clk->anchored && (!clk->live || sample_end - clk->anchor_sample < clk->interval)))
+        return;
+
+    struct timespec real, mono;
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+
+    clk->anchor_sample = sample_end;
+    clk->anchor_real   = timespec_secs(&real);
+    clk->anchor_mono   = timespec_secs(&mono);
+    clk->anchored      = 1;
+}
+
+double sample_clock_time(sample_clock_t const *clk, uint64_t sample)
+{
+    // signed, events may precede the anchor within the buffer
+    double dt = ((double)sample - (double)clk->anchor_sample) / clk->samp_rate;
+    return clk->anchor_real + dt;
+}
+
+double sample_clock_mono(sample_clock_t const *clk, uint64_t sample)
+{
+    double dt = ((double)sample - (double)clk->anchor_sample) / clk->samp_rate;
+    return clk->anchor_mono + dt;
+}
@@ -0,0 +1,247 @@
+/** @file
+    Spectrum scan that finds the channels of blinking lights.
+*/
+
+#include "scan.h"
+#include "fatal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+struct scan {
+    uint32_t samp_rate;
+    unsigned frames_needed;
+    unsigned frames;
+    unsigned fill;               ///< samples in the current frame
+    mrbeam_format_t format;
+    float scale;                 ///< CS16 and CF32 input to full scale units
+    float in[SCAN_FFT_SIZE][2];
+    float window[SCAN_FFT_SIZE];
+    float twiddle[SCAN_FFT_SIZE / 2][2];
+    unsigned bitrev[SCAN_FFT_SIZE];
+    double blink_step;           ///< blink phase advance per frame
+    unsigned window_frames;      ///< frames per coherent blink window
+    unsigned window_fill;        ///< frames in the current window
+    double power[SCAN_FFT_SIZE]; ///< summed bin power
+    double blink[SCAN_FFT_SIZE][2]; ///< bin power times the blink phasor, current window
+    double mod[SCAN_FFT_SIZE];   ///< summed magnitudes of the finished windows
+    double mod_power[SCAN_FFT_SIZE]; ///< summed bin power of the finished windows
+};
+
+scan_t *scan_create(uint32_t samp_rate, double secs)
+{
+    scan_t *scan = calloc(1, sizeof(*scan));
+    if (!scan) {
+        WARN_CALLOC("scan_create()");
+        return NULL;
+    }
+    scan->samp_rate     = samp_rate;
+    scan->format        = MRBEAM_CU8;
+    scan->frames_needed = (unsigned)(secs * samp_rate / SCAN_FFT_SIZE);
+    scan->blink_step    = 2 * M_PI * SCAN_BLINK_RATE * SCAN_FFT_SIZE / samp_rate;
+    scan->window_frames = (unsigned)lround(SCAN_BLINK_PERIODS * samp_rate / (SCAN_BLINK_RATE * SCAN_FFT_SIZE));
+    if (scan->window_frames < 1)
+        scan->window_frames = 1;
+
+    int bits = 0;
+    while ((1 << bits) < SCAN_FFT_SIZE)
+        bits++;
+    for (unsigned i = 0; i < SCAN_FFT_SIZE; ++i) {
+        unsigned r = 0;
+        for (int b = 0; b < bits; ++b)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        scan->bitrev[i] = r;
+        scan->window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / SCAN_FFT_SIZE); // Hann
+    }
+    for (unsigned i = 0; i < SCAN_FFT_SIZE / 2; ++i) {
+        scan->twiddle[i][0] = cosf(-2 * M_PI * i / SCAN_FFT_SIZE);
+        scan->twiddle[i][1] = sinf(-2 * M_PI * i / SCAN_FFT_SIZE);
+    }
+    return scan;
+}
+
+/// In-place radix-2 FFT of the bit reversed input.
+static void scan_fft(scan_t *scan, float (*x)[2])
+{
+    for (unsigned len = 2; len <= SCAN_FFT_SIZE; len <<= 1) {
+        unsigned half   = len / 2;
+        unsigned stride = SCAN_FFT_SIZE / len;
+        for (unsigned i = 0; i < SCAN_FFT_SIZE; i += len) {
+            for (unsigned j = 0; j < half; ++j) {
+                float const *w = scan->twiddle[j * stride];
+                float *a = x[i + j];
+                float *b = x[i + j + half];
+                float t0 = b[0] * w[0] - b[1] * w[1];
+                float t1 = b[0] * w[1] + b[1] * w[0];
+                b[0] = a[0] - t0;
+                b[1] = a[1] - t1;
+                a[0] += t0;
+                a[1] += t1;
+            }
+        }
+    }
+}
+
+static void scan_frame(scan_t *scan)
+{
+    float x[SCAN_FFT_SIZE][2];
+    for (unsigned i = 0; i < SCAN_FFT_SIZE; ++i) {
+        unsigned r = scan->bitrev[i];
+        x[r][0] = scan->in[i][0] * scan->window[i];
+        x[r][1] = scan->in[i][1] * scan->window[i];
+    }
+    scan_fft(scan, x);
+
+    double phase = scan->blink_step * scan->window_fill;
+    double c = cos(phase);
+    double s = -sin(phase);
+    for (unsigned k = 0; k < SCAN_FFT_SIZE; ++k) {
+        double p = (double)x[k][0] * x[k][0] + (double)x[k][1] * x[k][1];
+        scan->power[k] += p;
+        scan->blink[k][0] += p * c;
+        scan->blink[k][1] += p * s;
+    }
+    scan->frames++;
+
+    if (++scan->window_fill < scan->window_frames)
+        return;
+    // the window is done, its blink component adds in magnitude only
+    for (unsigned k = 0; k < SCAN_FFT_SIZE; ++k) {
+        scan->mod[k] += hypot(scan->blink[k][0], scan->blink[k][1]);
+        scan->blink[k][0] = 0;
+        scan->blink[k][1] = 0;
+    }
+    memcpy(scan->mod_power, scan->power, sizeof(scan->mod_power));
+    scan->window_fill = 0;
+}
+
+void scan_set_format(scan_t *scan, mrbeam_format_t format, float full_scale)
+{
+    scan->format = format;
+    scan->scale  = 1.0f / full_scale;
+}
+
+static void scan_sample(scan_t *scan, float i, float q)
+{
+    scan->in[scan->fill][0] = i;
+    scan->in[scan->fill][1] = q;
+    if (++scan->fill == SCAN_FFT_SIZE) {
+        scan->fill = 0;
+        scan_frame(scan);
+    }
+}
+
+int scan_feed(scan_t *scan, unsigned char const *iq_buf, uint32_t len)
+{
+    uint32_t samples = len / 2 / mrbeam_sample_size(scan->format);
+    int8_t const *cs8   = (int8_t const *)iq_buf;
+    int16_t const *cs16 = (int16_t const *)iq_buf;
+    float const *cf32   = (float const *)iq_buf;
+
+    for (uint32_t k = 0; k < samples && scan->frames < scan->frames_needed; ++k) {
+        switch (scan->format) {
+        case MRBEAM_CU8:
+            scan_sample(scan, (iq_buf[2 * k] - 127.4f) * (1.0f / 128.0f),
+                    (iq_buf[2 * k + 1] - 127.4f) * (1.0f / 128.0f));
+            break;
+        case MRBEAM_CS8:
+            scan_sample(scan, cs8[2 * k] * (1.0f / 128.0f), cs8[2 * k + 1] * (1.0f / 128.0f));
+            break;
+        case MRBEAM_CS16:
+            scan_sample(scan, cs16[2 * k] * scan->scale, cs16[2 * k + 1] * scan->scale);
+            break;
+        case MRBEAM_CF32:
+            scan_sample(scan, cf32[2 * k] * scan->scale, cf32[2 * k + 1] * scan->scale);
+            break;
+        }
+    }
+    return scan->frames >= scan->frames_needed;
+}
+
+static int cmp_double(void const *a, void const *b)
+{
+    double x = *(double const *)a;
+    double y = *(double const *)b;
+    return (x > y) - (x < y);
+}
+
+static double bin_freq(scan_t const *scan, double k)
+{
+    if (k >= SCAN_FFT_SIZE / 2)
+        k -= SCAN_FFT_SIZE;
+    return k * scan->samp_rate / SCAN_FFT_SIZE;
+}
+
+int scan_result(scan_t *scan, float *offsets, int max_channels)
+{
+    if (!scan->frames || !scan->mod_power[0])
+        return 0;
+
+    double sorted[SCAN_FFT_SIZE];
+    memcpy(sorted, scan->power, sizeof(sorted));
+    qsort(sorted, SCAN_FFT_SIZE, sizeof(*sorted), cmp_double);
+    double floor = sorted[SCAN_FFT_SIZE / 2];
+    double min_power = floor * pow(10.0, SCAN_MIN_SNR / 10.0);
+
+    // local maxima that look like a light, strongest first
+    int cand[SCAN_FFT_SIZE];
+    int num_cand = 0;
+    for (int k = 0; k < SCAN_FFT_SIZE; ++k) {
+        double p = scan->power[k];
+        double prev = scan->power[(k + SCAN_FFT_SIZE - 1) % SCAN_FFT_SIZE];
+        double next = scan->power[(k + 1) % SCAN_FFT_SIZE];
+        double mod = scan->mod[k] / scan->mod_power[k];
+        // stay clear of the band edges, the tuner filters roll off there
+        if (fabs(bin_freq(scan, k)) > 0.4 * scan->samp_rate)
+            continue;
+        if (p < min_power || p < prev || p < next || mod < SCAN_MIN_MOD)
+            continue;
+        int j = num_cand++;
+        while (j > 0 && scan->power[cand[j - 1]] < p) {
+            cand[j] = cand[j - 1];
+            j--;
+        }
+        cand[j] = k;
+    }
+
+    int found = 0;
+    for (int c = 0; c < num_cand && found < max_channels; ++c) {
+        int k = cand[c];
+        // parabolic interpolation of the peak on the dB scale
+        double a = 10 * log10(scan->power[(k + SCAN_FFT_SIZE - 1) % SCAN_FFT_SIZE]);
+        double b = 10 * log10(scan->power[k]);
+        double d = 10 * log10(scan->power[(k + 1) % SCAN_FFT_SIZE]);
+        double den = a - 2 * b + d;
+        double delta = den < 0 ? 0.5 * (a - d) / den : 0;
+        float f = (float)bin_freq(scan, k + delta);
+
+        int near = 0;
+        for (int n = 0; n < found; ++n)
+            near |= fabsf(offsets[n] - f) < SCAN_MIN_SPACING;
+        if (!near)
+            offsets[found++] = f;
+    }
+    return found;
+}
+
+void scan_reset(scan_t *scan)
+{
+    scan->frames      = 0;
+    scan->fill        = 0;
+    scan->window_fill = 0;
+    memset(scan->power, 0, sizeof(scan->power));
+    memset(scan->blink, 0, sizeof(scan->blink));
+    memset(scan->mod, 0, sizeof(scan->mod));
+    memset(scan->mod_power, 0, sizeof(scan->mod_power));
+}
+
+void scan_free(scan_t *scan)
+{
+    free(scan);
+}
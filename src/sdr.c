@@ -16,6 +16,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
 #include "sdr.h"
 #include "r_util.h"
 #include "optparse.h"
@@ -55,6 +58,7 @@
 
 struct sdr_dev {
     SOCKET rtl_tcp;
+    unsigned rtl_tcp_tuner;
 
 #ifdef SOAPYSDR
     SoapySDRDevice *soapy_dev;
@@ -71,8 +75,56 @@ struct sdr_dev {
     size_t buffer_size;
 
     int sample_size;
+    char const *sample_format;
+    uint32_t sample_rate;
+
+    sdr_buffer_info_t info;   ///< metadata of the next buffer
+    int64_t next_time_ns;     ///< expected hardware time of the next buffer, 0 if unknown
+    sdr_read_cb_t read_cb;
+    void *read_ctx;
 };
 
+/// Hand a buffer with its metadata on, then advance the metadata.
+static void sdr_deliver(sdr_dev_t *dev, unsigned char *buf, uint32_t len)
+{
+    sdr_buffer_info_t *info = &dev->info;
+
+    if (!(info->flags & SDR_BUFFER_HW_TIME)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        info->time_ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    dev->read_cb(buf, len, info, dev->read_ctx);
+
+    uint32_t samples = len / 2 / dev->sample_size;
+    if ((info->flags & SDR_BUFFER_HW_TIME) && dev->sample_rate)
+        dev->next_time_ns = info->time_ns + llround(samples * 1e9 / dev->sample_rate);
+    info->sample_index += samples;
+    info->lost  = 0;
+    info->flags = 0;
+}
+
+#ifdef SOAPYSDR
+/// Note the hardware time of the next buffer, a jump ahead of the samples read is a gap.
+static void sdr_hw_time(sdr_dev_t *dev, int64_t time_ns)
+{
+    sdr_buffer_info_t *info = &dev->info;
+
+    if (dev->next_time_ns && dev->sample_rate) {
+        int64_t gap_ns = time_ns - dev->next_time_ns;
+        uint64_t lost = gap_ns > 0 ? (uint64_t)llround(gap_ns * 1e-9 * dev->sample_rate) : 0;
+        if (lost) {
+            info->flags |= SDR_BUFFER_OVERFLOW;
+            info->lost += lost;
+            info->sample_index += lost;
+        }
+    }
+    info->flags |= SDR_BUFFER_HW_TIME;
+    info->time_ns = time_ns;
+}
+#endif
+
 /* rtl_tcp helpers */
 
 #pragma pack(push, 1)
@@ -88,7 +140,13 @@ static int rtltcp_open(sdr_dev_t **out_dev, int *sample_size, char *dev_query, i
     char *host = "localhost";
     char *port = "1234";
 
-    char *param = arg_param(dev_query);
+    // parse a copy, the query is needed again to reopen the device
+    char *query = strdup(dev_query);
+    if (!query) {
+        WARN_STRDUP("rtltcp_open()");
+        return -1;
+    }
+    char *param = arg_param(query);
     hostport_param(param, &host, &port);
 
     fprintf(stderr, "rtl_tcp input from %s port %s\n", host, port);
@@ -106,6 +164,7 @@ static int rtltcp_open(sdr_dev_t **out_dev, int *sample_size, char *dev_query, i
     ret = getaddrinfo(host, port, &hints, &res0);
     if (ret) {
         fprintf(stderr, "%s\n", gai_strerror(ret));
+        free(query);
         return -1;
     }
     sock = INVALID_SOCKET;
@@ -124,6 +183,7 @@ static int rtltcp_open(sdr_dev_t **out_dev, int *sample_size, char *dev_query, i
     freeaddrinfo(res0);
     if (sock == INVALID_SOCKET) {
         perror("socket");
+        free(query);
         return -1;
     }
 
@@ -132,15 +192,25 @@ static int rtltcp_open(sdr_dev_t **out_dev, int *sample_size, char *dev_query, i
     //if (ret < 0)
     //    fprintf(stderr, "rtl_tcp TCP_NODELAY failed\n");
 
+#ifndef _WIN32
+    // wake up the read loop periodically so sdr_stop() is noticed on a silent connection
+    struct timeval recv_timeout = {.tv_sec = 1};
+    ret = setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout));
+    if (ret < 0)
+        fprintf(stderr, "rtl_tcp SO_RCVTIMEO failed\n");
+#endif
+
     struct rtl_tcp_info info;
     ret = recv(sock, (char *)&info, sizeof (info), 0);
     if (ret != 12) {
         fprintf(stderr, "Bad rtl_tcp header (%d)\n", ret);
+        free(query);
         return -1;
     }
     if (strncmp(info.magic, "RTL0", 4)) {
         info.tuner_number = 0; // terminate magic
         fprintf(stderr, "Bad rtl_tcp header magic \"%s\"\n", info.magic);
+        free(query);
         return -1;
     }
 
@@ -151,6 +221,7 @@ static int rtltcp_open(sdr_dev_t **out_dev, int *sample_size, char *dev_query, i
     char const *tuner_name = tuner_number > sizeof (tuner_names) ? "Invalid" : tuner_names[tuner_number];
 
     fprintf(stderr, "rtl_tcp connected to %s:%s (Tuner: %s)\n", host, port, tuner_name);
+    free(query);
 
     sdr_dev_t *dev = calloc(1, sizeof(sdr_dev_t));
     if (!dev) {
@@ -159,7 +230,9 @@ static int rtltcp_open(sdr_dev_t **out_dev, int *sample_size, char *dev_query, i
     }
 
     dev->rtl_tcp = sock;
+    dev->rtl_tcp_tuner = tuner_number;
     dev->sample_size = sizeof(uint8_t); // CU8
+    dev->sample_format = "CU8";
     *sample_size = sizeof(uint8_t); // CU8
 
     *out_dev = dev;
@@ -183,7 +256,7 @@ static int rtltcp_close(SOCKET sock)
     return 0;
 }
 
-static int rtltcp_read_loop(sdr_dev_t *dev, sdr_read_cb_t cb, void *ctx, uint32_t buf_num, uint32_t buf_len)
+static int rtltcp_read_loop(sdr_dev_t *dev, uint32_t buf_num, uint32_t buf_len)
 {
     if (dev->buffer_size != buf_len) {
         free(dev->buffer);
@@ -199,27 +272,42 @@ static int rtltcp_read_loop(sdr_dev_t *dev, sdr_read_cb_t cb, void *ctx, uint32_
     dev->running = 1;
     do {
         unsigned n_read = 0;
-        int r;
+        int r = 0;
 
-        do {
+        // fill the whole buffer, a receive timeout only checks if we are still running
+        while (n_read < buf_len && dev->running) {
             r = recv(dev->rtl_tcp, &buffer[n_read], buf_len - n_read, MSG_WAITALL);
+#ifndef _WIN32
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                continue;
+#endif
             if (r <= 0)
                 break;
             n_read += r;
             //fprintf(stderr, "readStream ret=%d (of %u)\n", r, n_read);
-        } while (n_read < buf_len);
+        }
         //fprintf(stderr, "readStream ret=%d (read %u)\n", r, n_read);
 
         if (r < 0) {
             fprintf(stderr, "WARNING: sync read failed. %d\n", r);
         }
-        if (n_read == 0) {
-            perror("rtl_tcp");
+        int closed = r <= 0 && n_read < buf_len && dev->running;
+        if (closed) {
+            if (r < 0)
+                perror("rtl_tcp");
+            else
+                fprintf(stderr, "rtl_tcp: the server closed the connection\n");
             dev->running = 0;
         }
 
+        // a short read at the end of the stream may split an I/Q pair
+        n_read -= n_read % (2 * dev->sample_size);
         if (n_read > 0) // prevent a crash in callback
-            cb((unsigned char *)buffer, n_read, ctx);
+            sdr_deliver(dev, buffer, n_read);
+
+        // the caller would start reading a dead connection again
+        if (closed)
+            return -1;
 
     } while (dev->running);
 
@@ -323,6 +411,7 @@ static int sdr_open_rtl(sdr_dev_t **out_dev, int *sample_size, char *dev_query,
                 fprintf(stderr, "Using device %u: %s\n",
                         i, rtlsdr_get_device_name(i));
             dev->sample_size = sizeof(uint8_t); // CU8
+            dev->sample_format = "CU8";
             *sample_size = sizeof(uint8_t); // CU8
             break;
         }
@@ -340,26 +429,15 @@ static int sdr_open_rtl(sdr_dev_t **out_dev, int *sample_size, char *dev_query,
 
 static int rtlsdr_find_tuner_gain(sdr_dev_t *dev, int centigain, int verbose)
 {
-    int r = -1;
+    int gains[SDR_MAX_GAINS];
 
     /* Get allowed gains */
-    int gains_count = rtlsdr_get_tuner_gains(dev->rtlsdr_dev, NULL);
-    if (gains_count < 0) {
-        if (verbose)
-            fprintf(stderr, "Unable to get exact gains\n");
-        return centigain;
-    }
+    int gains_count = sdr_get_tuner_gains(dev, gains, SDR_MAX_GAINS);
     if (gains_count < 1) {
         if (verbose)
-            fprintf(stderr, "No exact gains\n");
+            fprintf(stderr, "Unable to get exact gains\n");
         return centigain;
     }
-    int *gains = calloc(gains_count, sizeof(int));
-    if (!gains) {
-        WARN_CALLOC("rtlsdr_find_tuner_gain()");
-        return centigain; // NOTE: just aborts on alloc failure.
-    }
-    r = rtlsdr_get_tuner_gains(dev->rtlsdr_dev, gains);
 
     /* Find allowed gain */
     for (int i = 0; i < gains_count; ++i) {
@@ -371,7 +449,6 @@ static int rtlsdr_find_tuner_gain(sdr_dev_t *dev, int centigain, int verbose)
     if (centigain > gains[gains_count - 1]) {
         centigain = gains[gains_count - 1];
     }
-    free(gains);
 
     return centigain;
 }
@@ -664,26 +741,35 @@ static int sdr_open_soapy(sdr_dev_t **out_dev, int *sample_size, char *dev_query
     if (verbose)
         soapysdr_show_device_info(dev->soapy_dev);
 
-    // select a stream format, in preference order: native CU8, CS8, CS16, forced CS16
+    // select a stream format, the native CU8, CS8, CS16 or CF32, else forced CS16
+    // the samples are passed on as read, the detector converts each format itself
     // stream_formats = SoapySDRDevice_getStreamFormats(dev->soapy_dev, SOAPY_SDR_RX, 0, &len);
     char *format = SoapySDRDevice_getNativeStreamFormat(dev->soapy_dev, SOAPY_SDR_RX, 0, &dev->fullScale);
     if (!strcmp(SOAPY_SDR_CU8, format)) {
         // actually not supported by SoapySDR
+        dev->sample_format = "CU8";
         *sample_size = sizeof(uint8_t); // CU8
     }
-//    else if (!strcmp(SOAPY_SDR_CS8, format)) {
-//        // TODO: CS8 needs conversion to CU8
-//        // e.g. RTL-SDR (8 bit), scale is 128.0
-//        *sample_size = sizeof(int8_t); // CS8
-//    }
+    else if (!strcmp(SOAPY_SDR_CS8, format)) {
+        // e.g. HackRF (8 bit), scale is 128.0
+        dev->sample_format = "CS8";
+        *sample_size = sizeof(int8_t); // CS8
+    }
     else if (!strcmp(SOAPY_SDR_CS16, format)) {
         // e.g. LimeSDR-mini (12 bit), native scale is 2048.0
         // e.g. SDRplay RSP1A (14 bit), native scale is 32767.0
+        dev->sample_format = "CS16";
         *sample_size = sizeof(int16_t); // CS16
     }
+    else if (!strcmp(SOAPY_SDR_CF32, format)) {
+        // e.g. Airspy, scale is 1.0
+        dev->sample_format = "CF32";
+        *sample_size = sizeof(float); // CF32
+    }
     else {
         // force CS16
         format = SOAPY_SDR_CS16;
+        dev->sample_format = "CS16";
         *sample_size = sizeof(int16_t); // CS16
         dev->fullScale = 32768.0; // assume max for SOAPY_SDR_CS16
     }
@@ -711,7 +797,7 @@ static int sdr_open_soapy(sdr_dev_t **out_dev, int *sample_size, char *dev_query
     return 0;
 }
 
-static int soapysdr_read_loop(sdr_dev_t *dev, sdr_read_cb_t cb, void *ctx, uint32_t buf_num, uint32_t buf_len)
+static int soapysdr_read_loop(sdr_dev_t *dev, uint32_t buf_num, uint32_t buf_len)
 {
     if (dev->buffer_size != buf_len) {
         free(dev->buffer);
@@ -722,7 +808,7 @@ static int soapysdr_read_loop(sdr_dev_t *dev, sdr_read_cb_t cb, void *ctx, uint3
         }
         dev->buffer_size = buf_len;
     }
-    int16_t *buffer = dev->buffer;
+    unsigned char *buffer = dev->buffer;
 
     size_t buf_elems = buf_len / 2 / dev->sample_size;
 
@@ -732,45 +818,32 @@ static int soapysdr_read_loop(sdr_dev_t *dev, sdr_read_cb_t cb, void *ctx, uint3
         int flags        = 0;
         long long timeNs = 0;
         long timeoutUs   = 1000000; // 1 second
-        unsigned n_read  = 0, i;
+        unsigned n_read  = 0;
         int r;
 
         do {
-            buffs[0] = &buffer[n_read * 2];
+            buffs[0] = &buffer[n_read * 2 * dev->sample_size];
             r  = SoapySDRDevice_readStream(dev->soapy_dev, dev->soapy_stream, buffs, buf_elems - n_read, &flags, &timeNs, timeoutUs);
             if (r < 0)
                 break;
+            if (n_read == 0 && (flags & SOAPY_SDR_HAS_TIME))
+                sdr_hw_time(dev, timeNs); // time of the first sample in the buffer
             n_read += r; // r is number of elements read, elements=complex pairs, so buffer length is twice
             //fprintf(stderr, "readStream ret=%d, flags=%d, timeNs=%lld (%zu - %u)\n", r, flags, timeNs, buf_elems, n_read);
         } while (n_read < buf_elems);
         //fprintf(stderr, "readStream ret=%d (%d), flags=%d, timeNs=%lld\n", n_read, buf_len, flags, timeNs);
-        if (r < 0) {
-            if (r == SOAPY_SDR_OVERFLOW) {
-                fprintf(stderr, "O");
-                fflush(stderr);
-                continue;
-            }
+        if (r < 0 && r != SOAPY_SDR_OVERFLOW)
             fprintf(stderr, "WARNING: sync read failed. %d\n", r);
-        }
 
-        // convert to CS16 or CU8 if needed
-        // if converting CS8 to CU8 -- vectorized with -O3
-        //for (i = 0; i < n_read * 2; ++i)
-        //    cu8buf[i] = (int8_t)cu8buf[i] + 128;
+        // the samples read before an overflow are good, the gap follows them
+        if (n_read > 0) // prevent a crash in callback
+            sdr_deliver(dev, buffer, n_read * 2 * dev->sample_size);
 
-        // rescale cs16 buffer
-        if (dev->fullScale >= 2047.0 && dev->fullScale <= 2048.0) {
-            for (i = 0; i < n_read * 2; ++i)
-                buffer[i] *= 16; // prevent left shift of negative value
+        if (r == SOAPY_SDR_OVERFLOW) {
+            fprintf(stderr, "O");
+            fflush(stderr);
+            dev->info.flags |= SDR_BUFFER_OVERFLOW;
         }
-        else if (dev->fullScale < 32767.0) {
-            int upscale = 32768 / dev->fullScale;
-            for (i = 0; i < n_read * 2; ++i)
-                buffer[i] *= upscale;
-        }
-
-        if (n_read > 0) // prevent a crash in callback
-            cb((unsigned char *)buffer, n_read * 2 * dev->sample_size, ctx);
 
     } while (dev->running);
 
@@ -860,6 +933,19 @@ int sdr_set_center_freq(sdr_dev_t *dev, uint32_t freq, int verbose)
     return r;
 }
 
+char const *sdr_get_sample_format(sdr_dev_t *dev, double *full_scale)
+{
+    if (!dev)
+        return NULL;
+
+    *full_scale = 128.0;
+#ifdef SOAPYSDR
+    if (dev->soapy_dev)
+        *full_scale = dev->fullScale;
+#endif
+    return dev->sample_format;
+}
+
 uint32_t sdr_get_center_freq(sdr_dev_t *dev)
 {
 #ifdef SOAPYSDR
@@ -974,6 +1060,72 @@ int sdr_set_tuner_gain(sdr_dev_t *dev, char *gain_str, int verbose)
     return r;
 }
 
+// rtl_tcp only sends the tuner type, these are the librtlsdr gain tables
+static int const rtltcp_gains_e4k[] = { -10, 15, 40, 65, 90, 115, 140, 165, 190, 215, 240, 290, 340, 420 };
+static int const rtltcp_gains_fc0012[] = { -99, -40, 71, 179, 192 };
+static int const rtltcp_gains_fc0013[] = { -99, -73, -65, -63, -60, -58, -54, 58, 61, 63, 65, 67, 68, 70, 71, 179, 181, 182, 184, 186, 188, 191, 197 };
+static int const rtltcp_gains_r82xx[] = { 0, 9, 14, 27, 37, 77, 87, 125, 144, 157, 166, 197, 207, 229, 254, 280, 297, 328, 338, 364, 372, 386, 402, 421, 434, 439, 445, 480, 496 };
+
+static int rtltcp_get_tuner_gains(sdr_dev_t *dev, int *gains, int max_gains)
+{
+    int const *table;
+    int count;
+
+    switch (dev->rtl_tcp_tuner) {
+    case 1: // E4000
+        table = rtltcp_gains_e4k;
+        count = sizeof(rtltcp_gains_e4k) / sizeof(*table);
+        break;
+    case 2: // FC0012
+        table = rtltcp_gains_fc0012;
+        count = sizeof(rtltcp_gains_fc0012) / sizeof(*table);
+        break;
+    case 3: // FC0013
+        table = rtltcp_gains_fc0013;
+        count = sizeof(rtltcp_gains_fc0013) / sizeof(*table);
+        break;
+    case 5: // R820T
+    case 6: // R828D
+        table = rtltcp_gains_r82xx;
+        count = sizeof(rtltcp_gains_r82xx) / sizeof(*table);
+        break;
+    default:
+        return -1;
+    }
+
+    if (count > max_gains)
+        count = max_gains;
+    memcpy(gains, table, count * sizeof(*gains));
+    return count;
+}
+
+int sdr_get_tuner_gains(sdr_dev_t *dev, int *gains, int max_gains)
+{
+    int r = -1;
+
+    if (dev->rtl_tcp)
+        return rtltcp_get_tuner_gains(dev, gains, max_gains);
+
+#ifdef RTLSDR
+    if (dev->rtlsdr_dev) {
+        int gains_count = rtlsdr_get_tuner_gains(dev->rtlsdr_dev, NULL);
+        if (gains_count < 1)
+            return -1;
+        int *all = calloc(gains_count, sizeof(int));
+        if (!all) {
+            WARN_CALLOC("sdr_get_tuner_gains()");
+            return -1; // NOTE: returns error on alloc failure.
+        }
+        rtlsdr_get_tuner_gains(dev->rtlsdr_dev, all);
+        r = gains_count < max_gains ? gains_count : max_gains;
+        memcpy(gains, all, r * sizeof(int));
+        free(all);
+    }
+#endif
+
+    return r;
+}
+
 int sdr_set_antenna(sdr_dev_t *dev, char *antenna_str, int verbose)
 {
     int r = -1;
@@ -1020,6 +1172,9 @@ int sdr_set_sample_rate(sdr_dev_t *dev, uint32_t rate, int verbose)
         r = rtlsdr_set_sample_rate(dev->rtlsdr_dev, rate);
 #endif
 
+    if (r >= 0)
+        dev->sample_rate = rate;
+
     if (verbose) {
         if (r < 0)
             fprintf(stderr, "WARNING: Failed to set sample rate.\n");
@@ -1134,19 +1289,33 @@ int sdr_reset(sdr_dev_t *dev, int verbose)
     return r;
 }
 
+#ifdef RTLSDR
+static void rtlsdr_read_cb(unsigned char *buf, uint32_t len, void *ctx)
+{
+    sdr_deliver(ctx, buf, len);
+}
+#endif
+
 int sdr_start(sdr_dev_t *dev, sdr_read_cb_t cb, void *ctx, uint32_t buf_num, uint32_t buf_len)
 {
+    dev->read_cb  = cb;
+    dev->read_ctx = ctx;
+    // a restart is no gap, the hardware time may jump
+    dev->next_time_ns = 0;
+    dev->info.flags = 0;
+    dev->info.lost  = 0;
+
     if (dev->rtl_tcp)
-        return rtltcp_read_loop(dev, cb, ctx, buf_num, buf_len);
+        return rtltcp_read_loop(dev, buf_num, buf_len);
 
 #ifdef SOAPYSDR
     if (dev->soapy_dev)
-        return soapysdr_read_loop(dev, cb, ctx, buf_num, buf_len);
+        return soapysdr_read_loop(dev, buf_num, buf_len);
 #endif
 
 #ifdef RTLSDR
     if (dev->rtlsdr_dev) {
-        int r = rtlsdr_read_async(dev->rtlsdr_dev, cb, ctx, buf_num, buf_len);
+        int r = rtlsdr_read_async(dev->rtlsdr_dev, rtlsdr_read_cb, dev, buf_num, buf_len);
         // rtlsdr_read_async() returns possible error codes from:
         //     if (!dev) return -1;
         //     if (RTLSDR_INACTIVE != dev->async_status) return -2;
@@ -0,0 +1,230 @@
+/** @file
+    Lock-free shared-memory ring of per-channel decimated samples.
+*/
+
+#include "shm_ring.h"
+#include "fatal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t shm_ring_map_size(unsigned channels, unsigned slots)
+{
+    return SHM_RING_HEADER_SIZE + (size_t)channels * slots * sizeof(shm_ring_sample_t)
+            + (size_t)slots * sizeof(shm_ring_frame_info_t);
+}
+
+shm_ring_t *shm_ring_create(char const *name, unsigned channels, unsigned slots,
+        uint32_t sample_rate, uint32_t decimation, float const *channel_freq)
+{
+    if (!channels || channels > SHM_RING_MAX_CHANNELS) {
+        fprintf(stderr, "shm ring: unsupported channel count %u\n", channels);
+        return NULL;
+    }
+
+    // round up to a power of two so the slot index is a mask
+    unsigned len = 1;
+    while (len < slots)
+        len <<= 1;
+    slots = len;
+
+    shm_ring_t *ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        WARN_CALLOC("shm_ring_create()");
+        return NULL;
+    }
+    ring->name     = strdup(name);
+    ring->writer   = 1;
+    ring->map_size = shm_ring_map_size(channels, slots);
+
+    // start from a fresh object so stale readers see the magic disappear
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        perror("shm_open");
+        free(ring->name);
+        free(ring);
+        return NULL;
+    }
+    if (ftruncate(fd, ring->map_size) < 0) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(name);
+        free(ring->name);
+        free(ring);
+        return NULL;
+    }
+    void *map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(name);
+        free(ring->name);
+        free(ring);
+        return NULL;
+    }
+
+    ring->hdr    = map;
+    ring->frames = (shm_ring_sample_t *)((char *)map + SHM_RING_HEADER_SIZE);
+    ring->info   = (shm_ring_frame_info_t *)&ring->frames[(size_t)channels * slots];
+
+    ring->hdr->version     = SHM_RING_VERSION;
+    ring->hdr->channels    = channels;
+    ring->hdr->slots       = slots;
+    ring->hdr->sample_rate = sample_rate;
+    ring->hdr->decimation  = decimation;
+    ring->hdr->generation  = 0;
+    for (unsigned i = 0; i < channels; ++i)
+        ring->hdr->channel_freq[i] = channel_freq[i];
+    ring->hdr->write_pos   = 0;
+    ring->hdr->reserve_pos = 0;
+    // readers check the magic last
+    __atomic_store_n(&ring->hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+    fprintf(stderr, "Publishing %u channels to shared memory %s (%u frames, %zu bytes)\n",
+            channels, name, slots, ring->map_size);
+
+    return ring;
+}
+
+shm_ring_t *shm_ring_attach(char const *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < SHM_RING_HEADER_SIZE) {
+        fprintf(stderr, "shm ring: %s is not a ring\n", name);
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    shm_ring_header_t *hdr = map;
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC
+            || hdr->version != SHM_RING_VERSION
+            || (size_t)st.st_size < shm_ring_map_size(hdr->channels, hdr->slots)) {
+        fprintf(stderr, "shm ring: %s has a bad header\n", name);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    shm_ring_t *ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        WARN_CALLOC("shm_ring_attach()");
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    ring->name     = strdup(name);
+    ring->map_size = st.st_size;
+    ring->hdr      = hdr;
+    ring->frames   = (shm_ring_sample_t *)((char *)map + SHM_RING_HEADER_SIZE);
+    ring->info     = (shm_ring_frame_info_t *)&ring->frames[(size_t)hdr->channels * hdr->slots];
+
+    // the oldest frame the writer is not about to overwrite
+    uint64_t rpos = __atomic_load_n(&hdr->reserve_pos, __ATOMIC_ACQUIRE);
+    ring->pos = rpos >= hdr->slots ? rpos - hdr->slots : 0;
+
+    return ring;
+}
+
+void shm_ring_set_channel_freq(shm_ring_t *ring, float const *channel_freq)
+{
+    shm_ring_header_t *hdr = ring->hdr;
+    uint32_t gen = hdr->generation;
+
+    // odd while the frequencies change
+    __atomic_store_n(&hdr->generation, gen + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (unsigned i = 0; i < hdr->channels; ++i)
+        __atomic_store(&hdr->channel_freq[i], &channel_freq[i], __ATOMIC_RELAXED);
+    __atomic_store_n(&hdr->generation, gen + 2, __ATOMIC_RELEASE);
+}
+
+uint32_t shm_ring_get_channel_freq(shm_ring_t *ring, float *channel_freq)
+{
+    shm_ring_header_t *hdr = ring->hdr;
+    uint32_t gen;
+
+    for (;;) {
+        gen = __atomic_load_n(&hdr->generation, __ATOMIC_ACQUIRE);
+        if (gen & 1)
+            continue;
+        for (unsigned i = 0; i < hdr->channels; ++i)
+            __atomic_load(&hdr->channel_freq[i], &channel_freq[i], __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&hdr->generation, __ATOMIC_RELAXED) == gen)
+            return gen;
+    }
+}
+
+void shm_ring_free(shm_ring_t *ring)
+{
+    if (!ring)
+        return;
+
+    munmap(ring->hdr, ring->map_size);
+    if (ring->writer)
+        shm_unlink(ring->name);
+    free(ring->name);
+    free(ring);
+}
+
+unsigned shm_ring_read(shm_ring_t *ring, shm_ring_sample_t *out, shm_ring_frame_info_t *info,
+        unsigned max_frames, uint64_t *lost)
+{
+    unsigned channels = ring->hdr->channels;
+    uint64_t slots    = ring->hdr->slots;
+    uint64_t wpos     = __atomic_load_n(&ring->hdr->write_pos, __ATOMIC_ACQUIRE);
+    uint64_t rpos     = __atomic_load_n(&ring->hdr->reserve_pos, __ATOMIC_ACQUIRE);
+
+    *lost = 0;
+    // the writer may be filling the slots of frames wpos - slots to rpos - slots right now
+    if (rpos > ring->pos + slots) {
+        *lost     = rpos - slots - ring->pos;
+        ring->pos = rpos - slots;
+    }
+    if (wpos < ring->pos)
+        wpos = ring->pos;
+
+    uint64_t avail = wpos - ring->pos;
+    unsigned n = avail < max_frames ? (unsigned)avail : max_frames;
+    size_t frame_size = channels * sizeof(shm_ring_sample_t);
+
+    for (unsigned i = 0; i < n; ++i) {
+        uint64_t slot = (ring->pos + i) & (slots - 1);
+        memcpy(&out[i * channels], &ring->frames[slot * channels], frame_size);
+        if (info)
+            info[i] = ring->info[slot];
+    }
+
+    // drop frames the writer overtook while we were copying
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t rpos2 = __atomic_load_n(&ring->hdr->reserve_pos, __ATOMIC_RELAXED);
+    if (rpos2 > ring->pos + slots) {
+        uint64_t torn = rpos2 - slots - ring->pos;
+        if (torn > n)
+            torn = n;
+        memmove(out, &out[torn * channels], (n - torn) * frame_size);
+        if (info)
+            memmove(info, &info[torn], (n - torn) * sizeof(*info));
+        *lost     += torn;
+        ring->pos += torn;
+        n         -= (unsigned)torn;
+    }
+
+    ring->pos += n;
+    return n;
+}
@@ -0,0 +1,189 @@
+/** @file
+    Sweep of the trigger and pulse counting settings over one replay.
+*/
+
+#include "sweep.h"
+#include "optparse.h"
+#include "fatal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define SWEEP_MAX_VALUES 64
+
+enum {
+    SWEEP_LEVEL,
+    SWEEP_MINSNR,
+    SWEEP_COUNT,
+    SWEEP_GAP,
+    SWEEP_REFRACTORY,
+    SWEEP_WINDOW,
+    SWEEP_SETTINGS,
+};
+
+static char const *const sweep_names[SWEEP_SETTINGS] = {
+        "level", "minsnr", "count", "gap", "refractory", "window",
+};
+
+typedef struct sweep_values {
+    double v[SWEEP_MAX_VALUES];
+    int n;
+} sweep_values_t;
+
+/// Parse colon separated values, returns -1 if there are none or too many.
+static int parse_values(char const *name, char *val, sweep_values_t *values)
+{
+    values->n = 0;
+    for (char *p = val; p && *p;) {
+        char *end;
+        double v = strtod(p, &end);
+        if (end == p || (*end && *end != ':') || values->n >= SWEEP_MAX_VALUES) {
+            fprintf(stderr, "Invalid sweep values \"%s=%s\"\n", name, val);
+            return -1;
+        }
+        values->v[values->n++] = v;
+        p = *end ? end + 1 : end;
+    }
+    if (!values->n) {
+        fprintf(stderr, "Sweep setting \"%s\" needs values\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+static void set_param(mrbeam_params_t *params, int setting, double v)
+{
+    switch (setting) {
+    case SWEEP_LEVEL:
+        params->levelDb = (float)v;
+        break;
+    case SWEEP_MINSNR:
+        params->minSnrDb = (float)v;
+        break;
+    case SWEEP_COUNT:
+        params->minCount = (int)v;
+        break;
+    case SWEEP_GAP:
+        params->maxGap = (int)v;
+        break;
+    case SWEEP_REFRACTORY:
+        params->refractory = (float)v;
+        break;
+    case SWEEP_WINDOW:
+        params->window = (int)v;
+        break;
+    }
+}
+
+int sweep_parse(sweep_t *sweep, char const *spec, mrbeam_params_t const *base)
+{
+    sweep_values_t values[SWEEP_SETTINGS] = {{{0}}};
+
+    char *copy = strdup(spec);
+    if (!copy)
+        FATAL_STRDUP("sweep_parse()");
+
+    int r = 0;
+    for (char *p = copy, *key, *val; !r && p && *p;) {
+        getkwargs(&p, &key, &val);
+        int setting = 0;
+        while (setting < SWEEP_SETTINGS && (!key || strcasecmp(key, sweep_names[setting])))
+            setting++;
+        if (setting == SWEEP_SETTINGS) {
+            fprintf(stderr, "Unknown sweep setting \"%s\"\n", key ? key : "");
+            r = -1;
+        }
+        else {
+            r = parse_values(key, val ? val : "", &values[setting]);
+        }
+    }
+    free(copy);
+    if (r)
+        return -1;
+
+    long count = 1;
+    for (int s = 0; s < SWEEP_SETTINGS; ++s)
+        count *= values[s].n ? values[s].n : 1;
+    if (count > SWEEP_MAX_SETS) {
+        fprintf(stderr, "Sweep of %ld parameter sets, at most %d\n", count, SWEEP_MAX_SETS);
+        return -1;
+    }
+
+    sweep->sets = calloc(count, sizeof(*sweep->sets));
+    if (!sweep->sets) {
+        WARN_CALLOC("sweep_parse()");
+        return -1;
+    }
+    sweep->count = (int)count;
+
+    // every combination, the last setting varies fastest
+    for (long k = 0; k < count; ++k) {
+        mrbeam_params_t *params = &sweep->sets[k].params;
+        *params = *base;
+        long rest = k;
+        for (int s = SWEEP_SETTINGS - 1; s >= 0; --s) {
+            if (!values[s].n)
+                continue;
+            set_param(params, s, values[s].v[rest % values[s].n]);
+            rest /= values[s].n;
+        }
+    }
+    return 0;
+}
+
+void sweep_event(int set, mrbeam_event_t const *ev, void *ctx)
+{
+    sweep_t *sweep = ctx;
+    sweep_set_t *s = &sweep->sets[set];
+
+    if (s->events == (unsigned)s->size) {
+        int size = s->size ? 2 * s->size : 16;
+        mrbeam_event_t *p = realloc(s->ev, size * sizeof(*p));
+        if (!p) {
+            WARN_REALLOC("sweep_event()");
+            return;
+        }
+        s->ev   = p;
+        s->size = size;
+    }
+    s->ev[s->events++] = *ev;
+    if (ev->channel >= 0 && ev->channel < MRBEAM_CHANNELS)
+        s->channel_events[ev->channel]++;
+}
+
+void sweep_report(sweep_t const *sweep, FILE *out, event_fmt_t *fmt)
+{
+    for (int k = 0; k < sweep->count; ++k) {
+        sweep_set_t const *s = &sweep->sets[k];
+        mrbeam_params_t const *p = &s->params;
+
+        fprintf(out, "set %d: level %g dB, minsnr %g dB, count %d, gap %d, refractory %g s, window %d: %u events",
+                k, p->levelDb, p->minSnrDb, p->minCount, p->maxGap, p->refractory, p->window, s->events);
+        char const *sep = " (";
+        for (int c = 0; c < MRBEAM_CHANNELS; ++c) {
+            if (s->channel_events[c]) {
+                fprintf(out, "%schannel %d: %u", sep, c, s->channel_events[c]);
+                sep = ", ";
+            }
+        }
+        fprintf(out, "%s\n", *sep == ',' ? ")" : "");
+
+        if (fmt->mode == EVENT_FMT_BINARY)
+            continue;
+        for (unsigned i = 0; i < s->events; ++i) {
+            char buf[EVENT_FMT_MAX];
+            int n = event_fmt_write(fmt, &s->ev[i], buf);
+            fprintf(out, "  %.*s", n, buf);
+        }
+    }
+}
+
+void sweep_free(sweep_t *sweep)
+{
+    for (int k = 0; k < sweep->count; ++k)
+        free(sweep->sets[k].ev);
+    free(sweep->sets);
+    sweep->sets  = NULL;
+    sweep->count = 0;
+}
@@ -0,0 +1,141 @@
+/** @file
+    Stall watchdog thread driven by per-stage heartbeats.
+*/
+
+#include "watchdog.h"
+#include "sample_clock.h"
+#include "fatal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+struct watchdog {
+    double timeout;
+    watchdog_stall_cb_t cb;
+    void *ctx;
+
+    watchdog_stage_t stages[WATCHDOG_MAX_STAGES];
+    int num_stages;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int stopping;
+};
+
+watchdog_t *watchdog_create(double timeout, watchdog_stall_cb_t cb, void *ctx)
+{
+    watchdog_t *wd = calloc(1, sizeof(*wd));
+    if (!wd) {
+        WARN_CALLOC("watchdog_create()");
+        return NULL;
+    }
+    wd->timeout = timeout;
+    wd->cb      = cb;
+    wd->ctx     = ctx;
+    pthread_mutex_init(&wd->lock, NULL);
+    pthread_cond_init(&wd->cond, NULL);
+    return wd;
+}
+
+watchdog_stage_t *watchdog_add_stage(watchdog_t *wd, char const *name)
+{
+    if (wd->num_stages >= WATCHDOG_MAX_STAGES)
+        return NULL;
+
+    watchdog_stage_t *stage = &wd->stages[wd->num_stages++];
+    memset(stage, 0, sizeof(*stage));
+    stage->name = name;
+    stage->idle = 1;
+    return stage;
+}
+
+static void watchdog_check(watchdog_t *wd)
+{
+    double now = mono_time();
+
+    for (int i = 0; i < wd->num_stages; ++i) {
+        watchdog_stage_t *stage = &wd->stages[i];
+        uint32_t beat = __atomic_load_n(&stage->beat, __ATOMIC_RELAXED);
+        int idle      = __atomic_load_n(&stage->idle, __ATOMIC_RELAXED);
+
+        if (idle || beat != stage->seen_beat) {
+            stage->seen_beat   = beat;
+            stage->last_change = now;
+            stage->reports     = 0;
+            continue;
+        }
+
+        double stalled = now - stage->last_change;
+        if (stalled >= wd->timeout * (stage->reports + 1)) {
+            stage->reports++;
+            wd->cb(stage, stalled, stage->reports, wd->ctx);
+        }
+    }
+}
+
+static void *watchdog_thread(void *arg)
+{
+    watchdog_t *wd = arg;
+    // a few samples per timeout keep the reported stall time accurate
+    long period_ms = (long)(wd->timeout * 1000 / 4);
+    if (period_ms < 10)
+        period_ms = 10;
+
+    pthread_mutex_lock(&wd->lock);
+    while (!wd->stopping) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec  += period_ms / 1000;
+        ts.tv_nsec += (period_ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&wd->cond, &wd->lock, &ts) != ETIMEDOUT)
+            continue;
+
+        pthread_mutex_unlock(&wd->lock);
+        watchdog_check(wd);
+        pthread_mutex_lock(&wd->lock);
+    }
+    pthread_mutex_unlock(&wd->lock);
+    return NULL;
+}
+
+int watchdog_start(watchdog_t *wd)
+{
+    double now = mono_time();
+    for (int i = 0; i < wd->num_stages; ++i)
+        wd->stages[i].last_change = now;
+
+    int r = pthread_create(&wd->thread, NULL, watchdog_thread, wd);
+    if (r) {
+        fprintf(stderr, "Failed to start watchdog thread: %s\n", strerror(r));
+        return -1;
+    }
+    wd->running = 1;
+    return 0;
+}
+
+void watchdog_free(watchdog_t *wd)
+{
+    if (!wd)
+        return;
+
+    if (wd->running) {
+        pthread_mutex_lock(&wd->lock);
+        wd->stopping = 1;
+        pthread_cond_signal(&wd->cond);
+        pthread_mutex_unlock(&wd->lock);
+        pthread_join(wd->thread, NULL);
+    }
+    pthread_cond_destroy(&wd->cond);
+    pthread_mutex_destroy(&wd->lock);
+    free(wd);
+}
@@ -0,0 +1,275 @@
+/** @file
+    An rtl_tcp server that replays a CU8 capture for tests.
+
+    Serves one client: sends the rtl_tcp header of an R820T tuner, then the
+    capture (or synthetic noise) as fast as the client reads it, scaled by
+    the tuner gain the client last set. The gain applies to the samples
+    sent after the command arrives, like a real tuner behind its USB and
+    socket buffers. Other commands are accepted and ignored.
+
+    Given a command, the server runs it once it listens, stops it with
+    SIGTERM once the client has read the whole input and exits with its
+    status, so a test is a single process to ctest:
+
+        rtl_tcp_emu -p 12345 -s 2 -n 20 -- rtl_mrbeam -d rtl_tcp:127.0.0.1:12345 -g agc
+
+    usage: rtl_tcp_emu [-p <port>] [-s <sigma> | -r <capture.cu8>] [-n <seconds>]
+                       [-G <reference dB>] [-e <min dB>:<max dB>] [-- <command> [<args>...]]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define EMU_SAMPLE_RATE 948000 // rtl_mrbeam's default
+#define EMU_BLOCK       16384  // bytes per send
+#define EMU_ZERO        127.4  // RTL-SDR zero
+
+#define RTLTCP_SET_GAIN_MODE 0x03
+#define RTLTCP_SET_GAIN      0x04
+
+// the librtlsdr R820T gain table, as rtl_mrbeam assumes for tuner type 5
+static int const emu_gains[] = { 0, 9, 14, 27, 37, 77, 87, 125, 144, 157, 166, 197, 207, 229, 254, 280, 297, 328, 338, 364, 372, 386, 402, 421, 434, 439, 445, 480, 496 };
+#define EMU_GAINS ((int)(sizeof(emu_gains) / sizeof(emu_gains[0])))
+
+typedef struct emu {
+    FILE *capture;      ///< capture to replay, NULL for noise
+    double sigma;       ///< noise sigma in counts at the reference gain
+    uint64_t left;      ///< bytes still to send
+    uint64_t rng;
+    double ref_gain;    ///< tenths of a dB that send the capture unchanged
+    int manual;         ///< manual gain mode
+    int gain;           ///< tenths of a dB, the last gain set
+    unsigned char cmd[5];
+    int cmd_len;
+} emu_t;
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: rtl_tcp_emu [-p <port>] [-s <sigma> | -r <capture.cu8>] [-n <seconds>]\n"
+            "                   [-G <reference dB>] [-e <min dB>:<max dB>] [-- <command> [<args>...]]\n");
+    exit(2);
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545f4914f6cdd1dULL;
+}
+
+/// About normal noise, the sum of four uniform values.
+static double noise(uint64_t *s)
+{
+    double sum = 0;
+    for (int k = 0; k < 4; ++k)
+        sum += (xorshift(s) >> 11) * (1.0 / 9007199254740992.0);
+    return (sum - 2.0) * sqrt(3.0);
+}
+
+/// Fill a block from the capture or with noise, scaled to the gain; returns the bytes.
+static size_t emu_block(emu_t *emu, unsigned char *buf)
+{
+    size_t len = emu->left < EMU_BLOCK ? (size_t)emu->left : EMU_BLOCK;
+    if (emu->capture) {
+        len = fread(buf, 1, len, emu->capture) & ~(size_t)1;
+        if (!len)
+            return 0;
+    }
+    else {
+        for (size_t k = 0; k < len; ++k)
+            buf[k] = (unsigned char)lround(EMU_ZERO + emu->sigma * noise(&emu->rng));
+    }
+
+    double scale = pow(10.0, ((emu->manual ? emu->gain : emu->ref_gain) - emu->ref_gain) / 200.0);
+    for (size_t k = 0; k < len; ++k) {
+        double v = round(EMU_ZERO + (buf[k] - EMU_ZERO) * scale);
+        buf[k] = (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+    emu->left -= len;
+    return len;
+}
+
+/// Take the commands that arrived, returns -1 once the client is gone.
+static int emu_commands(emu_t *emu, int sock)
+{
+    for (;;) {
+        ssize_t r = recv(sock, &emu->cmd[emu->cmd_len], sizeof(emu->cmd) - emu->cmd_len, MSG_DONTWAIT);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (r <= 0)
+            return -1;
+        emu->cmd_len += (int)r;
+        if (emu->cmd_len < (int)sizeof(emu->cmd))
+            continue;
+        emu->cmd_len = 0;
+
+        uint32_t param = (uint32_t)emu->cmd[1] << 24 | (uint32_t)emu->cmd[2] << 16 | (uint32_t)emu->cmd[3] << 8 | emu->cmd[4];
+        if (emu->cmd[0] == RTLTCP_SET_GAIN_MODE) {
+            emu->manual = param != 0;
+        }
+        else if (emu->cmd[0] == RTLTCP_SET_GAIN) {
+            emu->gain = (int)(int32_t)param;
+            fprintf(stderr, "rtl_tcp_emu: gain %.1f dB\n", emu->gain / 10.0);
+        }
+    }
+}
+
+/// Send the input to the client until it ends or the client goes away, returns 0 if it ended.
+static int emu_serve(emu_t *emu, int sock)
+{
+    unsigned char header[12] = {'R', 'T', 'L', '0', 0, 0, 0, 5, 0, 0, 0, EMU_GAINS};
+    if (send(sock, header, sizeof(header), MSG_NOSIGNAL) != sizeof(header))
+        return -1;
+
+    unsigned char buf[EMU_BLOCK];
+    size_t len = 0, sent = 0;
+    for (;;) {
+        struct pollfd p = {.fd = sock, .events = POLLIN | POLLOUT};
+        if (poll(&p, 1, 1000) < 0 && errno != EINTR)
+            return -1;
+        if ((p.revents & (POLLIN | POLLHUP | POLLERR)) && emu_commands(emu, sock) < 0)
+            return -1;
+        if (!(p.revents & POLLOUT))
+            continue;
+        if (sent == len) {
+            len  = emu_block(emu, buf);
+            sent = 0;
+            if (!len)
+                break;
+        }
+        ssize_t r = send(sock, &buf[sent], len - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+        if (r > 0)
+            sent += (size_t)r;
+    }
+
+    // the client has all of it once the send queue is empty
+    int queued = 1;
+    while (queued > 0 && ioctl(sock, SIOCOUTQ, &queued) == 0 && emu_commands(emu, sock) == 0)
+        usleep(10000);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    emu_t emu = {.sigma = 2.0, .rng = 0x9e3779b97f4a7c15ULL, .manual = 0};
+    int port = 1234;
+    double seconds = 10;
+    double min_gain = -1e9, max_gain = 1e9;
+    char const *capture = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:s:r:n:G:e:")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 's':
+            emu.sigma = atof(optarg);
+            break;
+        case 'r':
+            capture = optarg;
+            break;
+        case 'n':
+            seconds = atof(optarg);
+            break;
+        case 'G':
+            emu.ref_gain = atof(optarg) * 10;
+            break;
+        case 'e':
+            if (sscanf(optarg, "%lf:%lf", &min_gain, &max_gain) != 2)
+                usage();
+            break;
+        default:
+            usage();
+        }
+    }
+    emu.left = (uint64_t)(seconds * EMU_SAMPLE_RATE) * 2;
+    emu.gain = (int)emu.ref_gain;
+
+    if (capture) {
+        emu.capture = fopen(capture, "rb");
+        if (!emu.capture) {
+            perror(capture);
+            return 1;
+        }
+    }
+
+    int srv = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (srv < 0 || bind(srv, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(srv, 1) < 0) {
+        perror("rtl_tcp_emu");
+        return 1;
+    }
+
+    pid_t child = 0;
+    if (optind < argc) {
+        child = fork();
+        if (child < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (child == 0) {
+            close(srv);
+            execvp(argv[optind], &argv[optind]);
+            perror(argv[optind]);
+            _exit(127);
+        }
+    }
+
+    // a client that fails to connect must not leave the test waiting
+    struct pollfd p = {.fd = srv, .events = POLLIN};
+    int status;
+    while (poll(&p, 1, 1000) == 0) {
+        if (child && waitpid(child, &status, WNOHANG) == child) {
+            fprintf(stderr, "rtl_tcp_emu: %s exited before connecting\n", argv[optind]);
+            return 1;
+        }
+    }
+    int sock = accept(srv, NULL, NULL);
+    close(srv);
+    if (sock < 0) {
+        perror("accept");
+        return 1;
+    }
+    int ended = emu_serve(&emu, sock) == 0;
+    if (child && ended)
+        kill(child, SIGTERM);
+    if (emu.capture)
+        fclose(emu.capture);
+
+    int r = 0;
+    if (child) {
+        if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status)) {
+            fprintf(stderr, "rtl_tcp_emu: %s did not exit\n", argv[optind]);
+            return 1;
+        }
+        r = WEXITSTATUS(status);
+    }
+    close(sock);
+    fprintf(stderr, "rtl_tcp_emu: final gain %.1f dB (%s)\n", emu.gain / 10.0, emu.manual ? "manual" : "auto");
+    if (emu.gain < min_gain * 10 - 0.5 || emu.gain > max_gain * 10 + 0.5) {
+        fprintf(stderr, "rtl_tcp_emu: the final gain is not within %.1f to %.1f dB\n", min_gain, max_gain);
+        r = 1;
+    }
+    return r;
+}